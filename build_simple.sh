@@ -70,7 +70,9 @@ em++ -std=gnu++11 -DNDEBUG -O2 -Wno-deprecated-declarations $1 $2 $3 \
   src/search/stage0.cpp \
   src/data/seed_array.cpp \
   src/output/paf_format.cpp \
+  src/output/column_format.cpp \
   src/util/system/system.cpp \
+  src/util/system/buffer_pool.cpp \
   src/run/cluster.cpp \
   src/util/algo/greedy_vortex_cover.cpp \
   src/util/algo/greedy_vortex_cover_weighted.cpp \
@@ -81,4 +83,5 @@ em++ -std=gnu++11 -DNDEBUG -O2 -Wno-deprecated-declarations $1 $2 $3 \
   src/util/math/sparse_matrix.cpp \
   src/lib/tantan/LambdaCalculator.cc \
   src/data/taxonomy_filter.cpp \
+  src/run/work_queue.cpp \
 -lz -s USE_ZLIB=1 -s WASM=1 -o diamond.html
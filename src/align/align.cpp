@@ -17,6 +17,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ****/
 
 #include <memory>
+#include <algorithm>
 #include "../basic/value.h"
 #include "align.h"
 #include "../data/reference.h"
@@ -30,23 +31,57 @@ using namespace std;
 
 DpStat dp_stat;
 
+// Hands out the queries of a chunk to the alignment threads. Unless the input order is requested, the queries are
+// scheduled longest first (or by the number of trace points times the query length), so that no expensive query is
+// started right before the end of the chunk. The output sink restores the input order.
 struct Align_fetcher
 {
 	static void init(size_t qbegin, size_t qend, vector<hit>::iterator begin, vector<hit>::iterator end)
 	{
 		it_ = begin;
 		end_ = end;
-		queue_ = unique_ptr<Queue>(new Queue(qbegin, qend));
+		order_.clear();
+		offsets_.clear();
+		if (config.query_order == Config::input_order) {
+			queue_ = unique_ptr<Queue>(new Queue(qbegin, qend));
+			return;
+		}
+		const unsigned c = align_mode.query_contexts;
+		vector<pair<uint64_t, unsigned>> work;
+		work.reserve(qend - qbegin);
+		offsets_.reserve(qend - qbegin + 1);
+		vector<hit>::iterator it = begin;
+		for (size_t q = qbegin; q < qend; ++q) {
+			offsets_.push_back(it - begin);
+			while (it < end && it->query_ / c == q)
+				++it;
+			const uint64_t len = get_source_query_len((unsigned)q),
+				n = it - (begin + offsets_.back());
+			work.emplace_back(config.query_order == Config::longest_first ? len : n * len, (unsigned)q);
+		}
+		offsets_.push_back(it - begin);
+		std::stable_sort(work.begin(), work.end(), [](const pair<uint64_t, unsigned> &x, const pair<uint64_t, unsigned> &y) { return x.first > y.first; });
+		order_.reserve(work.size());
+		for (vector<pair<uint64_t, unsigned>>::const_iterator i = work.begin(); i < work.end(); ++i)
+			order_.push_back(i->second);
+		qbegin_ = qbegin;
+		queue_ = unique_ptr<Queue>(new Queue(0, order_.size()));
 	}
-	bool operator()(size_t query)
+	bool operator()(size_t n)
 	{
-		const unsigned q = (unsigned)query,
-			c = align_mode.query_contexts;
-		begin = it_;
-		while (it_ < end_ && it_->query_ / c == q)
-			++it_;
-		end = it_;
-		this->query = query;
+		const unsigned c = align_mode.query_contexts;
+		if (order_.empty()) {
+			query = n;
+			begin = it_;
+			while (it_ < end_ && it_->query_ / c == query)
+				++it_;
+			end = it_;
+		}
+		else {
+			query = order_[n];
+			begin = it_ + offsets_[query - qbegin_];
+			end = it_ + offsets_[query - qbegin_ + 1];
+		}
 		target_parallel = (end - begin > config.query_parallel_limit) && config.frame_shift != 0 && align_mode.mode == Align_mode::blastx && config.toppercent < 100 && config.query_range_culling;
 		return target_parallel;
 	}
@@ -64,11 +99,17 @@ struct Align_fetcher
 private:	
 	static vector<hit>::iterator it_, end_;
 	static unique_ptr<Queue> queue_;
+	static vector<unsigned> order_;
+	static vector<size_t> offsets_;
+	static size_t qbegin_;
 };
 
 unique_ptr<Queue> Align_fetcher::queue_;
 vector<hit>::iterator Align_fetcher::it_;
 vector<hit>::iterator Align_fetcher::end_;
+vector<unsigned> Align_fetcher::order_;
+vector<size_t> Align_fetcher::offsets_;
+size_t Align_fetcher::qbegin_;
 
 void align_worker(size_t thread_id, const Parameters *params, const Metadata *metadata)
 {
@@ -79,7 +120,7 @@ void align_worker(size_t thread_id, const Parameters *params, const Metadata *me
 		if (hits.end == hits.begin) {
 			TextBuffer *buf = 0;
 			if (!blocked_processing && *output_format != Output_format::daa && config.report_unaligned != 0) {
-				buf = new TextBuffer;
+				buf = OutputSink::get().get_buffer();
 				const char *query_title = query_ids::get()[hits.query].c_str();
 				output_format->print_query_intro(hits.query, query_title, get_source_query_len((unsigned)hits.query), *buf, true);
 				output_format->print_query_epilog(*buf, query_title, true, *params);
@@ -103,7 +144,7 @@ void align_worker(size_t thread_id, const Parameters *params, const Metadata *me
 		timer.go("Generating output");
 		TextBuffer *buf = 0;
 		if (*output_format != Output_format::null) {
-			buf = new TextBuffer;
+			buf = OutputSink::get().get_buffer();
 			const bool aligned = mapper->generate_output(*buf, stat, *metadata);
 			if (aligned && (!config.unaligned.empty() || !config.aligned_file.empty())) {
 				query_aligned_mtx.lock();
@@ -102,41 +102,45 @@ struct Target : public ::Target
 		inner_culling(mapper.raw_score_cutoff());
 	}
 
-	bool is_outranked(const IntervalPartition &ip, int source_query_len, double rr) const
-	{
-		const interval r = ungapped_query_range(source_query_len);
-		if (config.toppercent == 100.0) {
-			const int min_score = int((double)filter_score / rr);
-			return (double)ip.covered(r, min_score, IntervalPartition::MinScore()) / r.length() * 100.0 >= config.query_range_cover;
-		}
-		else {
-			const int min_score = int((double)filter_score / rr / (1.0 - config.toppercent / 100.0));
-			return (double)ip.covered(r, min_score, IntervalPartition::MaxScore()) / r.length() * 100.0 >= config.query_range_cover;
-		}
-	}
-
 };
 
 void Pipeline::range_ranking()
 {
 	const double rr = config.rank_ratio == -1 ? 0.4 : config.rank_ratio;
-	std::stable_sort(targets.begin(), targets.end(), Target::compare);
+	sort_targets();
+	const size_t n = targets.size();
+	vector<interval> &query_range = target_arrays.query_range;
+	query_range.resize(n);
+	for (size_t i = 0; i < n; ++i)
+		query_range[i] = target(i).ungapped_query_range(source_query_len);
 	IntervalPartition ip((int)std::min(config.max_alignments, (uint64_t)INT_MAX));
-	for (PtrVector< ::Target>::iterator i = targets.begin(); i < targets.end();) {
-		Target* t = ((Target*)*i);
-		if (t->is_outranked(ip, source_query_len, rr)) {
+	size_t j = 0;
+	for (size_t i = 0; i < n; ++i) {
+		const interval r = query_range[i];
+		const int filter_score = target_arrays.filter_score[i];
+		bool outranked;
+		if (config.toppercent == 100.0) {
+			const int min_score = int((double)filter_score / rr);
+			outranked = (double)ip.covered(r, min_score, IntervalPartition::MinScore()) / r.length() * 100.0 >= config.query_range_cover;
+		}
+		else {
+			const int min_score = int((double)filter_score / rr / (1.0 - config.toppercent / 100.0));
+			outranked = (double)ip.covered(r, min_score, IntervalPartition::MaxScore()) / r.length() * 100.0 >= config.query_range_cover;
+		}
+		if (outranked) {
 			if (config.benchmark_ranking) {
-				t->outranked = true;
-				++i;
+				targets[i].outranked = true;
+				targets.get(j++) = targets.get(i);
 			}
 			else
-				i = targets.erase(i, i + 1);
+				delete targets.get(i);
 		}
 		else {
-			ip.insert(t->ungapped_query_range(source_query_len), t->filter_score);
-			++i;
-		}			
+			ip.insert(r, filter_score);
+			targets.get(j++) = targets.get(i);
+		}
 	}
+	static_cast<vector< ::Target*>&>(targets).resize(j);
 }
 
 Target& Pipeline::target(size_t i)
@@ -158,13 +162,12 @@ void Pipeline::run_swipe(bool score_only)
 	}
 }
 
-void build_ranking_worker(PtrVector<::Target>::iterator begin, PtrVector<::Target>::iterator end, Atomic<size_t> *next, vector<unsigned> *intervals) {
-	PtrVector<::Target>::iterator it;
-	while ((it = begin + next->post_add(64)) < end) {
-		auto e = min(it + 64, end);
-		for (; it < e; ++it) {
-			(*it)->add_ranges(*intervals);
-		}
+void build_ranking_worker(const TargetArrays *targets, size_t n, Atomic<size_t> *next, vector<unsigned> *intervals) {
+	size_t i;
+	while ((i = next->post_add(64)) < n) {
+		const size_t e = min(i + 64, n);
+		for (; i < e; ++i)
+			targets->add_ranges(i, *intervals);
 	}
 }
 
@@ -198,6 +201,7 @@ void Pipeline::run(Statistics &stat)
 
 		if (target_parallel) {
 			timer.go("Building score ranking intervals");
+			target_arrays.gather_hsps(targets);
 			vector<vector<unsigned>> intervals(config.threads_);
 			const size_t interval_count = (source_query_len + ::Target::INTERVAL - 1) / ::Target::INTERVAL;
 			for (vector<unsigned> &v : intervals)
@@ -205,7 +209,7 @@ void Pipeline::run(Statistics &stat)
 			vector<thread> threads;
 			Atomic<size_t> next(0);
 			for (unsigned i = 0; i < config.threads_; ++i)
-				threads.emplace_back(build_ranking_worker, targets.begin(), targets.end(), &next, &intervals[i]);
+				threads.emplace_back(build_ranking_worker, &target_arrays, targets.size(), &next, &intervals[i]);
 			for (auto &t : threads)
 				t.join();
 
@@ -217,10 +221,10 @@ void Pipeline::run(Statistics &stat)
 			}
 
 			timer.go("Finding outranked targets");
-			for (auto i = targets.begin(); i < targets.end(); ++i)
-				if ((*i)->is_outranked(intervals[0], 1.0 - config.toppercent / 100)) {
-					delete *i;
-					*i = nullptr;
+			for (size_t i = 0; i < targets.size(); ++i)
+				if (target_arrays.is_outranked(i, intervals[0], 1.0 - config.toppercent / 100)) {
+					delete targets.get(i);
+					targets.get(i) = nullptr;
 				}
 
 			timer.go("Removing outranked targets");
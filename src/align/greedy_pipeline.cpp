@@ -32,7 +32,8 @@ struct Target : public ::Target
 	{
 		if (config.log_subject)
 			cout << "Subject = " << ref_ids::get()[subject_id].c_str() << endl;
-		std::stable_sort(mapper.seed_hits.begin() + begin, mapper.seed_hits.begin() + end, Seed_hit::compare_diag);
+		if (end - begin > 1)
+			std::stable_sort(mapper.seed_hits.begin() + begin, mapper.seed_hits.begin() + end, Seed_hit::compare_diag);
 		typedef Map<vector<Seed_hit>::const_iterator, Seed_hit::Frame> Hit_map;
 		Hit_map hit_map(mapper.seed_hits.begin() + begin, mapper.seed_hits.begin() + end);
 		for (Hit_map::Iterator it = hit_map.begin(); it.valid(); ++it) {
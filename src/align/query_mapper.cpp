@@ -28,6 +28,12 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 using namespace std;
 
+// Per-thread storage reused by the mappers of consecutive queries, so that the query profiles and the scratch space of
+// the seed hit extension keep their capacity instead of being reallocated for each query.
+static thread_local vector<Bias_correction> query_cb_buffer;
+static thread_local vector<Long_score_profile> profile_buffer;
+static thread_local TargetArrays target_arrays_buffer;
+
 bool Target::envelopes(const Hsp_traits &t, double p) const
 {
 	for (list<Hsp_traits>::const_iterator i = ts.begin(); i != ts.end(); ++i)
@@ -52,21 +58,39 @@ bool Target::is_enveloped(PtrVector<Target>::const_iterator begin, PtrVector<Tar
 	return false;
 }
 
-void Target::add_ranges(vector<unsigned> &v) {
-	for (const Hsp &hsp : hsps) {
-		const int i0 = hsp.query_source_range.begin_ / INTERVAL,
-			i1 = min(hsp.query_source_range.end_ / INTERVAL, int(v.size() - 1));
-		for (int i = i0; i <= i1; ++i)
-			v[i] = max(v[i], hsp.score);
+void TargetArrays::gather_hsps(const PtrVector<Target> &targets)
+{
+	const size_t n = targets.size();
+	hsp_begin.resize(n + 1);
+	hsp_range.clear();
+	hsp_score.clear();
+	for (size_t i = 0; i < n; ++i) {
+		hsp_begin[i] = hsp_range.size();
+		for (const Hsp &hsp : targets[i].hsps) {
+			hsp_range.push_back(hsp.query_source_range);
+			hsp_score.push_back(hsp.score);
+		}
 	}
+	hsp_begin[n] = hsp_range.size();
 }
 
-bool Target::is_outranked(const vector<unsigned> &v, double treshold) {
-	for (const Hsp &hsp : hsps) {
-		const int i0 = hsp.query_source_range.begin_ / INTERVAL,
-			i1 = min(hsp.query_source_range.end_ / INTERVAL, int(v.size() - 1));
-		for (int i = i0; i <= i1; ++i)
-			if (hsp.score >= unsigned(v[i] * treshold))
+void TargetArrays::add_ranges(size_t i, vector<unsigned> &v) const
+{
+	for (size_t j = hsp_begin[i]; j < hsp_begin[i + 1]; ++j) {
+		const int i0 = hsp_range[j].begin_ / Target::INTERVAL,
+			i1 = min(hsp_range[j].end_ / Target::INTERVAL, int(v.size() - 1));
+		for (int k = i0; k <= i1; ++k)
+			v[k] = max(v[k], hsp_score[j]);
+	}
+}
+
+bool TargetArrays::is_outranked(size_t i, const vector<unsigned> &v, double treshold) const
+{
+	for (size_t j = hsp_begin[i]; j < hsp_begin[i + 1]; ++j) {
+		const int i0 = hsp_range[j].begin_ / Target::INTERVAL,
+			i1 = min(hsp_range[j].end_ / Target::INTERVAL, int(v.size() - 1));
+		for (int k = i0; k <= i1; ++k)
+			if (hsp_score[j] >= unsigned(v[k] * treshold))
 				return false;
 	}
 	return true;
@@ -84,6 +108,9 @@ QueryMapper::QueryMapper(const Parameters &params, size_t query_id, Trace_pt_lis
 	targets_finished(0),
 	next_target(0),
 	source_query_len(get_source_query_len((unsigned)query_id)),
+	query_cb(query_cb_buffer),
+	profile(profile_buffer),
+	target_arrays(target_arrays_buffer),
 	translated_query(get_translated_query(query_id)),
 	target_parallel(target_parallel)
 {
@@ -94,13 +121,28 @@ void QueryMapper::init()
 {
 	if(config.log_query)
 		cout << "Query = " << query_ids::get()[query_id].c_str() << endl;
-	if (config.comp_based_stats == 1)
+	// The bias corrections and profiles are only needed for the contexts that have seed hits. For translated
+	// searches this is usually a small subset of the six frames. The slots of the other contexts still hold the data
+	// of an earlier query of this thread, they are emptied (keeping their capacity) so that they cannot be read.
+	bool has_hits[6] = { false, false, false, false, false, false };
+	for (Trace_pt_list::iterator i = source_hits.first; i < source_hits.second; ++i)
+		has_hits[i->query_ % align_mode.query_contexts] = true;
+	if (config.comp_based_stats == 1) {
+		query_cb.resize(align_mode.query_contexts);
 		for (unsigned i = 0; i < align_mode.query_contexts; ++i)
-			query_cb.emplace_back(query_seq(i));
-	if (config.ext == Config::greedy || config.ext == Config::more_greedy)
+			if (has_hits[i])
+				query_cb[i].set(query_seq(i));
+			else
+				query_cb[i].clear();
+	}
+	if (config.ext == Config::greedy || config.ext == Config::more_greedy) {
+		profile.resize(align_mode.query_contexts);
 		for (unsigned i = 0; i < align_mode.query_contexts; ++i)
-			profile.emplace_back(query_seq(i));
-			//profile.push_back(Long_score_profile());
+			if (has_hits[i])
+				profile[i].set(query_seq(i));
+			else
+				profile[i].clear();
+	}
 	targets.resize(count_targets());
 	if (targets.empty())
 		return;
@@ -114,32 +156,102 @@ unsigned QueryMapper::count_targets()
 	const Trace_pt_list::iterator hits = source_hits.first;
 	size_t subject_id = std::numeric_limits<size_t>::max();
 	unsigned n_subject = 0;
+	static thread_local vector<std::pair<size_t, size_t>> l;
+	static thread_local vector<unsigned> frame;
+	l.resize(n);
+	frame.resize(n);
 	for (size_t i = 0; i < n; ++i) {
-		std::pair<size_t, size_t> l = ref_seqs::data_->local_position(hits[i].subject_);
-		const unsigned frame = hits[i].query_ % align_mode.query_contexts;
-		/*const Diagonal_segment d = config.comp_based_stats ? xdrop_ungapped(query_seq(frame), query_cb[frame], ref_seqs::get()[l.first], hits[i].seed_offset_, (int)l.second)
-			: xdrop_ungapped(query_seq(frame), ref_seqs::get()[l.first], hits[i].seed_offset_, (int)l.second);*/
-		if (target_parallel) {
-			seed_hits.emplace_back(frame, (unsigned)l.first, (unsigned)l.second, (unsigned)hits[i].seed_offset_, Diagonal_segment());
-			if (l.first != subject_id) {
-				subject_id = l.first;
+		l[i] = ref_seqs::data_->local_position(hits[i].subject_);
+		frame[i] = hits[i].query_ % align_mode.query_contexts;
+	}
+	if (target_parallel) {
+		for (size_t i = 0; i < n; ++i) {
+			seed_hits.emplace_back(frame[i], (unsigned)l[i].first, (unsigned)l[i].second, (unsigned)hits[i].seed_offset_, Diagonal_segment());
+			if (l[i].first != subject_id) {
+				subject_id = l[i].first;
 				++n_subject;
 			}
 		}
-		else {
-			const Diagonal_segment d = xdrop_ungapped(query_seq(frame), ref_seqs::get()[l.first], hits[i].seed_offset_, (int)l.second);
-			if (d.score >= config.min_ungapped_raw_score) {
-				if (l.first != subject_id) {
-					subject_id = l.first;
-					++n_subject;
-				}
-				seed_hits.emplace_back(frame, (unsigned)l.first, (unsigned)l.second, (unsigned)hits[i].seed_offset_, d);
+		return n_subject;
+	}
+	/*const Diagonal_segment d = config.comp_based_stats ? xdrop_ungapped(query_seq(frame), query_cb[frame], ref_seqs::get()[l.first], hits[i].seed_offset_, (int)l.second)
+		: xdrop_ungapped(query_seq(frame), ref_seqs::get()[l.first], hits[i].seed_offset_, (int)l.second);*/
+	static thread_local vector<Diagonal_segment> ungapped;
+	ungapped.resize(n);
+	extend_seed_hits(l, frame, ungapped);
+	for (size_t i = 0; i < n; ++i) {
+		if (ungapped[i].score >= config.min_ungapped_raw_score) {
+			if (l[i].first != subject_id) {
+				subject_id = l[i].first;
+				++n_subject;
 			}
+			seed_hits.emplace_back(frame[i], (unsigned)l[i].first, (unsigned)l[i].second, (unsigned)hits[i].seed_offset_, ungapped[i]);
 		}
 	}
 	return n_subject;
 }
 
+void QueryMapper::extend_seed_hits(const vector<std::pair<size_t, size_t>> &l, const vector<unsigned> &frame, vector<Diagonal_segment> &ungapped)
+{
+	const size_t n = l.size();
+	const Trace_pt_list::iterator hits = source_hits.first;
+	static thread_local vector<size_t> order;
+	static thread_local vector<std::pair<size_t, size_t>> runs;
+	order.resize(n);
+	for (size_t i = 0; i < n; ++i)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&l, &frame, hits](size_t a, size_t b) {
+		const int da = (int)hits[a].seed_offset_ - (int)l[a].second, db = (int)hits[b].seed_offset_ - (int)l[b].second;
+		return l[a].first < l[b].first
+			|| (l[a].first == l[b].first && (frame[a] < frame[b]
+			|| (frame[a] == frame[b] && (da < db
+			|| (da == db && (l[a].second < l[b].second || (l[a].second == l[b].second && a < b)))))));
+	});
+
+	// Runs of hits on the same subject, frame and diagonal, ordered by position. In each round the first unresolved
+	// hit of every run is extended, the following hits whose seed lies inside its segment are not extended again.
+	runs.clear();
+	for (size_t i = 0; i < n;) {
+		const size_t a = order[i];
+		size_t j = i + 1;
+		while (j < n && l[order[j]].first == l[a].first && frame[order[j]] == frame[a]
+			&& (int)hits[order[j]].seed_offset_ - (int)l[order[j]].second == (int)hits[a].seed_offset_ - (int)l[a].second)
+			++j;
+		runs.emplace_back(i, j);
+		i = j;
+	}
+
+	static thread_local vector<const Letter*> query, subject;
+	static thread_local vector<int> score, delta, len;
+	while (!runs.empty()) {
+		const size_t m = runs.size();
+		query.resize(m);
+		subject.resize(m);
+		score.resize(m);
+		delta.resize(m);
+		len.resize(m);
+		for (size_t r = 0; r < m; ++r) {
+			const size_t h = order[runs[r].first];
+			query[r] = query_seq(frame[h]).data() + hits[h].seed_offset_;
+			subject[r] = ref_seqs::get()[l[h].first].data() + l[h].second;
+		}
+		xdrop_ungapped(query.data(), subject.data(), m, score.data(), delta.data(), len.data());
+		size_t k = 0;
+		for (size_t r = 0; r < m; ++r) {
+			const size_t h = order[runs[r].first];
+			const int qa = (int)hits[h].seed_offset_, sa = (int)l[h].second;
+			const Diagonal_segment d(qa - delta[r], sa - delta[r], len[r], score[r]);
+			ungapped[h] = d;
+			size_t i = runs[r].first + 1;
+			for (; i < runs[r].second && (int)hits[order[i]].seed_offset_ < d.query_end(); ++i)
+				ungapped[order[i]] = d;
+			if (i < runs[r].second)
+				runs[k++] = std::make_pair(i, runs[r].second);
+		}
+		runs.resize(k);
+	}
+}
+
 void QueryMapper::load_targets()
 {
 	unsigned subject_id = std::numeric_limits<unsigned>::max(), n = 0;
@@ -156,23 +268,45 @@ void QueryMapper::load_targets()
 	targets[n - 1].end = seed_hits.size();
 }
 
+void QueryMapper::sort_targets()
+{
+	// The filter score (descending) and the subject id are packed into one integer key. Subject ids are unique within
+	// the targets of a query.
+	static thread_local vector<pair<uint64_t, unsigned>> keys;
+	static thread_local vector<Target*> v;
+	const size_t n = targets.size();
+	keys.resize(n);
+	for (size_t i = 0; i < n; ++i)
+		keys[i] = std::make_pair(uint64_t(~((uint32_t)targets[i].filter_score ^ 0x80000000u)) << 32 | targets[i].subject_id, (unsigned)i);
+	std::sort(keys.begin(), keys.end());
+	v.assign(targets.begin(), targets.end());
+	target_arrays.filter_score.resize(n);
+	target_arrays.subject_id.resize(n);
+	for (size_t i = 0; i < n; ++i) {
+		targets.get(i) = v[keys[i].second];
+		target_arrays.filter_score[i] = int(~(uint32_t)(keys[i].first >> 32) ^ 0x80000000u);
+		target_arrays.subject_id[i] = (unsigned)keys[i].first;
+	}
+}
+
 void QueryMapper::rank_targets(double ratio, double factor)
 {
-	std::stable_sort(targets.begin(), targets.end(), Target::compare);
+	sort_targets();
+	const vector<int> &filter_score = target_arrays.filter_score;
 
 	int score = 0;
 	if (config.toppercent < 100) {
-		score = int((double)targets[0].filter_score * (1.0 - config.toppercent / 100.0) * ratio);
+		score = int((double)filter_score[0] * (1.0 - config.toppercent / 100.0) * ratio);
 	}
 	else {
 		size_t min_idx = std::min(targets.size(), (size_t)config.max_alignments);
-		score = int((double)targets[min_idx - 1].filter_score * ratio);
+		score = int((double)filter_score[min_idx - 1] * ratio);
 	}
 
 	const size_t cap = (config.toppercent < 100 || config.max_alignments == std::numeric_limits<uint64_t>::max()) ? std::numeric_limits<uint64_t>::max() : size_t(config.max_alignments*factor);
 	size_t i = 0;
 	for (; i < targets.size(); ++i)
-		if (targets[i].filter_score < score || i >= cap)
+		if (filter_score[i] < score || i >= cap)
 			break;
 
 	if (config.benchmark_ranking)
@@ -184,34 +318,43 @@ void QueryMapper::rank_targets(double ratio, double factor)
 
 void QueryMapper::score_only_culling()
 {
-	std::stable_sort(targets.begin(), targets.end(), Target::compare);
+	sort_targets();
+	if (config.query_range_culling)
+		target_arrays.gather_hsps(targets);
 	unique_ptr<TargetCulling> target_culling(TargetCulling::get());
 	const unsigned query_len = (unsigned)query_seq(0).length();
-	PtrVector<Target>::iterator i;
-	for (i = targets.begin(); i<targets.end();) {
-		if ((config.min_bit_score == 0 && score_matrix.evalue((*i)->filter_score, query_len) > config.max_evalue)
-			|| score_matrix.bitscore((*i)->filter_score) < config.min_bit_score)
+	const size_t n = targets.size();
+	size_t i, j = 0;
+	for (i = 0; i < n; ++i) {
+		const int filter_score = target_arrays.filter_score[i];
+		if ((config.min_bit_score == 0 && score_matrix.evalue(filter_score, query_len) > config.max_evalue)
+			|| score_matrix.bitscore(filter_score) < config.min_bit_score)
 			break;
-		const int c = target_culling->cull(**i);
+		const int c = target_culling->cull(target_arrays, i);
 		if (c == TargetCulling::FINISHED)
 			break;
 		else if (c == TargetCulling::NEXT) {
-			if (config.benchmark_ranking)
-				(*i++)->outranked = true;
+			if (config.benchmark_ranking) {
+				targets[i].outranked = true;
+				targets.get(j++) = targets.get(i);
+			}
 			else
-				i = targets.erase(i, i + 1);
+				delete targets.get(i);
 		}
 		else {
-			target_culling->add(**i);
-			++i;
+			target_culling->add(target_arrays, i);
+			targets.get(j++) = targets.get(i);
 		}
 	}
-	targets.erase(i, targets.end());
+	// The culled targets were deleted above, the kept ones moved to the front.
+	for (; i < n; ++i)
+		delete targets.get(i);
+	static_cast<vector<Target*>&>(targets).resize(j);
 }
 
 bool QueryMapper::generate_output(TextBuffer &buffer, Statistics &stat, const Metadata &metadata)
 {
-	std::stable_sort(targets.begin(), targets.end(), Target::compare);
+	sort_targets();
 
 	unsigned n_hsp = 0, n_target_seq = 0, hit_hsps = 0;
 	unique_ptr<TargetCulling> target_culling(TargetCulling::get());
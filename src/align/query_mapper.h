@@ -55,8 +55,6 @@ struct Target
 		for (list<Hsp_traits>::iterator i = ts.begin(); i != ts.end(); ++i)
 			i->query_source_range = TranslatedPosition::absolute_interval(TranslatedPosition(i->query_range.begin_, Frame(i->frame)), TranslatedPosition(i->query_range.end_, Frame(i->frame)), (int)query_len);
 	}
-	void add_ranges(vector<unsigned> &v);
-	bool is_outranked(const vector<unsigned> &v, double treshold);
 	bool envelopes(const Hsp_traits &t, double p) const;
 	bool is_enveloped(const Target &t, double p) const;
 	bool is_enveloped(PtrVector<Target>::const_iterator begin, PtrVector<Target>::const_iterator end, double p, int min_score) const;
@@ -75,11 +73,29 @@ struct Target
 	enum { INTERVAL = 64 };
 };
 
+// Data of the targets read by the ranking and culling passes, gathered into parallel arrays in the order of
+// QueryMapper::targets. The HSPs of target i are at [hsp_begin[i], hsp_begin[i + 1]) of hsp_range and hsp_score.
+struct TargetArrays
+{
+	void gather_hsps(const PtrVector<Target> &targets);
+	void add_ranges(size_t i, vector<unsigned> &v) const;
+	bool is_outranked(size_t i, const vector<unsigned> &v, double treshold) const;
+	vector<int> filter_score;
+	vector<unsigned> subject_id;
+	vector<interval> query_range;
+	vector<size_t> hsp_begin;
+	vector<interval> hsp_range;
+	vector<unsigned> hsp_score;
+};
+
 struct QueryMapper
 {
 	QueryMapper(const Parameters &params, size_t query_id, Trace_pt_list::iterator begin, Trace_pt_list::iterator end, bool target_parallel = false);
 	void init();
 	bool generate_output(TextBuffer &buffer, Statistics &stat, const Metadata &metadata);
+	// Sorts the targets by decreasing filter score and increasing subject id. Afterwards target_arrays holds the filter
+	// scores and subject ids in the sorted order.
+	void sort_targets();
 	void rank_targets(double ratio, double factor);
 	void score_only_culling();
 	int raw_score_cutoff() const;
@@ -109,8 +125,9 @@ struct QueryMapper
 	unsigned source_query_len, unaligned_from;
 	PtrVector<Target> targets;
 	vector<Seed_hit> seed_hits;
-	vector<Bias_correction> query_cb;
-	vector<Long_score_profile> profile;
+	vector<Bias_correction> &query_cb;
+	vector<Long_score_profile> &profile;
+	TargetArrays &target_arrays;
 	TranslatedSequence translated_query;
 	bool target_parallel;
 
@@ -118,6 +135,7 @@ private:
 
 	static pair<Trace_pt_list::iterator, Trace_pt_list::iterator> get_query_data();
 	unsigned count_targets();
+	void extend_seed_hits(const vector<std::pair<size_t, size_t>> &l, const vector<unsigned> &frame, vector<Diagonal_segment> &ungapped);
 	sequence query_source_seq() const
 	{
 		return align_mode.query_translated ? query_source_seqs::get()[query_id] : query_seqs::get()[query_id];
@@ -72,7 +72,12 @@ Config::Config(int argc, const char **argv)
 		.add_command("translate", "")
 		.add_command("filter-blasttab", "")
 		.add_command("show-cbs", "")
-		.add_command("simulate-seqs", "");
+		.add_command("simulate-seqs", "")
+		.add_command("mcl", "")
+		.add_command("dbsplit", "Split a DIAMOND database into shards of similar size")
+		.add_command("merge-shards", "Merge the tabular outputs of searches against the shards of a database")
+		.add_command("test-masking", "")
+		.add_command("test-bloom-filter", "");
 
 	Options_group general("General options");
 	general.add()
@@ -84,8 +89,9 @@ Config::Config(int argc, const char **argv)
 \t5   = BLAST XML\n\
 \t6   = BLAST tabular\n\
 \t100 = DIAMOND alignment archive (DAA)\n\
-\t101 = SAM\n\n\
-\tValue 6 may be followed by a space-separated list of these keywords:\n\n\
+\t101 = SAM\n\
+\t104 = DIAMOND binary column format (converted to tabular by the view command)\n\n\
+\tValue 6 may be followed by a space-separated list of these keywords (value 104 by the numeric ones and the subject ids and titles):\n\n\
 \tqseqid means Query Seq - id\n\
 \tqlen means Query sequence length\n\
 \tsseqid means Subject Seq - id\n\
@@ -128,7 +134,13 @@ Config::Config(int argc, const char **argv)
 
 	Options_group makedb("Makedb options");
 	makedb.add()
-		("in", 0, "input reference file in FASTA format", input_ref_file);
+		("in", 0, "input reference file in FASTA format", input_ref_file)
+		("append", 0, "append the input sequences to an existing database", append);
+
+	Options_group dbsplit("Dbsplit and merge-shards options");
+	dbsplit.add()
+		("shards", 0, "number of shards to split the database into", shards)
+		("shard-out", 0, "tabular outputs of the searches against the shards, in the order of the shards", shard_outputs);
 
 	Options_group aligner("Aligner options");
 	aligner.add()
@@ -143,6 +155,7 @@ Config::Config(int argc, const char **argv)
 		("top", 0, "report alignments within this percentage range of top alignment score (overrides --max-target-seqs)", toppercent, 100.0)
 		("range-culling", 0, "restrict hit culling to overlapping query ranges", query_range_culling)
 		("compress", 0, "compression for output files (0=none, 1=gzip)", compression)
+		("daa-block-compression", 0, "deflate the alignments of DAA output in independent blocks (DAA format version 2)", daa_block_compression)
 		("evalue", 'e', "maximum e-value to report alignments (default=0.001)", max_evalue, 0.001)
 		("min-score", 0, "minimum bit score to report alignments (overrides e-value setting)", min_bit_score)
 		("id", 0, "minimum identity% to report an alignment", min_id)
@@ -201,12 +214,20 @@ Config::Config(int argc, const char **argv)
 		("stop-match-score", 0, "Set the match score of stop codons against each other.", stop_match_score, 1)
 		("tantan-minMaskProb", 0, "minimum repeat probability for masking (0.9)", tantan_minMaskProb, 0.9)
 		("tantan-maxRepeatOffset", 0, "maximum tandem repeat period to consider (50)", tantan_maxRepeatOffset, 15)
-		("tantan-ungapped", 0, "use tantan masking in ungapped mode", tantan_ungapped);
+		("tantan-ungapped", 0, "use tantan masking in ungapped mode", tantan_ungapped)
+		("multiprocessing", 0, "share the search with other processes through --parallel-tmpdir", multiprocessing)
+		("parallel-tmpdir", 0, "shared directory for work units and intermediate files of --multiprocessing", parallel_tmpdir)
+		("checkpoint", 0, "directory to keep the finished work units in, so that the search can be resumed", checkpoint)
+		("resume", 0, "resume the search kept in --checkpoint or --parallel-tmpdir", resume)
+		("huge-pages", 0, "allocate the seed index buffers on huge pages (0=no, 1=transparent, 2=explicit)", huge_pages)
+		("release-buffers", 0, "return the seed index buffers to the system before the alignment phase of each block instead of keeping them for the next block", release_buffers)
+		("query-order", 0, "order in which queries are aligned, output keeps the input order (0=input, 1=longest first, 2=most estimated work first)", query_order);
 
 	Options_group view_options("View options");
 	view_options.add()
 		("daa", 'a', "DIAMOND alignment archive (DAA) file", daa_file)
-		("forwardonly", 0, "only show alignments of forward strand", forwardonly);
+		("forwardonly", 0, "only show alignments of forward strand", forwardonly)
+		("query-num", 0, "only show the query records with these numbers (0-based, requires a DAA file with query index)", view_query_num);
 
 	Options_group getseq_options("Getseq options");
 	getseq_options.add()
@@ -278,11 +299,18 @@ Config::Config(int argc, const char **argv)
 		("hard-masked", 0, "", hardmasked)
 		("cbs-window", 0, "", cbs_window, 40)
 		("no-unlink", 0, "", no_unlink)
-		("no-dict", 0, "", no_dict);
+		("no-dict", 0, "", no_dict)
+		("inflation", 0, "MCL inflation parameter (default=2.0)", inflation, 2.0)
+		("mcl-prune", 0, "MCL threshold for pruning matrix entries after expansion (default=0.0001)", mcl_prune, 0.0001)
+		("mcl-select", 0, "MCL maximum number of entries kept per row after expansion (default=1000)", mcl_select, 1000u);
 		
-	parser.add(general).add(makedb).add(aligner).add(advanced).add(view_options).add(getseq_options).add(hidden_options);
+	parser.add(general).add(makedb).add(dbsplit).add(aligner).add(advanced).add(view_options).add(getseq_options).add(hidden_options);
 	parser.store(argc, argv, command);
 
+	// Options that do not change the alignments found, left out of the signature checked by --resume.
+	static const char *scheduling_options[] = { "threads", "palign", "out", "tmpdir", "parallel-tmpdir", "checkpoint", "resume", "multiprocessing", "verbose", "log", "quiet", "huge-pages", "release-buffers" };
+	search_signature = parser.given_options(set<string>(scheduling_options, scheduling_options + sizeof(scheduling_options) / sizeof(scheduling_options[0])));
+
 	if (long_reads) {
 		query_range_culling = true;
 		if (toppercent == 100.0)
@@ -291,6 +319,7 @@ Config::Config(int argc, const char **argv)
 			frame_shift = 15;
 	}
 
+	bool daa_output = false;
 	switch (command) {
 	case Config::makedb:
 		if (database == "")
@@ -298,6 +327,18 @@ Config::Config(int argc, const char **argv)
 		if (chunk_size != 0.0)
 			throw std::runtime_error("Invalid option: --block-size/-b. Block size is set for the alignment commands.");
 		break;
+	case Config::dbsplit:
+		if (database == "")
+			throw std::runtime_error("Missing parameter: database file (--db/-d)");
+		if (shards == 0)
+			throw std::runtime_error("Missing parameter: number of shards (--shards)");
+		break;
+	case Config::merge_shards:
+		if (shard_outputs.empty())
+			throw std::runtime_error("Missing parameter: shard output files (--shard-out)");
+		if (query_file == "")
+			throw std::runtime_error("Missing parameter: query file (--query/-q)");
+		break;
 	case Config::blastp:
 	case Config::blastx:
 		if (database == "")
@@ -309,9 +350,32 @@ Config::Config(int argc, const char **argv)
 				throw std::runtime_error("Invalid parameter: --daa/-a. Output file is specified with the --out/-o parameter.");
 			output_file = daa_file;
 		}
+		if (multiprocessing) {
+			if (parallel_tmpdir == "")
+				throw std::runtime_error("Option --multiprocessing requires setting --parallel-tmpdir.");
+			if (query_file == "")
+				throw std::runtime_error("Option --multiprocessing requires a query file (--query/-q).");
+			if (unaligned != "" || aligned_file != "")
+				throw std::runtime_error("Options --un and --al are not supported with --multiprocessing.");
+			if (checkpoint != "")
+				throw std::runtime_error("Option --checkpoint cannot be used with --multiprocessing, the work units are kept in --parallel-tmpdir.");
+		}
+		if (checkpoint != "") {
+			if (query_file == "")
+				throw std::runtime_error("Option --checkpoint requires a query file (--query/-q).");
+			if (unaligned != "" || aligned_file != "")
+				throw std::runtime_error("Options --un and --al are not supported with --checkpoint.");
+		}
+		if (resume && checkpoint == "" && !multiprocessing)
+			throw std::runtime_error("Option --resume requires --checkpoint or --multiprocessing.");
+		if (huge_pages > 2)
+			throw std::runtime_error("Invalid value for --huge-pages.");
+		if (query_order > Config::most_work_first)
+			throw std::runtime_error("Invalid value for --query-order.");
 		if (daa_file.length() > 0 || (output_format.size() > 0 && (output_format[0] == "daa" || output_format[0] == "100"))) {
+			daa_output = true;
 			if (compression != 0)
-				throw std::runtime_error("Compression is not supported for DAA format.");
+				throw std::runtime_error("Compression is not supported for DAA format. Use --daa-block-compression to compress the alignments of a DAA file.");
 			if (!no_auto_append)
 				auto_append_extension(output_file, ".daa");
 		}
@@ -319,6 +383,9 @@ Config::Config(int argc, const char **argv)
 	case Config::view:
 		if (daa_file == "")
 			throw std::runtime_error("Missing parameter: DAA file (--daa/-a)");
+		daa_output = output_format.size() > 0 && (output_format[0] == "daa" || output_format[0] == "100");
+		if (daa_output && compression != 0)
+			throw std::runtime_error("Compression is not supported for DAA format. Use --daa-block-compression to compress the alignments of a DAA file.");
 	default:
 		;
 	}
@@ -368,7 +435,7 @@ Config::Config(int argc, const char **argv)
 		else
 			auto_append_extension_if_exists(database, ".dmnd");
 		if (command == Config::view)
-			auto_append_extension(daa_file, ".daa");
+			auto_append_extension_if_exists(daa_file, ".daa");
 		if (compression == 1)
 			auto_append_extension(output_file, ".gz");
 	}
@@ -401,8 +468,10 @@ Config::Config(int argc, const char **argv)
 	case Config::model_sim:
 	case Config::opt:
 	case Config::mask:
+	case Config::test_masking:
 	case Config::makedb:
 	case Config::cluster:
+	case Config::merge_shards:
 		if (frame_shift != 0 && command == Config::blastp)
 			throw std::runtime_error("Frameshift alignments are only supported for translated searches.");
 		if (query_range_culling && frame_shift == 0)
@@ -29,6 +29,7 @@ using std::vector;
 struct Config
 {
 	string	input_ref_file;
+	bool	append;
 	unsigned	threads_;
 	string	database;
 	string	query_file;
@@ -44,6 +45,7 @@ struct Config
 	int		padding;
 	unsigned	output_threads;
 	unsigned compression;
+	bool	daa_block_compression;
 	unsigned		lowmem;
 	double	chunk_size;
 	unsigned min_identities;
@@ -181,11 +183,26 @@ struct Config
 	int tantan_maxRepeatOffset;
 	bool tantan_ungapped;
 	string taxon_exclude;
+	bool multiprocessing;
+	string parallel_tmpdir;
+	string checkpoint;
+	bool resume;
+	string search_signature;
+	vector<string> view_query_num;
+	unsigned huge_pages;
+	bool release_buffers;
+	unsigned query_order;
+	unsigned shards;
+	vector<string> shard_outputs;
+	double inflation;
+	double mcl_prune;
+	unsigned mcl_select;
 
 	enum {
 		makedb = 0, blastp = 1, blastx = 2, view = 3, help = 4, version = 5, getseq = 6, benchmark = 7, random_seqs = 8, compare = 9, sort = 10, roc = 11, db_stat = 12, model_sim = 13,
 		match_file_stat = 14, model_seqs = 15, opt = 16, mask = 17, fastq2fasta = 18, dbinfo = 19, test_extra = 20, test_io = 21, db_annot_stats = 22, read_sim = 23, info = 24, seed_stat = 25,
-		smith_waterman = 26, protein_snps = 27, cluster = 28, translate = 29, filter_blasttab = 30, show_cbs = 31, simulate_seqs = 32
+		smith_waterman = 26, protein_snps = 27, cluster = 28, translate = 29, filter_blasttab = 30, show_cbs = 31, simulate_seqs = 32, mcl = 33, dbsplit = 34,
+		merge_shards = 35, test_masking = 36, test_bloom_filter = 37
 	};
 	unsigned	command;
 
@@ -195,6 +212,8 @@ struct Config
 	enum { query_parallel = 0, target_parallel = 1 };
 	unsigned load_balancing;
 
+	enum { input_order = 0, longest_first = 1, most_work_first = 2 };
+
 	enum {
 		swipe = 0, greedy = 1, floating_xdrop = 4, more_greedy = 2, most_greedy=3, banded_swipe=4
 	};
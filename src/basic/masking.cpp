@@ -17,13 +17,398 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ****/
 
 #include <math.h>
+#include <string.h>
 #include <algorithm>
 #include "masking.h"
 #include "../lib/tantan/tantan.hh"
 #include "../lib/tantan/LambdaCalculator.hh"
+#include "../util/algo/MurmurHash3.h"
+#include "../util/simd.h"
 
 using namespace std;
 
+namespace {
+
+#ifdef __SSE2__
+
+// Four doubles in two SSE2 registers, lanes 0 and 1 in lo, 2 and 3 in hi.
+struct Double4
+{
+	Double4()
+	{}
+	Double4(__m128d lo, __m128d hi):
+		lo(lo),
+		hi(hi)
+	{}
+	explicit Double4(double x):
+		lo(_mm_set1_pd(x)),
+		hi(lo)
+	{}
+	Double4 operator+(const Double4 &x) const
+	{
+		return Double4(_mm_add_pd(lo, x.lo), _mm_add_pd(hi, x.hi));
+	}
+	Double4 operator*(const Double4 &x) const
+	{
+		return Double4(_mm_mul_pd(lo, x.lo), _mm_mul_pd(hi, x.hi));
+	}
+	// Moves lane i to lane i + n, shifting in zeros.
+	template<int n>
+	Double4 shift_up() const
+	{
+		const __m128d z = _mm_setzero_pd();
+		if (n == 1)
+			return Double4(_mm_unpacklo_pd(z, lo), _mm_shuffle_pd(lo, hi, 1));
+		if (n == 2)
+			return Double4(z, lo);
+		return Double4(z, _mm_unpacklo_pd(z, lo));
+	}
+	// Moves lane i to lane i - n, shifting in zeros.
+	template<int n>
+	Double4 shift_down() const
+	{
+		const __m128d z = _mm_setzero_pd();
+		if (n == 1)
+			return Double4(_mm_shuffle_pd(lo, hi, 1), _mm_unpackhi_pd(hi, z));
+		if (n == 2)
+			return Double4(hi, z);
+		return Double4(_mm_unpackhi_pd(hi, z), z);
+	}
+	Double4 first() const
+	{
+		const __m128d x = _mm_unpacklo_pd(lo, lo);
+		return Double4(x, x);
+	}
+	Double4 last() const
+	{
+		const __m128d x = _mm_unpackhi_pd(hi, hi);
+		return Double4(x, x);
+	}
+	double sum() const
+	{
+		const __m128d a = _mm_add_pd(lo, hi);
+		return _mm_cvtsd_f64(_mm_add_sd(a, _mm_unpackhi_pd(a, a)));
+	}
+	__m128d lo, hi;
+};
+
+#else
+
+struct Double4
+{
+	Double4()
+	{}
+	explicit Double4(double x)
+	{
+		std::fill(v, v + 4, x);
+	}
+	Double4 operator+(const Double4 &x) const
+	{
+		Double4 r;
+		for (int i = 0; i < 4; ++i)
+			r.v[i] = v[i] + x.v[i];
+		return r;
+	}
+	Double4 operator*(const Double4 &x) const
+	{
+		Double4 r;
+		for (int i = 0; i < 4; ++i)
+			r.v[i] = v[i] * x.v[i];
+		return r;
+	}
+	template<int n>
+	Double4 shift_up() const
+	{
+		Double4 r(0.0);
+		std::copy(v, v + 4 - n, r.v + n);
+		return r;
+	}
+	template<int n>
+	Double4 shift_down() const
+	{
+		Double4 r(0.0);
+		std::copy(v + n, v + 4, r.v);
+		return r;
+	}
+	Double4 first() const
+	{
+		return Double4(v[0]);
+	}
+	Double4 last() const
+	{
+		return Double4(v[3]);
+	}
+	double sum() const
+	{
+		return v[0] + v[1] + v[2] + v[3];
+	}
+	double v[4];
+};
+
+#endif
+
+// Version of the tantan forward-backward algorithm (lib/tantan/tantan.cc) that keeps the repeat offsets in vector
+// lanes. Lanes at offsets >= max_repeat_offset are kept at zero. The gap recurrences, which run along the offsets,
+// are computed as scans within and across vectors. The computation is in double precision and the letter
+// probabilities are rounded to float as in lib/tantan, so that the masks agree with it.
+struct Tantan
+{
+
+	enum { SCALE_STEP = 16, PAD_LETTER = 63 };
+
+	Tantan(int max_repeat_offset, const double (*likelihood_ratio)[64], double repeat_prob, double repeat_end_prob, double repeat_offset_prob_decay, double first_gap_prob, double other_gap_prob) :
+		n_(max_repeat_offset),
+		w_((max_repeat_offset + 3) / 4),
+		lr_(likelihood_ratio),
+		first_gap_prob_(first_gap_prob),
+		b2b_(1 - repeat_prob),
+		f2b_(repeat_end_prob),
+		g_(other_gap_prob),
+		g2_(other_gap_prob * other_gap_prob),
+		gaps_(first_gap_prob > 0),
+		fg_(w_),
+		ins_(w_),
+		scan_(w_),
+		growth_(w_),
+		coef_f_(w_),
+		coef_ins_(w_),
+		coef_del_(w_),
+		coef_e_(w_),
+		coef_e2_(w_),
+		active_(w_),
+		active_ins_(w_)
+	{
+		const double one_gap = first_gap_prob * (1 - other_gap_prob),
+			end_gap = first_gap_prob,
+			f2f0 = 1 - repeat_end_prob,
+			f2f1 = 1 - repeat_end_prob - first_gap_prob,
+			f2f2 = 1 - repeat_end_prob - first_gap_prob * 2,
+			growth = 1 / repeat_offset_prob_decay,
+			b2f_last = repeat_prob * first_repeat_offset_prob(growth, n_);
+		vector<double> v(w_ * 4);
+		const auto set = [this, &v](vector<Double4> &dst) {
+			for (int i = 0; i < w_; ++i)
+				dst[i] = load(&v[i * 4]);
+			std::fill(v.begin(), v.end(), 0.0);
+		};
+		std::fill(v.begin(), v.end(), 0.0);
+		for (int k = 0; k < n_; ++k)
+			v[k] = b2f_last * pow(growth, n_ - 1 - k);
+		set(growth_);
+		for (int k = 0; k < n_; ++k)
+			v[k] = n_ == 1 ? f2f0 : (k == 0 || k == n_ - 1 ? f2f1 : f2f2);
+		set(coef_f_);
+		for (int k = 1; k < n_; ++k)
+			v[k] = k == n_ - 1 ? end_gap : one_gap;
+		set(coef_ins_);
+		for (int k = 0; k < n_ - 1; ++k)
+			v[k] = k == 0 ? end_gap : one_gap;
+		set(coef_del_);
+		coef_e_ = coef_del_;
+		for (int k = 1; k < n_; ++k)
+			v[k] = k == n_ - 1 ? end_gap : one_gap;
+		set(coef_e2_);
+		for (int k = 0; k < n_; ++k)
+			v[k] = 1.0;
+		set(active_);
+		for (int k = 1; k < n_; ++k)
+			v[k] = 1.0;
+		set(active_ins_);
+		suffix_carry_ = load4(g2_ * g2_, g2_ * g_, g2_, g_);
+		prefix_carry_ = load4(g_, g2_, g2_ * g_, g2_ * g2_);
+	}
+
+	bool parameters(int max_repeat_offset, const double (*likelihood_ratio)[64], double repeat_prob, double repeat_end_prob, double first_gap_prob, double other_gap_prob) const
+	{
+		return n_ == max_repeat_offset && lr_ == likelihood_ratio && b2b_ == 1 - repeat_prob && f2b_ == repeat_end_prob && first_gap_prob_ == first_gap_prob && g_ == other_gap_prob;
+	}
+
+	void mask(Letter *seq, size_t len, double min_mask_prob, const char *mask_table)
+	{
+		prob_.resize(len);
+		scale_.resize(len / SCALE_STEP);
+		emission_.resize(len * w_);
+		// Positions before the start of the sequence get a letter with zero likelihood ratios.
+		padded_.assign(w_ * 4, PAD_LETTER);
+		padded_.insert(padded_.end(), seq, seq + len);
+		for (size_t i = 0; i < len; ++i)
+			set_emission(&padded_[w_ * 4 + i], &emission_[i * w_]);
+
+		bg_ = 1.0;
+		std::fill(fg_.begin(), fg_.end(), Double4(0.0));
+		std::fill(ins_.begin(), ins_.end(), Double4(0.0));
+		for (size_t i = 0; i < len; ++i) {
+			forward_transition();
+			emit(&emission_[i * w_]);
+			if (i % SCALE_STEP == SCALE_STEP - 1) {
+				scale_[i / SCALE_STEP] = 1.0 / bg_;
+				rescale(scale_[i / SCALE_STEP]);
+			}
+			prob_[i] = (float)bg_;
+		}
+		const double z = bg_ * b2b_ + sum(fg_) * f2b_;
+
+		bg_ = b2b_;
+		for (int i = 0; i < w_; ++i) {
+			fg_[i] = active_[i] * Double4(f2b_);
+			ins_[i] = Double4(0.0);
+		}
+		for (size_t i = len; i-- > 0;) {
+			prob_[i] = 1 - (float)(prob_[i] * bg_ / z);
+			if (i % SCALE_STEP == SCALE_STEP - 1)
+				rescale(scale_[i / SCALE_STEP]);
+			emit(&emission_[i * w_]);
+			backward_transition();
+		}
+
+		for (size_t i = 0; i < len; ++i)
+			if (prob_[i] >= min_mask_prob)
+				seq[i] = mask_table[(uint8_t)seq[i]];
+	}
+
+private:
+
+	static double first_repeat_offset_prob(double prob_mult, int max_repeat_offset)
+	{
+		if (prob_mult < 1 || prob_mult > 1)
+			return (1 - prob_mult) / (1 - pow(prob_mult, max_repeat_offset));
+		else
+			return 1.0 / max_repeat_offset;
+	}
+
+	static Double4 load(const double *p)
+	{
+#ifdef __SSE2__
+		return Double4(_mm_loadu_pd(p), _mm_loadu_pd(p + 2));
+#else
+		Double4 r;
+		std::copy(p, p + 4, r.v);
+		return r;
+#endif
+	}
+
+	static Double4 load4(double a, double b, double c, double d)
+	{
+#ifdef __SSE2__
+		return Double4(_mm_setr_pd(a, b), _mm_setr_pd(c, d));
+#else
+		const double v[4] = { a, b, c, d };
+		return load(v);
+#endif
+	}
+
+	static double sum(const vector<Double4> &v)
+	{
+		Double4 s(0.0);
+		for (const Double4 &x : v)
+			s = s + x;
+		return s.sum();
+	}
+
+	void rescale(double scale)
+	{
+		const Double4 s(scale);
+		bg_ *= scale;
+		for (int i = 0; i < w_; ++i) {
+			fg_[i] = fg_[i] * s;
+			ins_[i] = ins_[i] * s;
+		}
+	}
+
+	// Likelihood ratios of the letter at p against the letters at the repeat offsets. Lanes at offsets >= max_repeat_offset
+	// are ignored, since the corresponding states are zero.
+	void set_emission(const uint8_t *p, Double4 *e) const
+	{
+		const double *row = lr_[*p];
+		for (int i = 0; i < w_; ++i, p -= 4)
+			e[i] = load4(row[p[-1]], row[p[-2]], row[p[-3]], row[p[-4]]);
+	}
+
+	void emit(const Double4 *e)
+	{
+		for (int i = 0; i < w_; ++i)
+			fg_[i] = fg_[i] * e[i];
+	}
+
+	// ins_ holds the insertion states shifted up by one offset.
+	void forward_transition()
+	{
+		const Double4 g(g_), g2(g2_), bg(bg_);
+		const double from_fg = sum(fg_) * f2b_;
+		if (gaps_) {
+			Double4 carry(0.0);
+			for (int i = w_ - 1; i >= 0; --i) {
+				Double4 s = fg_[i];
+				s = s + g * s.shift_down<1>();
+				s = s + g2 * s.shift_down<2>();
+				s = s + carry * suffix_carry_;
+				scan_[i] = s;
+				carry = s.first();
+			}
+		}
+		for (int i = w_ - 1; i >= 0; --i) {
+			const Double4 f = fg_[i];
+			if (gaps_) {
+				const Double4 del = scan_[i].shift_down<1>() + (i + 1 < w_ ? scan_[i + 1].shift_up<3>() : Double4(0.0)),
+					x = f + ins_[i] * g,
+					x_prev = i > 0 ? fg_[i - 1] + ins_[i - 1] * g : Double4(0.0);
+				fg_[i] = growth_[i] * bg + f * coef_f_[i] + ins_[i] * coef_ins_[i] + del * coef_del_[i];
+				ins_[i] = (x.shift_up<1>() + x_prev.shift_down<3>()) * active_ins_[i];
+			}
+			else
+				fg_[i] = growth_[i] * bg + f * coef_f_[i];
+		}
+		bg_ = bg_ * b2b_ + from_fg;
+	}
+
+	void backward_transition()
+	{
+		const Double4 g(g_), g2(g2_), to_bg(f2b_ * bg_);
+		Double4 to_fg(0.0);
+		for (int i = 0; i < w_; ++i)
+			to_fg = to_fg + fg_[i] * growth_[i];
+		if (gaps_) {
+			Double4 carry(0.0);
+			for (int i = 0; i < w_; ++i) {
+				Double4 s = fg_[i] * coef_e_[i];
+				s = s + g * s.shift_up<1>();
+				s = s + g2 * s.shift_up<2>();
+				s = s + carry * prefix_carry_;
+				scan_[i] = s;
+				carry = s.last();
+			}
+		}
+		for (int i = 0; i < w_; ++i) {
+			const Double4 f = fg_[i];
+			if (gaps_) {
+				const Double4 del = scan_[i].shift_up<1>() + (i > 0 ? scan_[i - 1].shift_down<3>() : Double4(0.0)),
+					y = f * coef_e2_[i] + ins_[i] * g,
+					y_next = i + 1 < w_ ? fg_[i + 1] * coef_e2_[i + 1] + ins_[i + 1] * g : Double4(0.0);
+				fg_[i] = (to_bg + del) * active_[i] + f * coef_f_[i] + ins_[i];
+				ins_[i] = y.shift_down<1>() + y_next.shift_up<3>();
+			}
+			else
+				fg_[i] = to_bg * active_[i] + f * coef_f_[i];
+		}
+		bg_ = b2b_ * bg_ + to_fg.sum();
+	}
+
+	const int n_, w_;
+	const double (*lr_)[64];
+	const double first_gap_prob_, b2b_, f2b_, g_, g2_;
+	const bool gaps_;
+	double bg_;
+	vector<Double4> fg_, ins_, scan_, growth_, coef_f_, coef_ins_, coef_del_, coef_e_, coef_e2_, active_, active_ins_;
+	Double4 suffix_carry_, prefix_carry_;
+	vector<float> prob_;
+	vector<double> scale_;
+	vector<Double4> emission_;
+	vector<uint8_t> padded_;
+
+};
+
+}
+
 unique_ptr<Masking> Masking::instance;
 const uint8_t Masking::bit_mask = 128;
 
@@ -43,8 +428,7 @@ Masking::Masking(const Score_matrix &score_matrix)
 		mask_table_x_[i] = value_traits.mask_char;
 		mask_table_bit_[i] = (uint8_t)i | bit_mask;
 		for (unsigned j = 0; j < size; ++j)
-			if (i < n && j < n)
-				likelihoodRatioMatrix_[i][j] = exp(lambda * score_matrix(i, j));
+			likelihoodRatioMatrix_[i][j] = i < n && j < n ? exp(lambda * score_matrix(i, j)) : 0.0;
 	}
 	std::copy(likelihoodRatioMatrix_, likelihoodRatioMatrix_ + size, probMatrixPointers_);
 	int firstGapCost = score_matrix.gap_extend() + score_matrix.gap_open();
@@ -53,7 +437,30 @@ Masking::Masking(const Score_matrix &score_matrix)
 	firstGapProb_ /= (1 - otherGapProb_);
 }
 
-void Masking::operator()(Letter *seq, size_t len) const
+uint64_t Masking::parameter_hash() const
+{
+	const unsigned n = value_traits.alphabet_size;
+	const double params[] = { firstGapProb_, otherGapProb_, config.tantan_minMaskProb, (double)config.tantan_maxRepeatOffset, (double)config.tantan_ungapped };
+	char hash[16] = { 0 };
+	for (unsigned i = 0; i < n; ++i)
+		MurmurHash3_x64_128(likelihoodRatioMatrix_[i], (int)(n * sizeof(double)), hash, hash);
+	MurmurHash3_x64_128(params, (int)sizeof(params), hash, hash);
+	uint64_t h;
+	memcpy(&h, hash, sizeof(h));
+	return h | 1;
+}
+
+void Masking::mask(Letter *seq, size_t len, const char *mask_table) const
+{
+	// The model and its scratch buffers are kept per thread and only rebuilt when the parameters change.
+	static thread_local unique_ptr<Tantan> tantan;
+	const double first_gap_prob = config.tantan_ungapped ? 0.0 : firstGapProb_, other_gap_prob = config.tantan_ungapped ? 0.0 : otherGapProb_;
+	if (!tantan || !tantan->parameters(config.tantan_maxRepeatOffset, likelihoodRatioMatrix_, 0.005, 0.05, first_gap_prob, other_gap_prob))
+		tantan.reset(new Tantan(config.tantan_maxRepeatOffset, likelihoodRatioMatrix_, 0.005, 0.05, 0.9, first_gap_prob, other_gap_prob));
+	tantan->mask(seq, len, config.tantan_minMaskProb, mask_table);
+}
+
+void Masking::mask_reference(Letter *seq, size_t len) const
 {
 	tantan::maskSequences((tantan::uchar*)seq, (tantan::uchar*)(seq + len), config.tantan_maxRepeatOffset,
 		(tantan::const_double_ptr*)probMatrixPointers_,
@@ -63,14 +470,14 @@ void Masking::operator()(Letter *seq, size_t len) const
 		config.tantan_minMaskProb, (const tantan::uchar*)mask_table_x_);
 }
 
+void Masking::operator()(Letter *seq, size_t len) const
+{
+	mask(seq, len, mask_table_x_);
+}
+
 void Masking::mask_bit(Letter *seq, size_t len) const
 {
-	tantan::maskSequences((tantan::uchar*)seq, (tantan::uchar*)(seq + len), config.tantan_maxRepeatOffset,
-		(tantan::const_double_ptr*)probMatrixPointers_,
-		0.005, 0.05,
-		0.9,
-		config.tantan_ungapped ? 0.0 : firstGapProb_, config.tantan_ungapped ? 0.0 : otherGapProb_,
-		config.tantan_minMaskProb, (const tantan::uchar*)mask_table_bit_);
+	mask(seq, len, mask_table_bit_);
 }
 
 void Masking::bit_to_hard_mask(Letter *seq, size_t len, size_t &n) const
@@ -29,6 +29,10 @@ struct Masking
 	void mask_bit(Letter *seq, size_t len) const;
 	void bit_to_hard_mask(Letter *seq, size_t len, size_t &n) const;
 	void remove_bit_mask(Letter *seq, size_t len) const;
+	// Hard masks using lib/tantan, which the vectorised implementation is checked against.
+	void mask_reference(Letter *seq, size_t len) const;
+	// Identifies the masking parameters, so that masks stored in a database can be reused. Never 0.
+	uint64_t parameter_hash() const;
 	static const Masking& get()
 	{
 		return *instance;
@@ -37,7 +41,9 @@ struct Masking
 	static const uint8_t bit_mask;
 private:
 	enum { size = 64 };
-	double likelihoodRatioMatrix_[size][size], *probMatrixPointers_[size], firstGapProb_, otherGapProb_;
+	void mask(Letter *seq, size_t len, const char *mask_table) const;
+	double likelihoodRatioMatrix_[size][size], *probMatrixPointers_[size];
+	double firstGapProb_, otherGapProb_;
 	char mask_table_x_[size], mask_table_bit_[size];
 };
 
@@ -17,6 +17,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ****/
 
 #include <utility>
+#include <thread>
+#include <string.h>
 #include "reference.h"
 #include "ref_dictionary.h"
 #include "../util/util.h"
@@ -25,64 +27,149 @@ using std::pair;
 
 ReferenceDictionary ReferenceDictionary::instance_;
 
-string* get_allseqids(const char *s)
+string get_allseqids(const char *s)
 {
-	string *r = new string;
+	string r;
 	const vector<string> t(tokenize(s, "\1"));
 	for (vector<string>::const_iterator i = t.begin(); i != t.end(); ++i) {
 		if (i != t.begin())
-			r->append("\1");
-		r->append(i->substr(0, find_first_of(i->c_str(), Const::id_delimiters)));
+			r.append("\1");
+		r.append(i->substr(0, find_first_of(i->c_str(), Const::id_delimiters)));
 	}
 	return r;
 }
 
+ReferenceDictionary::ReferenceDictionary() :
+	next_(0),
+	pages_(new std::atomic<Entry*>[MAX_PAGES]),
+	generation_(0)
+{
+	for (size_t i = 0; i < MAX_PAGES; ++i)
+		pages_[i].store(nullptr, std::memory_order_relaxed);
+}
+
+ReferenceDictionary::~ReferenceDictionary()
+{
+	clear();
+}
+
 void ReferenceDictionary::clear()
 {
 	data_.clear();
-	len_.clear();
-	database_id_.clear();
-	name_.clear();
+	for (size_t i = 0; i < MAX_PAGES; ++i)
+		delete[] pages_[i].exchange(nullptr, std::memory_order_relaxed);
+	for (vector<char*>::const_iterator i = arena_.begin(); i < arena_.end(); ++i)
+		delete[] *i;
+	arena_.clear();
+	++generation_;
 	next_ = 0;
 }
 
+ReferenceDictionary::Entry& ReferenceDictionary::new_entry(uint32_t i)
+{
+	std::atomic<Entry*> &page = pages_[i >> PAGE_BITS];
+	Entry *p = page.load(std::memory_order_acquire);
+	if (p == nullptr) {
+		Entry *q = new Entry[PAGE_SIZE];
+		if (page.compare_exchange_strong(p, q, std::memory_order_acq_rel))
+			p = q;
+		else
+			delete[] q;
+	}
+	return p[i & (PAGE_SIZE - 1)];
+}
+
+const char* ReferenceDictionary::store_name(const char *s, size_t len)
+{
+	struct Chunk
+	{
+		char *ptr, *end;
+		unsigned generation;
+	};
+	static thread_local Chunk chunk = { nullptr, nullptr, 0 };
+	if (chunk.ptr == nullptr || chunk.generation != generation_ || size_t(chunk.end - chunk.ptr) < len + 1) {
+		const size_t size = std::max(len + 1, (size_t)ARENA_CHUNK);
+		chunk.ptr = new char[size];
+		chunk.end = chunk.ptr + size;
+		chunk.generation = generation_;
+		std::lock_guard<std::mutex> lock(arena_mtx_);
+		arena_.push_back(chunk.ptr);
+	}
+	char *r = chunk.ptr;
+	memcpy(r, s, len);
+	r[len] = '\0';
+	chunk.ptr += len + 1;
+	return r;
+}
+
+void ReferenceDictionary::save(OutputFile &f) const
+{
+	const uint32_t n = seqs();
+	f << n;
+	if (config.no_dict)
+		return;
+	for (uint32_t i = 0; i < n; ++i) {
+		const Entry &e = entry(i);
+		f << e.len << e.database_id;
+		f.write(e.name, strlen(e.name) + 1);
+	}
+}
+
+void ReferenceDictionary::load(InputFile &f)
+{
+	uint32_t n, len, database_id;
+	string name;
+	f >> n;
+	if (!config.no_dict)
+		for (uint32_t i = 0; i < n; ++i) {
+			f >> len >> database_id >> name;
+			Entry &e = new_entry(next_ + i);
+			e.len = len;
+			e.database_id = database_id;
+			e.name = store_name(name.c_str(), name.length());
+		}
+	next_ += n;
+}
+
 void ReferenceDictionary::init(unsigned ref_count, const vector<unsigned> &block_to_database_id)
 {
 	const unsigned block = current_ref_block;
 	if (data_.size() < block + 1) {
 		data_.resize(block + 1);
-		data_[block].insert(data_[block].end(), ref_count, std::numeric_limits<uint32_t>::max());
+		data_[block].reset(new std::atomic<uint32_t>[ref_count]);
+		for (unsigned i = 0; i < ref_count; ++i)
+			data_[block][i].store(EMPTY, std::memory_order_relaxed);
 	}
 	block_to_database_id_ = &block_to_database_id;
 }
 
 uint32_t ReferenceDictionary::get(unsigned block, size_t block_id)
 {
-	uint32_t n = data_[block][block_id];
-	if (n != std::numeric_limits<uint32_t>::max())
+	std::atomic<uint32_t> &slot = data_[block][block_id];
+	uint32_t n = slot.load(std::memory_order_acquire);
+	if (n < PENDING)
 		return n;
-	{
-		mtx_.lock();
-		n = data_[block][block_id];
-		if (n != std::numeric_limits<uint32_t>::max()) {
-			mtx_.unlock();
-			return n;
-		}
-		n = next_++;
-		data_[block][block_id] = n;
+	if (n == EMPTY && slot.compare_exchange_strong(n, PENDING, std::memory_order_acquire)) {
+		n = next_.fetch_add(1, std::memory_order_relaxed);
 		if (!config.no_dict) {
-			len_.push_back((uint32_t)ref_seqs::get().length(block_id));
-			database_id_.push_back((*block_to_database_id_)[block_id]);
+			Entry &e = new_entry(n);
+			e.len = (uint32_t)ref_seqs::get().length(block_id);
+			e.database_id = (*block_to_database_id_)[block_id];
 			const char *title = ref_ids::get()[block_id].c_str();
 			if (config.salltitles)
-				name_.push_back(new string(title));
-			else if (config.sallseqid)
-				name_.push_back(get_allseqids(title));
+				e.name = store_name(title, strlen(title));
+			else if (config.sallseqid) {
+				const string ids = get_allseqids(title);
+				e.name = store_name(ids.c_str(), ids.length());
+			}
 			else
-				name_.push_back(get_str(title, Const::id_delimiters));
+				e.name = store_name(title, find_first_of(title, Const::id_delimiters));
 		}
-		mtx_.unlock();
+		slot.store(n, std::memory_order_release);
+		return n;
 	}
+	while ((n = slot.load(std::memory_order_acquire)) == PENDING)
+		std::this_thread::yield();
 	return n;
 }
 
@@ -90,12 +177,12 @@ void ReferenceDictionary::build_lazy_dict(DatabaseFile &db_file)
 {
 	vector<bool> filter(db_file.ref_header.sequences);
 	vector<pair<unsigned, unsigned> > m;
-	const size_t dict_size = database_id_.size();
+	const size_t dict_size = config.no_dict ? 0 : seqs();
 	m.reserve(dict_size);
-	unsigned n = 0;
-	for (vector<uint32_t>::const_iterator i = database_id_.begin(); i < database_id_.end(); ++i) {
-		filter[*i] = true;
-		m.push_back(std::make_pair(*i, n++));
+	for (unsigned n = 0; n < dict_size; ++n) {
+		const unsigned database_id = entry(n).database_id;
+		filter[database_id] = true;
+		m.push_back(std::make_pair(database_id, n));
 	}
 	db_file.rewind();
 	vector<unsigned> block_to_database_id;
@@ -103,7 +190,7 @@ void ReferenceDictionary::build_lazy_dict(DatabaseFile &db_file)
 	std::sort(m.begin(), m.end());
 	dict_to_lazy_dict_id_.clear();
 	dict_to_lazy_dict_id_.resize(dict_size);
-	n = 0;
+	unsigned n = 0;
 	for (vector<pair<unsigned, unsigned> >::const_iterator i = m.begin(); i < m.end(); ++i)
 		dict_to_lazy_dict_id_[i->second] = n++;
 }
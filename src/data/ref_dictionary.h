@@ -23,35 +23,40 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdexcept>
 #include <vector>
 #include <mutex>
+#include <atomic>
+#include <memory>
 #include <string>
-#include "../util/ptr_vector.h"
 #include "../util/io/output_file.h"
 #include "reference.h"
 
 using std::vector;
 using std::string;
 
+// Maps the sequences of all reference blocks that have hits to dense ids in the order they are first seen. Ids are assigned by
+// a compare-and-swap on the slot of the sequence, the entries are stored in pages allocated on demand and the names in
+// thread-local chunks of an arena, so that alignment threads do not synchronise with each other.
 struct ReferenceDictionary
 {
 
-	ReferenceDictionary() :
-		next_(0)
-	{ }
+	ReferenceDictionary();
+	~ReferenceDictionary();
 
 	void init(unsigned ref_count, const vector<unsigned> &block_to_database_id);
 
 	uint32_t get(unsigned block, size_t i);
 	void build_lazy_dict(DatabaseFile &db_file);
 	void clear();
+	void save(OutputFile &f) const;
+	void load(InputFile &f);
 
 	unsigned length(uint32_t i) const
 	{
-		return config.no_dict ? 1 : len_[i];
+		return config.no_dict ? 1 : entry(i).len;
 	}
 
 	const char* name(uint32_t i) const
 	{
-		return config.no_dict ? "" : name_[i].c_str();
+		return config.no_dict ? "" : entry(i).name;
 	}
 
 	sequence seq(size_t i) const
@@ -63,7 +68,7 @@ struct ReferenceDictionary
 	
 	unsigned database_id(unsigned dict_id) const
 	{
-		return config.no_dict ? 0 : database_id_[dict_id];
+		return config.no_dict ? 0 : entry(dict_id).database_id;
 	}
 
 	unsigned block_to_database_id(size_t block_id) const
@@ -73,7 +78,7 @@ struct ReferenceDictionary
 
 	uint32_t check_id(uint32_t i) const
 	{
-		if (i >= next_)
+		if (i >= seqs())
 			throw std::runtime_error("Dictionary reference id out of bounds.");
 		return i;
 	}
@@ -85,23 +90,41 @@ struct ReferenceDictionary
 
 	uint32_t seqs() const
 	{
-		return next_;
+		return next_.load(std::memory_order_relaxed);
 	}
 
 private:
 
+	enum : uint32_t { EMPTY = UINT32_MAX, PENDING = UINT32_MAX - 1 };
+	enum { PAGE_BITS = 16, PAGE_SIZE = 1 << PAGE_BITS, MAX_PAGES = 1 << (32 - PAGE_BITS), ARENA_CHUNK = 1 << 20 };
+
+	struct Entry
+	{
+		uint32_t len, database_id;
+		const char *name;
+	};
+
+	const Entry& entry(uint32_t i) const
+	{
+		return pages_[i >> PAGE_BITS].load(std::memory_order_relaxed)[i & (PAGE_SIZE - 1)];
+	}
+
+	Entry& new_entry(uint32_t i);
+	const char* store_name(const char *s, size_t len);
+
 	static ReferenceDictionary instance_;
 
-	std::mutex mtx_;
-	vector<vector<uint32_t> > data_;
-	vector<uint32_t> len_, database_id_;
-	PtrVector<string> name_;
+	vector<std::unique_ptr<std::atomic<uint32_t>[]>> data_;
+	std::atomic<uint32_t> next_;
+	std::unique_ptr<std::atomic<Entry*>[]> pages_;
+	std::mutex arena_mtx_;
+	vector<char*> arena_;
+	unsigned generation_;
 	//vector<uint32_t> rev_map_;
-	uint32_t next_;
 	vector<uint32_t> dict_to_lazy_dict_id_;
 	const vector<unsigned> *block_to_database_id_;
 
-	friend void finish_daa(OutputFile&, const DatabaseFile&);
+	friend struct DAA_writer;
 
 };
 
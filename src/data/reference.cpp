@@ -34,6 +34,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "taxonomy_nodes.h"
 #include "../util/algo/MurmurHash3.h"
 #include "../util/io/record_reader.h"
+#include "../util/system/system.h"
 
 String_set<0>* ref_ids::data_ = 0;
 Partitioned_histogram ref_hst;
@@ -48,7 +49,7 @@ Serializer& operator<<(Serializer &s, const ReferenceHeader2 &h)
 	s.unset(Serializer::VARINT);
 	s << sizeof(ReferenceHeader2);
 	s.write(h.hash, sizeof(h.hash));
-	s << h.taxon_array_offset << h.taxon_array_size << h.taxon_nodes_offset << h.taxon_names_offset;
+	s << h.taxon_array_offset << h.taxon_array_size << h.taxon_nodes_offset << h.taxon_names_offset << h.masking << h.db_seqs << h.db_letters;
 	return s;
 }
 
@@ -59,6 +60,9 @@ Deserializer& operator>>(Deserializer &d, ReferenceHeader2 &h)
 		>> h.taxon_array_size
 		>> h.taxon_nodes_offset
 		>> h.taxon_names_offset
+		>> h.masking
+		>> h.db_seqs
+		>> h.db_letters
 		>> Finish();
 	return d;
 }
@@ -133,6 +137,21 @@ bool DatabaseFile::has_taxon_scientific_names() {
 
 }
 
+bool DatabaseFile::has_masking() const
+{
+	return config.masking == 1 && header2.masking == Masking::get().parameter_hash();
+}
+
+uint64_t DatabaseFile::total_sequences() const
+{
+	return header2.db_seqs ? header2.db_seqs : ref_header.sequences;
+}
+
+uint64_t DatabaseFile::total_letters() const
+{
+	return header2.db_letters ? header2.db_letters : ref_header.letters;
+}
+
 void DatabaseFile::rewind()
 {
 	pos_array_offset = ref_header.pos_array_offset;
@@ -150,6 +169,43 @@ void push_seq(const sequence &seq, const sequence &id, uint64_t &offset, vector<
 	offset += seq.length() + id.length() + 3;
 }
 
+// Loads the sequences of the FASTA input, writes them to the database file starting at offset and chains them into the
+// sequence hash, so that a database hash can be continued by appending further sequences.
+static void write_seqs(TextInputFile &db_file, OutputFile &out, bool mask, uint64_t &offset, vector<Pos_record> &pos_array, size_t &letters, size_t &n_seqs, FileBackedBuffer &accessions, ReferenceHeader2 &header2, task_timer &timer)
+{
+	size_t n;
+	Sequence_set *seqs;
+	String_set<0> *ids;
+	const FASTA_format format;
+	while ((timer.go("Loading sequences"), n = load_seqs(db_file, format, &seqs, ids, 0, nullptr, (size_t)(1e9), string())) > 0) {
+		if (mask) {
+			timer.go("Masking sequences");
+			mask_seqs(*seqs, Masking::get(), false);
+			header2.masking = Masking::get().parameter_hash();
+		}
+		timer.go("Writing sequences");
+		for (size_t i = 0; i < n; ++i) {
+			sequence seq = (*seqs)[i];
+			if (seq.length() == 0)
+				throw std::runtime_error("File format error: sequence of length 0 at line " + to_string(db_file.line_count));
+			push_seq(seq, (*ids)[i], offset, pos_array, out, letters, n_seqs);
+		}
+		if (!config.prot_accession2taxid.empty()) {
+			timer.go("Writing accessions");
+			for (size_t i = 0; i < n; ++i)
+				accessions << Taxonomy::Accession::from_title((*ids)[i].c_str());
+		}
+		timer.go("Hashing sequences");
+		for (size_t i = 0; i < n; ++i) {
+			sequence seq = (*seqs)[i], id = (*ids)[i];
+			MurmurHash3_x64_128(seq.data(), (int)seq.length(), header2.hash, header2.hash);
+			MurmurHash3_x64_128(id.data(), (int)id.length(), header2.hash, header2.hash);
+		}
+		delete seqs;
+		delete ids;
+	}
+}
+
 void make_db(TempFile **tmp_out)
 {
 	message_stream << "Database file: " << config.input_ref_file << endl;
@@ -168,42 +224,14 @@ void make_db(TempFile **tmp_out)
 	out->write(&header, 1);
 	*out << header2;
 
-	size_t letters = 0, n = 0, n_seqs = 0;
+	size_t letters = 0, n_seqs = 0;
 	uint64_t offset = out->tell();
 
-	Sequence_set *seqs;
-	String_set<0> *ids;
-	const FASTA_format format;
 	vector<Pos_record> pos_array;
 	FileBackedBuffer accessions;
 
 	try {
-		while ((timer.go("Loading sequences"), n = load_seqs(*db_file, format, &seqs, ids, 0, nullptr, (size_t)(1e9), string())) > 0) {
-			if (config.masking == 1) {
-				timer.go("Masking sequences");
-				mask_seqs(*seqs, Masking::get(), false);
-			}
-			timer.go("Writing sequences");
-			for (size_t i = 0; i < n; ++i) {
-				sequence seq = (*seqs)[i];
-				if (seq.length() == 0)
-					throw std::runtime_error("File format error: sequence of length 0 at line " + to_string(db_file->line_count));
-				push_seq(seq, (*ids)[i], offset, pos_array, *out, letters, n_seqs);
-			}
-			if (!config.prot_accession2taxid.empty()) {
-				timer.go("Writing accessions");
-				for (size_t i = 0; i < n; ++i)
-					accessions << Taxonomy::Accession::from_title((*ids)[i].c_str());
-			}
-			timer.go("Hashing sequences");
-			for (size_t i = 0; i < n; ++i) {
-				sequence seq = (*seqs)[i], id = (*ids)[i];
-				MurmurHash3_x64_128(seq.data(), (int)seq.length(), header2.hash, header2.hash);
-				MurmurHash3_x64_128(id.data(), (int)id.length(), header2.hash, header2.hash);
-			}
-			delete seqs;
-			delete ids;
-		}
+		write_seqs(*db_file, *out, config.masking == 1, offset, pos_array, letters, n_seqs, accessions, header2, timer);
 	}
 	catch (std::exception&) {
 		out->close();
@@ -256,6 +284,315 @@ void make_db(TempFile **tmp_out)
 	message_stream << "Total time = " << total.getElapsedTimeInSec() << "s" << endl;
 }
 
+// Reads the bytes of the file from begin up to end, or up to the end of the file if end is 0.
+static vector<char> read_section(InputFile &in, uint64_t begin, uint64_t end)
+{
+	static const size_t CHUNK = 1 << 20;
+	vector<char> v;
+	in.seek(begin);
+	size_t n;
+	do {
+		const size_t size = v.size(), count = end ? std::min((size_t)(end - begin - size), CHUNK) : CHUNK;
+		v.resize(size + count);
+		n = in.read_raw(v.data() + size, count);
+		v.resize(size + n);
+	} while (n == CHUNK);
+	if (end && v.size() != end - begin)
+		throw std::runtime_error("Unexpected end of file.");
+	return v;
+}
+
+// Returns the end of the taxonomy section starting at offset, which is the start of the next section or the end of the file.
+static uint64_t section_end(const ReferenceHeader2 &h, uint64_t offset)
+{
+	uint64_t end = 0;
+	const uint64_t s[] = { h.taxon_array_offset, h.taxon_nodes_offset, h.taxon_names_offset };
+	for (unsigned i = 0; i < 3; ++i)
+		if (s[i] > offset && (end == 0 || s[i] < end))
+			end = s[i];
+	return end;
+}
+
+// Rewrites the headers at the start of the file. Seeking flushes the data written before, so that the headers never
+// point to a trailer that has not been written.
+static void write_headers(OutputFile &out, const ReferenceHeader &header, const ReferenceHeader2 &header2)
+{
+	out.seek(0);
+	out.write(&header, 1);
+	out << header2;
+	out.seek(0);
+}
+
+// Appends the sequences of the input file to an existing database without rewriting the existing sequences, which have
+// to stay contiguous with the new ones. The new sequences and the new trailer are staged behind the end of the file,
+// followed by a copy of the old trailer that the header is then pointed to. This leaves the database unchanged, so that
+// the staged data can be moved down over the old trailer. Rewriting the header in place afterwards is the commit point.
+// A failed run truncates the file back to its last valid state. The file temporarily grows by twice the size of the
+// appended data plus the old trailer. The sequence hash is continued from the stored value and equals the hash of a full
+// build.
+void append_db()
+{
+	message_stream << "Database file: " << config.database << endl;
+
+	Timer total;
+	total.start();
+	if (config.input_ref_file == "")
+		std::cerr << "Input file parameter (--in) is missing. Input will be read from stdin." << endl;
+	task_timer timer("Opening the database file", true);
+	DatabaseFile db(config.database);
+	ReferenceHeader header = db.ref_header;
+	ReferenceHeader2 header2 = db.header2;
+	if (header.db_version != ReferenceHeader::current_db_version)
+		throw std::runtime_error("Database was built with an older version of Diamond, sequences can not be appended.");
+	if (header2.masking != 0 && header2.masking != Masking::get().parameter_hash())
+		throw std::runtime_error("Database was masked with different parameters, sequences can not be appended.");
+	if (header2.db_letters != 0)
+		throw std::runtime_error("Sequences can not be appended to a shard of a database.");
+
+	timer.go("Reading trailer");
+	vector<Pos_record> pos_array(header.sequences + 1);
+	db.seek(header.pos_array_offset);
+	if (db.read(pos_array.data(), pos_array.size()) != pos_array.size())
+		throw std::runtime_error("Unexpected end of file.");
+	// The last record marks the end of the sequences, which is also valid for a database without sequences.
+	const uint64_t seqs_end = pos_array.back().pos;
+	vector<char> taxon_array, taxon_nodes, taxon_names;
+	if (header2.taxon_array_offset)
+		taxon_array = read_section(db, header2.taxon_array_offset, header2.taxon_array_offset + header2.taxon_array_size);
+	if (header2.taxon_nodes_offset)
+		taxon_nodes = read_section(db, header2.taxon_nodes_offset, section_end(header2, header2.taxon_nodes_offset));
+	if (header2.taxon_names_offset)
+		taxon_names = read_section(db, header2.taxon_names_offset, section_end(header2, header2.taxon_names_offset));
+	db.close();
+	pos_array.pop_back();
+	const ReferenceHeader old_header = header;
+	const ReferenceHeader2 old_header2 = header2;
+	const size_t old_seqs = pos_array.size();
+	const uint64_t old_size = file_size(config.database);
+	// Staged data is written this far behind its final position.
+	const uint64_t shift = old_size - seqs_end;
+
+	timer.go("Opening the input file");
+	unique_ptr<TextInputFile> in(new TextInputFile(config.input_ref_file));
+	OutputFile out(config.database, false, "r+b");
+
+	size_t letters = old_header.letters, n_seqs = old_seqs;
+	uint64_t offset = seqs_end, valid_size = old_size;
+	FileBackedBuffer accessions;
+
+	try {
+		out.seek(old_size);
+		write_seqs(*in, out, header2.masking != 0, offset, pos_array, letters, n_seqs, accessions, header2, timer);
+
+		timer.go("Closing the input file");
+		in->close();
+
+		timer.go("Writing trailer");
+		header.pos_array_offset = offset;
+		pos_array.emplace_back(offset, 0);
+		out.write_raw(pos_array);
+		timer.finish();
+
+		taxonomy.init();
+		if (header2.taxon_array_offset || !config.prot_accession2taxid.empty()) {
+			header2.taxon_array_offset = out.tell() - shift;
+			out.write_raw(taxon_array);
+			out.set(Serializer::VARINT);
+			if (taxon_array.empty())
+				for (size_t i = 0; i < old_seqs; ++i)
+					out << std::set<unsigned>();
+			if (!config.prot_accession2taxid.empty())
+				TaxonList::build(out, accessions.rewind(), n_seqs - old_seqs);
+			else {
+				message_stream << "Warning: no taxonomy mapping (--taxonmap) given, the appended sequences are not mapped to taxa." << endl;
+				for (size_t i = old_seqs; i < n_seqs; ++i)
+					out << std::set<unsigned>();
+			}
+			header2.taxon_array_size = out.tell() - shift - header2.taxon_array_offset;
+		}
+		if (!config.nodesdmp.empty()) {
+			header2.taxon_nodes_offset = out.tell() - shift;
+			TaxonomyNodes::build(out);
+		}
+		else if (header2.taxon_nodes_offset) {
+			header2.taxon_nodes_offset = out.tell() - shift;
+			out.write_raw(taxon_nodes);
+		}
+		if (!config.namesdmp.empty()) {
+			header2.taxon_names_offset = out.tell() - shift;
+			out << taxonomy.name_;
+		}
+		else if (header2.taxon_names_offset) {
+			header2.taxon_names_offset = out.tell() - shift;
+			out.write_raw(taxon_names);
+		}
+		const uint64_t staged_end = out.tell();
+
+		timer.go("Relocating the old trailer");
+		ReferenceHeader moved_header = old_header;
+		ReferenceHeader2 moved_header2 = old_header2;
+		moved_header.pos_array_offset = staged_end;
+		out.write(pos_array.data(), old_seqs);
+		out.write(Pos_record(seqs_end, 0));
+		if (old_header2.taxon_array_offset) {
+			moved_header2.taxon_array_offset = out.tell();
+			out.write_raw(taxon_array);
+		}
+		if (old_header2.taxon_nodes_offset) {
+			moved_header2.taxon_nodes_offset = out.tell();
+			out.write_raw(taxon_nodes);
+		}
+		if (old_header2.taxon_names_offset) {
+			moved_header2.taxon_names_offset = out.tell();
+			out.write_raw(taxon_names);
+		}
+		valid_size = out.tell();
+		write_headers(out, moved_header, moved_header2);
+
+		timer.go("Moving the appended data");
+		InputFile staged(config.database, InputFile::BUFFERED);
+		staged.seek(old_size);
+		out.seek(seqs_end);
+		vector<char> buf(1 << 20);
+		for (uint64_t n = staged_end - old_size; n > 0;) {
+			const size_t count = (size_t)std::min(n, (uint64_t)buf.size());
+			if (staged.read_raw(buf.data(), count) != count)
+				throw std::runtime_error("Unexpected end of file.");
+			out.write_raw(buf.data(), count);
+			n -= count;
+		}
+		staged.close();
+
+		timer.go("Closing the database file");
+		header.letters = letters;
+		header.sequences = n_seqs;
+		write_headers(out, header, header2);
+		valid_size = staged_end - shift;
+		out.close();
+		truncate_file(config.database, valid_size);
+	}
+	catch (std::exception&) {
+		try {
+			out.close();
+		}
+		catch (std::exception&) {
+		}
+		truncate_file(config.database, valid_size);
+		throw;
+	}
+
+	timer.finish();
+	message_stream << "Database hash = " << hex_print(header2.hash, 16) << endl;
+	message_stream << "Appended " << n_seqs - old_seqs << " sequences, " << letters - old_header.letters << " letters." << endl;
+	message_stream << "Database contains " << n_seqs << " sequences, " << letters << " letters." << endl;
+	message_stream << "Total time = " << total.getElapsedTimeInSec() << "s" << endl;
+}
+
+// Splits the database into shards of consecutive sequences with about the same number of letters. The shards carry the
+// sequence and letter counts of the complete database, so that a search against a shard reports the same e-values.
+void split_db()
+{
+	Timer total;
+	total.start();
+	task_timer timer("Opening the database file", true);
+	DatabaseFile db(config.database);
+	const ReferenceHeader &src_header = db.ref_header;
+	const ReferenceHeader2 &src_header2 = db.header2;
+	const size_t n_shards = config.shards;
+	if (n_shards > src_header.sequences)
+		throw std::runtime_error("The number of shards exceeds the number of sequences.");
+
+	timer.go("Reading trailer");
+	vector<Pos_record> pos_array(src_header.sequences + 1);
+	db.seek(src_header.pos_array_offset);
+	if (db.read(pos_array.data(), pos_array.size()) != pos_array.size())
+		throw std::runtime_error("Unexpected end of file.");
+	unique_ptr<TaxonList> taxon_list;
+	if (src_header2.taxon_array_offset)
+		taxon_list.reset(new TaxonList(db.seek(src_header2.taxon_array_offset), src_header.sequences, src_header2.taxon_array_size));
+	vector<char> taxon_nodes, taxon_names;
+	if (src_header2.taxon_nodes_offset)
+		taxon_nodes = read_section(db, src_header2.taxon_nodes_offset, section_end(src_header2, src_header2.taxon_nodes_offset));
+	if (src_header2.taxon_names_offset)
+		taxon_names = read_section(db, src_header2.taxon_names_offset, section_end(src_header2, src_header2.taxon_names_offset));
+
+	string prefix = config.output_file.empty() ? config.database : config.output_file;
+	if (prefix.length() > 5 && prefix.compare(prefix.length() - 5, 5, ".dmnd") == 0)
+		prefix.erase(prefix.length() - 5);
+
+	size_t begin = 0, letters = 0;
+	vector<char> record;
+	for (size_t shard = 0; shard < n_shards; ++shard) {
+		// The shard ends at the first sequence reaching its share of the letters, leaving at least one sequence per remaining shard.
+		const uint64_t target = src_header.letters * (shard + 1) / n_shards;
+		size_t end = begin, shard_letters = 0;
+		while (end < src_header.sequences - (n_shards - shard - 1) && (end == begin || letters < target || shard == n_shards - 1)) {
+			letters += pos_array[end].seq_len;
+			shard_letters += pos_array[end].seq_len;
+			++end;
+		}
+
+		const string file_name = prefix + '.' + to_string(shard) + ".dmnd";
+		timer.go("Writing shard");
+		OutputFile out(file_name);
+		ReferenceHeader header;
+		ReferenceHeader2 header2;
+		header2.masking = src_header2.masking;
+		header2.db_seqs = db.total_sequences();
+		header2.db_letters = db.total_letters();
+		out.write(&header, 1);
+		out << header2;
+
+		const uint64_t offset = out.tell();
+		vector<Pos_record> shard_pos;
+		shard_pos.reserve(end - begin + 1);
+		db.seek(pos_array[begin].pos);
+		for (size_t i = begin; i < end; ++i) {
+			const size_t size = pos_array[i + 1].pos - pos_array[i].pos, id_len = size - pos_array[i].seq_len - 3;
+			record.resize(size);
+			if (db.read(record.data(), size) != size)
+				throw std::runtime_error("Unexpected end of file.");
+			out.write(record.data(), size);
+			shard_pos.emplace_back(pos_array[i].pos - pos_array[begin].pos + offset, pos_array[i].seq_len);
+			MurmurHash3_x64_128(record.data() + 1, (int)pos_array[i].seq_len, header2.hash, header2.hash);
+			MurmurHash3_x64_128(record.data() + pos_array[i].seq_len + 2, (int)id_len, header2.hash, header2.hash);
+		}
+
+		header.pos_array_offset = pos_array[end].pos - pos_array[begin].pos + offset;
+		shard_pos.emplace_back(header.pos_array_offset, 0);
+		out.write_raw(shard_pos);
+		if (taxon_list) {
+			header2.taxon_array_offset = out.tell();
+			out.set(Serializer::VARINT);
+			for (size_t i = begin; i < end; ++i) {
+				const vector<unsigned> t((*taxon_list)[i]);
+				out << std::set<unsigned>(t.begin(), t.end());
+			}
+			header2.taxon_array_size = out.tell() - header2.taxon_array_offset;
+		}
+		if (src_header2.taxon_nodes_offset) {
+			header2.taxon_nodes_offset = out.tell();
+			out.write_raw(taxon_nodes);
+		}
+		if (src_header2.taxon_names_offset) {
+			header2.taxon_names_offset = out.tell();
+			out.write_raw(taxon_names);
+		}
+
+		header.sequences = end - begin;
+		header.letters = shard_letters;
+		out.seek(0);
+		out.write(&header, 1);
+		out << header2;
+		out.close();
+		timer.finish();
+		message_stream << "Shard " << file_name << ": " << header.sequences << " sequences, " << header.letters << " letters, hash = " << hex_print(header2.hash, 16) << endl;
+		begin = end;
+	}
+	db.close();
+	message_stream << "Total time = " << total.getElapsedTimeInSec() << "s" << endl;
+}
+
 void DatabaseFile::seek_seq(size_t i) {
 	pos_array_offset = ref_header.pos_array_offset + sizeof(Pos_record)*i;
 }
@@ -265,10 +602,13 @@ size_t DatabaseFile::tell_seq() const {
 }
 
 void DatabaseFile::seek_direct() {
-	seek(sizeof(ReferenceHeader) + sizeof(ReferenceHeader2) + 8);
+	Pos_record r;
+	seek(ref_header.pos_array_offset);
+	read(&r, 1);
+	seek(r.pos);
 }
 
-bool DatabaseFile::load_seqs(vector<unsigned> &block_to_database_id, size_t max_letters, Sequence_set **dst_seq, String_set<0> **dst_id, bool load_ids, const vector<bool> *filter)
+bool DatabaseFile::load_seqs(vector<unsigned> &block_to_database_id, size_t max_letters, Sequence_set **dst_seq, String_set<0> **dst_id, bool load_ids, const vector<bool> *filter, bool hard_mask)
 {
 	task_timer timer("Loading reference sequences");
 	seek(pos_array_offset);
@@ -319,6 +659,7 @@ bool DatabaseFile::load_seqs(vector<unsigned> &block_to_database_id, size_t max_
 	if(load_ids) (*dst_id)->finish_reserve();
 	seek(start_offset);
 
+	size_t masked_letters = 0;
 	for (size_t n = 0; n < seqs; ++n) {
 		if (filter && filtered_pos[n]) seek(filtered_pos[n]);
 		read((*dst_seq)->ptr(n) - 1, (*dst_seq)->length(n) + 2);
@@ -328,17 +669,40 @@ bool DatabaseFile::load_seqs(vector<unsigned> &block_to_database_id, size_t max_
 			read((*dst_id)->ptr(n), (*dst_id)->length(n) + 1);
 		else
 			if (!seek_forward('\0')) throw std::runtime_error("Unexpected end of file.");
-		Masking::get().remove_bit_mask((*dst_seq)->ptr(n), (*dst_seq)->length(n));
+		if (hard_mask)
+			Masking::get().bit_to_hard_mask((*dst_seq)->ptr(n), (*dst_seq)->length(n), masked_letters);
+		else
+			Masking::get().remove_bit_mask((*dst_seq)->ptr(n), (*dst_seq)->length(n));
 		if (!config.sfilt.empty() && strstr((**dst_id)[n].c_str(), config.sfilt.c_str()) == 0)
 			memset((*dst_seq)->ptr(n), value_traits.mask_char, (*dst_seq)->length(n));
 	}
 	timer.finish();
 	(*dst_seq)->print_stats();
+	if (hard_mask)
+		log_stream << "Masked letters (stored in database): " << masked_letters << endl;
 
 	blocked_processing = seqs_processed < ref_header.sequences;
 	return true;
 }
 
+bool DatabaseFile::skip_seqs(size_t max_letters, const vector<bool> *filter)
+{
+	seek(pos_array_offset);
+	size_t database_id = tell_seq(), letters = 0, seqs = 0;
+	Pos_record r;
+	read(&r, 1);
+	while (r.seq_len > 0 && letters < max_letters) {
+		if (!filter || (*filter)[database_id]) {
+			letters += r.seq_len;
+			++seqs;
+		}
+		read(&r, 1);
+		pos_array_offset += sizeof(Pos_record);
+		++database_id;
+	}
+	return seqs > 0;
+}
+
 void DatabaseFile::read_seq(string &id, vector<char> &seq)
 {
 	char c;
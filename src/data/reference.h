@@ -54,12 +54,18 @@ struct ReferenceHeader2
 		taxon_array_offset(0),
 		taxon_array_size(0),
 		taxon_nodes_offset(0),
-		taxon_names_offset(0)
+		taxon_names_offset(0),
+		masking(0),
+		db_seqs(0),
+		db_letters(0)
 	{
 		memset(hash, 0, sizeof(hash));
 	}
 	char hash[16];
-	uint64_t taxon_array_offset, taxon_array_size, taxon_nodes_offset, taxon_names_offset;
+	// masking is the parameter hash of the soft masks stored in the sequences, 0 if the sequences are unmasked.
+	uint64_t taxon_array_offset, taxon_array_size, taxon_nodes_offset, taxon_names_offset, masking;
+	// For a shard produced by dbsplit, the sequence and letter counts of the complete database, otherwise 0.
+	uint64_t db_seqs, db_letters;
 
 	friend Serializer& operator<<(Serializer &s, const ReferenceHeader2 &h);
 	friend Deserializer& operator>>(Deserializer &d, ReferenceHeader2 &h);
@@ -80,12 +86,17 @@ struct DatabaseFile : public InputFile
 	static DatabaseFile* auto_create_from_fasta();
 	static bool is_diamond_db(const string &file_name);
 	void rewind();
-	bool load_seqs(vector<unsigned> &block_to_database_id, size_t max_letters, Sequence_set **dst_seq, String_set<0> **dst_id, bool load_ids = true, const vector<bool> *filter = NULL);
+	bool load_seqs(vector<unsigned> &block_to_database_id, size_t max_letters, Sequence_set **dst_seq, String_set<0> **dst_id, bool load_ids = true, const vector<bool> *filter = NULL, bool hard_mask = false);
+	bool skip_seqs(size_t max_letters, const vector<bool> *filter = NULL);
 	void get_seq();
 	void read_seq(string &id, vector<char> &seq);
 	bool has_taxon_id_lists();
 	bool has_taxon_nodes();
 	bool has_taxon_scientific_names();
+	bool has_masking() const;
+	// Sequence and letter counts used for the statistics, which are those of the complete database for a shard.
+	uint64_t total_sequences() const;
+	uint64_t total_letters() const;
 	void close();
 	void seek_seq(size_t i);
 	size_t tell_seq() const;
@@ -104,6 +115,8 @@ private:
 };
 
 void make_db(TempFile **tmp_out = nullptr);
+void append_db();
+void split_db();
 
 struct ref_seqs
 {
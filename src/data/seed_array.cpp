@@ -17,20 +17,21 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ****/
 
 #include <stdint.h>
+#include <limits>
 #include "seed_array.h"
 #include "seed_set.h"
 
-typedef vector<Array<SeedArray::Entry*, Const::seedp> > PtrSet;
-
-char* SeedArray::alloc_buffer(const Partitioned_histogram &hst)
+bool seed_loc32(size_t letters)
 {
-	return new char[sizeof(Entry) * hst.max_chunk_size()];
+	return letters <= (size_t)std::numeric_limits<uint32_t>::max();
 }
 
+template<typename _pos>
 struct BufferedWriter
 {
+	typedef typename SeedArray<_pos>::Entry Entry;
 	static const unsigned BUFFER_SIZE = 16;
-	BufferedWriter(SeedArray::Entry* const* ptr)
+	BufferedWriter(Entry* const* ptr)
 	{
 		memset(n, 0, sizeof(n));
 		memcpy(this->ptr, ptr, sizeof(this->ptr));
@@ -40,14 +41,14 @@ struct BufferedWriter
 		const unsigned p = seed_partition(key);
 		if (range.contains(p)) {
 			assert(n[p] < BUFFER_SIZE);
-			buf[p][n[p]++] = SeedArray::Entry(seed_partition_offset(key), value);
+			buf[p][n[p]++] = Entry(seed_partition_offset(key), (_pos)value);
 			if (n[p] == BUFFER_SIZE)
 				flush(p);
 		}
 	}
 	void flush(unsigned p)
 	{
-		memcpy(ptr[p], buf[p], n[p] * sizeof(SeedArray::Entry));
+		memcpy(ptr[p], buf[p], n[p] * sizeof(Entry));
 		ptr[p] += n[p];
 		n[p] = 0;
 	}
@@ -57,13 +58,14 @@ struct BufferedWriter
 			if (n[p] > 0)
 				flush(p);
 	}
-	SeedArray::Entry *ptr[Const::seedp], buf[Const::seedp][BUFFER_SIZE];
+	Entry *ptr[Const::seedp], buf[Const::seedp][BUFFER_SIZE];
 	uint8_t n[Const::seedp];
 };
 
-PtrSet build_iterators(SeedArray &sa, const shape_histogram &hst)
+template<typename _pos>
+vector<Array<typename SeedArray<_pos>::Entry*, Const::seedp>> build_iterators(SeedArray<_pos> &sa, const shape_histogram &hst)
 {
-	PtrSet iterators(hst.size());
+	vector<Array<typename SeedArray<_pos>::Entry*, Const::seedp>> iterators(hst.size());
 	for (unsigned i = 0; i < Const::seedp; ++i)
 		iterators[0][i] = sa.begin(i);
 
@@ -73,11 +75,12 @@ PtrSet build_iterators(SeedArray &sa, const shape_histogram &hst)
 	return iterators;
 }
 
+template<typename _pos>
 struct BuildCallback
 {
-	BuildCallback(const SeedPartitionRange &range, SeedArray::Entry* const* ptr) :
+	BuildCallback(const SeedPartitionRange &range, typename SeedArray<_pos>::Entry* const* ptr) :
 		range(range),
-		it(new BufferedWriter(ptr))
+		it(new BufferedWriter<_pos>(ptr))
 	{ }
 	bool operator()(uint64_t seed, uint64_t pos, size_t shape)
 	{
@@ -93,24 +96,28 @@ struct BuildCallback
 		delete it;
 	}
 	SeedPartitionRange range;
-	BufferedWriter *it;
+	BufferedWriter<_pos> *it;
 };
 
+template<typename _pos>
 template<typename _filter>
-SeedArray::SeedArray(const Sequence_set &seqs, size_t shape, const shape_histogram &hst, const SeedPartitionRange &range, const vector<size_t> &seq_partition, char *buffer, const _filter *filter) :
+SeedArray<_pos>::SeedArray(const Sequence_set &seqs, size_t shape, const shape_histogram &hst, const SeedPartitionRange &range, const vector<size_t> &seq_partition, char *buffer, const _filter *filter) :
 	data_((Entry*)buffer)
 {
 	begin_[range.begin()] = 0;
 	for (size_t i = range.begin(); i < range.end(); ++i)
 		begin_[i + 1] = begin_[i] + partition_size(hst, i);
 
-	PtrSet iterators(build_iterators(*this, hst));
-	PtrVector<BuildCallback> cb;
+	vector<Array<Entry*, Const::seedp>> iterators(build_iterators(*this, hst));
+	PtrVector<BuildCallback<_pos>> cb;
 	for (size_t i = 0; i < seq_partition.size() - 1; ++i)
-		cb.push_back(new BuildCallback(range, iterators[i].begin()));
+		cb.push_back(new BuildCallback<_pos>(range, iterators[i].begin()));
 	seqs.enum_seeds(cb, seq_partition, shape, shape + 1, filter);
 }
 
-template SeedArray::SeedArray(const Sequence_set &, size_t, const shape_histogram &, const SeedPartitionRange &, const vector<size_t>&, char *buffer, const No_filter *);
-template SeedArray::SeedArray(const Sequence_set &, size_t, const shape_histogram &, const SeedPartitionRange &, const vector<size_t>&, char *buffer, const Seed_set *);
-template SeedArray::SeedArray(const Sequence_set &, size_t, const shape_histogram &, const SeedPartitionRange &, const vector<size_t>&, char *buffer, const Hashed_seed_set *);
\ No newline at end of file
+template SeedArray<Packed_loc>::SeedArray(const Sequence_set &, size_t, const shape_histogram &, const SeedPartitionRange &, const vector<size_t>&, char *buffer, const No_filter *);
+template SeedArray<Packed_loc>::SeedArray(const Sequence_set &, size_t, const shape_histogram &, const SeedPartitionRange &, const vector<size_t>&, char *buffer, const Seed_set *);
+template SeedArray<Packed_loc>::SeedArray(const Sequence_set &, size_t, const shape_histogram &, const SeedPartitionRange &, const vector<size_t>&, char *buffer, const Hashed_seed_set *);
+template SeedArray<uint32_t>::SeedArray(const Sequence_set &, size_t, const shape_histogram &, const SeedPartitionRange &, const vector<size_t>&, char *buffer, const No_filter *);
+template SeedArray<uint32_t>::SeedArray(const Sequence_set &, size_t, const shape_histogram &, const SeedPartitionRange &, const vector<size_t>&, char *buffer, const Seed_set *);
+template SeedArray<uint32_t>::SeedArray(const Sequence_set &, size_t, const shape_histogram &, const SeedPartitionRange &, const vector<size_t>&, char *buffer, const Hashed_seed_set *);
@@ -21,14 +21,16 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "seed_histogram.h"
 #include "../basic/packed_loc.h"
+#include "../util/system/buffer_pool.h"
 
 #pragma pack(1)
 
+// Seed locations are stored either as 40 bit offsets into the sequence block or, if both blocks are small
+// enough, as 32 bit offsets, so that entries are 8 bytes wide and stay aligned within the buffer.
+template<typename _pos>
 struct SeedArray
 {
 
-	typedef Packed_loc _pos;
-
 	struct Entry
 	{
 		Entry() :
@@ -62,7 +64,10 @@ struct SeedArray
 		return begin_[i + 1] - begin_[i];
 	}
 
-	static char *alloc_buffer(const Partitioned_histogram &hst);
+	static char *alloc_buffer(const Partitioned_histogram &hst)
+	{
+		return BufferPool::get().alloc(sizeof(Entry) * hst.max_chunk_size());
+	}
 
 private:
 
@@ -73,4 +78,11 @@ private:
 
 #pragma pack()
 
-#endif
\ No newline at end of file
+bool seed_loc32(size_t letters);
+
+inline char* alloc_seed_buffer(const Partitioned_histogram &hst, bool loc32)
+{
+	return loc32 ? SeedArray<uint32_t>::alloc_buffer(hst) : SeedArray<Packed_loc>::alloc_buffer(hst);
+}
+
+#endif
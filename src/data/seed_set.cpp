@@ -55,9 +55,24 @@ Seed_set::Seed_set(const Sequence_set &seqs, double max_coverage):
 	coverage_ = (double)v.back().coverage / pow(Reduction::reduction.size(), shapes[0].length_);
 }
 
+struct Seed_count_callback
+{
+	Seed_count_callback(vector<size_t> &count):
+		count(count)
+	{}
+	bool operator()(uint64_t seed, uint64_t pos, uint64_t shape)
+	{
+		++count[shape];
+		return true;
+	}
+	void finish()
+	{}
+	vector<size_t> &count;
+};
+
 struct Hashed_seed_set_callback
 {
-	Hashed_seed_set_callback(PtrVector<PHash_set<Modulo2, No_hash> > &dst):
+	Hashed_seed_set_callback(PtrVector<Blocked_bloom_filter> &dst):
 		dst(dst)
 	{}
 	bool operator()(uint64_t seed, uint64_t pos, uint64_t shape)
@@ -67,16 +82,20 @@ struct Hashed_seed_set_callback
 	}
 	void finish()
 	{}
-	PtrVector<PHash_set<Modulo2, No_hash> > &dst;
+	PtrVector<Blocked_bloom_filter> &dst;
 };
 
 Hashed_seed_set::Hashed_seed_set(const Sequence_set &seqs)
 {
+	vector<size_t> count(shapes.count());
+	PtrVector<Seed_count_callback> c;
+	c.push_back(new Seed_count_callback(count));
+	seqs.enum_seeds(c, seqs.partition(1), 0, shapes.count(), &no_filter);
 	for (size_t i = 0; i < shapes.count(); ++i)
-		data_.push_back(new PHash_set<Modulo2, No_hash>(next_power_of_2(seqs.letters()*1.25)));
+		data_.push_back(new Blocked_bloom_filter(count[i], BITS_PER_KEY));
 	PtrVector<Hashed_seed_set_callback> v;
 	v.push_back(new Hashed_seed_set_callback(data_));
 	seqs.enum_seeds(v, seqs.partition(1), 0, shapes.count(), &no_filter);
 	for (size_t i = 0; i < shapes.count(); ++i)
-		log_stream << "Shape=" << i << " Hash_table_size=" << data_[i].size() << " load=" << data_[i].load() << endl;
-}
\ No newline at end of file
+		log_stream << "Shape=" << i << " Seeds=" << count[i] << " Filter_size=" << data_[i].size() << " load=" << data_[i].load() << endl;
+}
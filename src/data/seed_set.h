@@ -23,9 +23,11 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "sequence_set.h"
 #include "../util/hash_table.h"
 #include "../util/ptr_vector.h"
+#include "../util/data_structures/bloom_filter.h"
 
 struct Seed_set
 {
+	enum { BATCH = 1 };
 	Seed_set(const Sequence_set &seqs, double max_coverage);
 	bool contains(uint64_t key, uint64_t shape) const
 	{
@@ -40,15 +42,22 @@ private:
 	double coverage_;
 };
 
+// Approximate set of the query seeds per shape. False positives only let additional reference seeds into the
+// seed arrays, which the hash join discards. Lookups are batched so that the cache misses overlap.
 struct Hashed_seed_set
 {
+	enum { BATCH = 16, BITS_PER_KEY = 16 };
 	Hashed_seed_set(const Sequence_set &seqs);
 	bool contains(uint64_t key, uint64_t shape) const
 	{
 		return data_[shape].contains(key);
 	}
+	void prefetch(uint64_t key, uint64_t shape) const
+	{
+		data_[shape].prefetch(key);
+	}
 private:
-	PtrVector<PHash_set<Modulo2, No_hash> > data_;
+	PtrVector<Blocked_bloom_filter> data_;
 };
 
 #endif
\ No newline at end of file
@@ -35,6 +35,58 @@ using std::cout;
 using std::endl;
 using std::pair;
 
+// Passes the seeds accepted by the filter on to the callback. Filters with a batch size greater than one are
+// probed for a batch of seeds at once, so that their memory accesses are issued before the first lookup.
+template<typename _f, typename _filter, bool _batched = (_filter::BATCH > 1)>
+struct Filtered_seeds
+{
+	Filtered_seeds(_f *f, const _filter *filter) :
+		f(f),
+		filter(filter)
+	{}
+	bool operator()(uint64_t key, uint64_t pos, uint64_t shape)
+	{
+		return filter->contains(key, shape) ? (*f)(key, pos, shape) : true;
+	}
+	bool flush()
+	{
+		return true;
+	}
+	_f *f;
+	const _filter *filter;
+};
+
+template<typename _f, typename _filter>
+struct Filtered_seeds<_f, _filter, true>
+{
+	Filtered_seeds(_f *f, const _filter *filter) :
+		f(f),
+		filter(filter),
+		n(0)
+	{}
+	bool operator()(uint64_t key, uint64_t pos, uint64_t shape)
+	{
+		filter->prefetch(key, shape);
+		key_[n] = key;
+		pos_[n] = pos;
+		shape_[n] = shape;
+		return ++n == _filter::BATCH ? flush() : true;
+	}
+	bool flush()
+	{
+		const unsigned m = n;
+		n = 0;
+		for (unsigned i = 0; i < m; ++i)
+			if (filter->contains(key_[i], shape_[i]) && (*f)(key_[i], pos_[i], shape_[i]) == false)
+				return false;
+		return true;
+	}
+	_f *f;
+	const _filter *filter;
+	unsigned n;
+	uint64_t key_[_filter::BATCH], pos_[_filter::BATCH], shape_[_filter::BATCH];
+};
+
 struct Sequence_set : public String_set<sequence::DELIMITER, 1>
 {
 
@@ -158,6 +210,7 @@ private:
 	{
 		vector<char> buf(max_len(begin, end));
 		uint64_t key;
+		Filtered_seeds<_f, _filter> out(f, filter);
 		for (unsigned i = begin; i < end; ++i) {
 			const sequence seq = (*this)[i];
 			Reduction::reduce_seq(seq, buf);
@@ -168,12 +221,12 @@ private:
 				size_t j = 0;
 				while (it.good()) {
 					if (it.get(key, sh))
-						if (filter->contains(key, shape_id))
-							(*f)(key, position(i, j), shape_id);
+						out(key, position(i, j), shape_id);
 					++j;
 				}
 			}
 		}
+		out.flush();
 		f->finish();
 	}
 
@@ -181,6 +234,7 @@ private:
 	void enum_seeds_hashed(_f *f, unsigned begin, unsigned end, pair<size_t, size_t> shape_range, const _filter *filter) const
 	{
 		uint64_t key;
+		Filtered_seeds<_f, _filter> out(f, filter);
 		for (unsigned i = begin; i < end; ++i) {
 			const sequence seq = (*this)[i];
 			for (size_t shape_id = shape_range.first; shape_id < shape_range.second; ++shape_id) {
@@ -191,12 +245,12 @@ private:
 				size_t j = 0;
 				while (it.good()) {
 					if (it.get(key, shape_mask))
-						if (filter->contains(key, shape_id))
-							(*f)(key, position(i, j), shape_id);
+						out(key, position(i, j), shape_id);
 					++j;
 				}
 			}
 		}
+		out.flush();
 		f->finish();
 	}
 
@@ -204,6 +258,7 @@ private:
 	void enum_seeds_contiguous(_f *f, unsigned begin, unsigned end, const _filter *filter) const
 	{
 		uint64_t key;
+		Filtered_seeds<_f, _filter> out(f, filter);
 		for (unsigned i = begin; i < end; ++i) {
 			const sequence seq = (*this)[i];
 			if (seq.length() < _it::length()) continue;
@@ -211,12 +266,13 @@ private:
 			size_t j = 0;
 			while (it.good()) {
 				if (it.get(key))
-					if (filter->contains(key, 0))
-						if ((*f)(key, position(i, j), 0) == false)
-							return;
+					if (out(key, position(i, j), 0) == false)
+						return;
 				++j;
 			}
 		}
+		if (out.flush() == false)
+			return;
 		f->finish();
 	}
 
@@ -276,6 +332,7 @@ private:
 
 struct No_filter
 {
+	enum { BATCH = 1 };
 	bool contains(uint64_t seed, uint64_t shape) const
 	{
 		return true;
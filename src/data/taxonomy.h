@@ -48,6 +48,7 @@ struct Taxonomy
 			const size_t l = strlen(s);
 			if (l > max_accesion_len)
 				throw AccessionLengthError();
+			memset(this->s, 0, max_accesion_len);
 			std::copy(s, s + l, this->s);
 		}
 		Accession(const std::string &s)
@@ -58,8 +59,8 @@ struct Taxonomy
 				//this->s[0] = 0;
 				throw AccessionLengthError();
 			}
-			else
-				std::copy(t.c_str(), t.c_str() + t.length(), this->s);
+			memset(this->s, 0, max_accesion_len);
+			std::copy(t.c_str(), t.c_str() + t.length(), this->s);
 		}
 		bool operator<(const Accession &y) const
 		{
@@ -155,11 +155,13 @@ void traceback(const sequence &query,
 	int j,
 	Hsp &l)
 {
+	// The transcript is built in a per-thread buffer and copied into the HSP once its length is known.
+	static thread_local Packed_transcript transcript;
 	Banded_traceback_matrix dp(scores, band, i0);
 	//dp.print(i + 1, j + 1);
 	l.query_range.end_ = i + 1;
 	l.subject_range.end_ = j + 1;
-	l.transcript.clear();
+	transcript.clear();
 
 	int gap_len, score;
 
@@ -169,12 +171,12 @@ void traceback(const sequence &query,
 
 		if (score == match_score + dp(i - 1, j - 1)) {
 			if (query[i] == subject[j]) {
-				l.transcript.push_back(op_match);
+				transcript.push_back(op_match);
 				++l.identities;
 				++l.positives;
 			}
 			else {
-				l.transcript.push_back(op_substitution, subject[j]);
+				transcript.push_back(op_substitution, subject[j]);
 				++l.mismatches;
 				if (match_score > 0)
 					++l.positives;
@@ -192,19 +194,20 @@ void traceback(const sequence &query,
 			l.gaps += gap_len;
 			if (g == 0) {
 				i -= gap_len;
-				l.transcript.push_back(op_insertion, (unsigned)gap_len);
+				transcript.push_back(op_insertion, (unsigned)gap_len);
 			}
 			else {
 				for (; gap_len > 0; gap_len--)
-					l.transcript.push_back(op_deletion, subject[j--]);
+					transcript.push_back(op_deletion, subject[j--]);
 			}
 		}
 	}
 
 	l.query_range.begin_ = i + 1;
 	l.subject_range.begin_ = j + 1;
-	l.transcript.reverse();
-	l.transcript.push_terminator();
+	transcript.reverse();
+	transcript.push_terminator();
+	l.transcript = transcript;
 }
 
 struct Banded_dp_matrix
@@ -31,6 +31,8 @@ void init_cbs()
 	}
 }
 
+// Sums of the scores of the window letters against each amino acid. The rows are updated over their full width of 32
+// so that the compiler can vectorise the updates; only the first 20 entries are read.
 struct Vector_scores
 {
 	Vector_scores()
@@ -39,22 +41,29 @@ struct Vector_scores
 	}
 	Vector_scores& operator+=(Letter l)
 	{
-		for (unsigned i = 0; i < 20; ++i)
-			scores[i] += score_matrix(l, i);
+		const int8_t *row = &score_matrix.matrix8()[int(l) << 5];
+		for (unsigned i = 0; i < 32; ++i)
+			scores[i] += row[i];
 		return *this;
 	}
 	Vector_scores& operator-=(Letter l)
 	{
-		for (unsigned i = 0; i < 20; ++i)
-			scores[i] -= score_matrix(l, i);
+		const int8_t *row = &score_matrix.matrix8()[int(l) << 5];
+		for (unsigned i = 0; i < 32; ++i)
+			scores[i] -= row[i];
 		return *this;
 	}
-	int scores[20];
+	int scores[32];
 };
 
-Bias_correction::Bias_correction(const sequence &seq):
-	vector<float>(seq.length())
+Bias_correction::Bias_correction(const sequence &seq)
 {
+	set(seq);
+}
+
+void Bias_correction::set(const sequence &seq)
+{
+	assign(seq.length(), 0.0f);
 	Vector_scores scores;
 	const unsigned window = config.cbs_window, window_half = std::min(window/2, (unsigned)seq.length() - 1);
 	unsigned n = 0;
@@ -102,6 +111,7 @@ Bias_correction::Bias_correction(const sequence &seq):
 
 int Bias_correction::operator()(const Hsp &hsp) const
 {
+	assert(!empty());
 	float s = 0;
 	for (Hsp::Iterator i = hsp.begin(); i.good(); ++i) {
 		switch (i.op()) {
@@ -117,6 +127,7 @@ int Bias_correction::operator()(const Hsp &hsp) const
 
 int Bias_correction::operator()(const Diagonal_segment &d) const
 {
+	assert(!empty());
 	float s = 0;
 	const int end = d.query_end();
 	for (int i = d.i; i < end; ++i)
@@ -55,7 +55,41 @@ size_t cells = 0;
 
 void scan_cols(const Long_score_profile &qp, sequence s, int i, int j, int j_end, vector<uint8_t> &sv_max, bool log, Band &buf, Band &local_max, int block_len)
 {
-#ifdef __SSE2__
+#if defined(__AVX2__)
+	// Same as the SSE2 version below, but covers 32 diagonals per pass. The profile padding keeps the 32 byte loads in bounds.
+	const __m256i vbias = _mm256_set1_epi8(score_matrix.bias());
+	const int qlen = (int)qp.length(),
+		diags = buf.diags();
+
+	int j2 = std::max(-(i - j + 31), j),
+		i3 = j2 + i - j,
+		j2_end = std::min(qlen - (i - j), j_end);
+	uint8_t *local_max_ptr = local_max.data() + (j2 - j) / 16 * diags,
+		*buf_ptr = buf.data() + (j2 - j)*diags;
+	__m256i v = _mm256_setzero_si256(), max = _mm256_setzero_si256(), global_max = _mm256_setzero_si256();
+	for (; j2 < j2_end; ++j2, ++i3) {
+		assert(j2 >= 0);
+		const uint8_t *q = qp.get(s[j2], i3);
+		v = _mm256_subs_epu8(_mm256_adds_epu8(v, _mm256_loadu_si256((const __m256i*)q)), vbias);
+		max = _mm256_max_epu8(max, v);
+		assert(buf.check(buf_ptr + 32));
+		_mm256_storeu_si256((__m256i*)buf_ptr, v);
+		buf_ptr += diags;
+		if (((j2 - j) & 15) == 15) {
+			global_max = _mm256_max_epu8(global_max, max);
+			assert(local_max.check(local_max_ptr + 32));
+			_mm256_storeu_si256((__m256i*)local_max_ptr, max);
+			local_max_ptr += diags;
+			max = _mm256_setzero_si256();
+		}
+	}
+	if (((j2 - j) & 15) != 0) {
+		global_max = _mm256_max_epu8(global_max, max);
+		assert(local_max.check(local_max_ptr));
+		_mm256_storeu_si256((__m256i*)local_max_ptr, max);
+	}
+	_mm256_storeu_si256((__m256i*)&sv_max[0], global_max);
+#elif defined(__SSE2__)
 	typedef score_vector<uint8_t> Sv;
 	const Sv vbias(score_matrix.bias());
 	const int qlen = (int)qp.length(),
@@ -289,12 +323,12 @@ void Diag_scores::scan_diags(int d_begin, int d_end, sequence query, sequence su
 	j_begin = i_begin - d_begin;
 	const int j1 = std::min(qlen - d_begin, slen);
 	sv_max.clear();
-	sv_max.resize(16);
+	sv_max.resize(channels);
 	assert(j1 > j_begin);
-	score_buf.init(16, j1 - j_begin);
-	local_max.init(16, (j1 - j_begin + block_len - 1) / block_len);
+	score_buf.init(channels, j1 - j_begin);
+	local_max.init(channels, (j1 - j_begin + block_len - 1) / block_len);
 
-	for (int i = i_begin; i < i_begin + band; i += 16) {
+	for (int i = i_begin; i < i_begin + band; i += channels) {
 
 		memset(sv_max.data(), 0, sv_max.size());
 		
@@ -304,7 +338,8 @@ void Diag_scores::scan_diags(int d_begin, int d_end, sequence query, sequence su
 		scan_cols(query, subject, i, j_begin, j1, sv_max, log, score_buf, local_max, block_len);
 #endif
 
-		for (int o = 0; o < 16; ++o)
+		const int n = std::min((int)channels, i_begin + band - i);
+		for (int o = 0; o < n; ++o)
 			if (sv_max[o] >= Diag_scores::min_diag_score) {
 				if (sv_max[o] >= 255 - score_matrix.bias()) {
 					const int s = std::min(i + o, 0), i0 = i + o - s, j0 = j_begin - s;
@@ -42,9 +42,13 @@ struct No_score_correction
 
 struct Bias_correction : public vector<float>
 {
+	Bias_correction()
+	{}
 	Bias_correction(const sequence &seq);
+	void set(const sequence &seq);
 	void operator()(float &score, int i, int query_anchor, int mult) const
 	{
+		assert(!empty());
 		score += (*this)[query_anchor + i*mult];
 	}
 	int operator()(const Hsp &hsp) const;
@@ -193,6 +197,10 @@ int xdrop_ungapped(const Letter *query, const Letter *subject, unsigned &delta,
 int xdrop_ungapped_right(const Letter *query, const Letter *subject, int &len);
 Diagonal_segment xdrop_ungapped(const sequence &query, const Bias_correction &query_bc, const sequence &subject, int qa, int sa);
 Diagonal_segment xdrop_ungapped(const sequence &query, const sequence &subject, int qa, int sa);
+// Batched versions of the extensions above with identical results. The letters of the following hits are prefetched, the
+// second one extends along the diagonal in vector registers.
+void xdrop_ungapped(const Letter *const *query, const Letter *const *subject, unsigned seed_len, size_t n, int *score, unsigned *delta, unsigned *len);
+void xdrop_ungapped(const Letter *const *query, const Letter *const *subject, size_t n, int *score, int *delta, int *len);
 
 struct Local {};
 struct Global {};
@@ -484,7 +492,12 @@ extern size_t cells;
 
 struct Diag_scores {
 	enum {
-		block_len = 16
+		block_len = 16,
+#ifdef __AVX2__
+		channels = 32
+#else
+		channels = 16
+#endif
 	};
 	int dj0(int d) const
 	{
@@ -142,6 +142,22 @@ int score_range(sequence query, sequence subject, int i, int j, int j_end)
 	return score;
 }
 
+// Scores of the letter pairs along a diagonal, looked up 8 at a time with AVX2 gathers.
+void diagonal_scores(const Letter *query, const Letter *subject, int n, int *out)
+{
+	int k = 0;
+#ifdef __AVX2__
+	const int *matrix = score_matrix.matrix32();
+	for (; k + 8 <= n; k += 8) {
+		const __m256i q = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(query + k))),
+			s = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(subject + k)));
+		_mm256_storeu_si256((__m256i*)(out + k), _mm256_i32gather_epi32(matrix, _mm256_add_epi32(_mm256_slli_epi32(q, 5), s), 4));
+	}
+#endif
+	for (; k < n; ++k)
+		out[k] = score_matrix(query[k], subject[k]);
+}
+
 int get_hgap_link(const Diagonal_segment &d1, const Diagonal_segment &d2, sequence query, sequence subject, Link &l, int padding)
 {
 	const int d = d1.diag() - d2.diag(),
@@ -167,24 +183,30 @@ int get_hgap_link(const Diagonal_segment &d1, const Diagonal_segment &d2, sequen
 	int score1 = 0,
 		//score2 = score_range(query, subject, i2, j2, d2.j + d2.len);
 		score2 = score_range(query, subject, i2, j2, d2.j) + d2.score - score_range(query, subject, d2.i, d2.j, j2);
-	int max_score = std::numeric_limits<int>::min();
-	while (true) {
-		//cout << "i1=" << i1 << " j1=" << j1 << " i2=" << i2 << " j2=" << j2 << " score1=" << score1 << " score2=" << score2 << " total=" << score1 + score2 << endl;
+	// The scores along both diagonals are fetched for the whole link window at once, then scanned for the best split point.
+	static thread_local vector<int> scores1, scores2;
+	const int n = std::max(j2_end - j2, 0);
+	scores1.resize(n);
+	scores2.resize(n);
+	diagonal_scores(&query[i1 + 1], &subject[j1 + 1], n, scores1.data());
+	diagonal_scores(&query[i2], &subject[j2], n, scores2.data());
+	int max_score = std::numeric_limits<int>::min(), best = 0;
+	for (int k = 0; ; ++k) {
 		if (score1 + score2 > max_score) {
 			max_score = score1 + score2;
-			l.query_pos1 = i1;
-			l.subject_pos1 = j1;
-			l.query_pos2 = i2;
-			l.subject_pos2 = j2;
+			best = k;
 			l.score1 = score1;
 			l.score2 = score2;
 		}
-		score2 -= score_matrix(query[i2], subject[j2]);
-		++i1; ++i2; ++j1; ++j2;
-		if (j2 > j2_end)
+		if (k == n)
 			break;
-		score1 += score_matrix(query[i1], subject[j1]);
+		score2 -= scores2[k];
+		score1 += scores1[k];
 	}
+	l.query_pos1 = i1 + best;
+	l.subject_pos1 = j1 + best;
+	l.query_pos2 = i2 + best;
+	l.subject_pos2 = j2 + best;
 	const int j1_end = j2_end - d;
 	if (space)
 		l.score1 = d1.score + l.score1;
@@ -493,7 +515,8 @@ struct Greedy_aligner2
 
 	int backtrace(list<Hsp> &hsps, list<Hsp_traits> &ts, int cutoff, int max_shift) const
 	{
-		vector<Diagonal_node*> top_nodes;
+		static thread_local vector<Diagonal_node*> top_nodes;
+		top_nodes.clear();
 		for (size_t i = 0; i < diags.nodes.size(); ++i) {
 			Diagonal_node &d = diags.nodes[i];
 			//cout << "node=" << i << " prefix_score=" << d.prefix_score << " path_max=" << d.path_max << " rel_score=" << d.rel_score() << " cutoff=" << cutoff << endl;
@@ -20,6 +20,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define SCORE_PROFILE_H_
 
 #include <vector>
+#include <algorithm>
 #include "../basic/sequence.h"
 #include "score_vector.h"
 
@@ -56,13 +57,12 @@ struct sequence_stream
 		memset(data_, value_traits.mask_char, buffer_len*16);
 		unsigned n = 0;
 		typename vector<sequence>::const_iterator it (begin);
-		assert(pos < it->length());
-		const unsigned read_len (std::min(unsigned(buffer_len), static_cast<unsigned>(it->length())-pos));
 		while(it < end) {
 			const uint8_t *src (reinterpret_cast<const uint8_t*>(it->data()) + pos);
 			_score *dest (reinterpret_cast<_score*>(data_) + n);
 			int clip (int(pos) - it->clipping_offset_);
-			if((mask & (1 << n)) == 0) {
+			const unsigned read_len (pos < it->length() ? std::min(unsigned(buffer_len), static_cast<unsigned>(it->length())-pos) : 0);
+			if((mask & (1 << n)) == 0 && read_len > 0) {
 				if(copy_char(src, dest, mask, n, clip))
 				if(read_len > 1 && copy_char(src, dest, mask, n, clip))
 				if(read_len > 2 && copy_char(src, dest, mask, n, clip))
@@ -136,25 +136,40 @@ struct Long_score_profile
 	{}
 	Long_score_profile(sequence seq)
 	{
+		set(seq);
+	}
+	// The 25 rows are stored back to back in one buffer, which keeps its capacity when the profile is rebuilt.
+	void set(sequence seq)
+	{
+		stride_ = seq.length() + 2 * padding;
+		data_.resize(25 * stride_);
 		for (unsigned l = 0; l < 25; ++l) {
 			const uint8_t *scores = &score_matrix.matrix8u()[l << 5];
-			data[l].reserve(seq.length() + 2*padding);
-			data[l].insert(data[l].end(), padding, 0);
+			uint8_t *row = &data_[l * stride_];
+			std::fill(row, row + padding, 0);
 			for (unsigned i = 0; i < seq.length(); ++i)
-				data[l].push_back(scores[(int)seq[i]]);
-			data[l].insert(data[l].end(), padding, 0);
+				row[padding + i] = scores[(int)seq[i]];
+			std::fill(row + padding + seq.length(), row + stride_, 0);
 		}
 	}
+	void clear()
+	{
+		data_.clear();
+		stride_ = 2 * padding;
+	}
 	size_t length() const
 	{
-		return data[0].size() - 2 * padding;
+		return stride_ - 2 * padding;
 	}
 	const uint8_t* get(Letter l, int i) const
 	{
-		return &data[(int)l][i + padding];
+		assert(!data_.empty());
+		return &data_[(int)l * stride_ + i + padding];
 	}
-	vector<uint8_t> data[25];
 	enum { padding = 32 };
+private:
+	vector<uint8_t> data_;
+	size_t stride_;
 };
 
 #endif /* SCORE_PROFILE_H_ */
@@ -67,7 +67,9 @@ void smith_waterman(const sequence &query,
 	typedef score_vector<_score> sv;
 
 	unsigned qlen ((unsigned)query.length());
-	unsigned slen ((unsigned)subjects[0].length());
+	unsigned slen (0);
+	for(typename vector<sequence>::const_iterator i = subjects.begin(); i < subjects.end(); ++i)
+		slen = std::max(slen, (unsigned)i->length());
 	DP_matrix<_score> dp (slen, qlen, band, padding);
 
 	sv open_penalty (static_cast<char>(op));
@@ -119,6 +121,78 @@ void smith_waterman(const sequence &query,
 	#endif
 }
 
+// Variant of the 8 bit kernel in which every channel aligns its own query window against its subject. The query
+// windows have the same length, which together with the padding fixes the band. Since the query letters differ
+// between the channels, the scores of a cell are looked up per channel instead of being taken from a profile.
+template<typename _callback>
+void smith_waterman(const vector<sequence> &queries,
+			const vector<sequence> &subjects,
+			unsigned band,
+			unsigned padding,
+			int op,
+			int ep,
+			int filter_score,
+			_callback &f,
+			Statistics &stats)
+{
+	typedef score_vector<uint8_t> sv;
+	const unsigned channels = score_traits<uint8_t>::channels;
+
+	unsigned qlen ((unsigned)queries[0].length());
+	unsigned slen (0);
+	for(vector<sequence>::const_iterator i = subjects.begin(); i < subjects.end(); ++i)
+		slen = std::max(slen, (unsigned)i->length());
+	DP_matrix<uint8_t> dp (slen, qlen, band, padding);
+
+	sv open_penalty (static_cast<char>(op));
+	sv extend_penalty (static_cast<char>(ep));
+	sv vbias (score_matrix.bias());
+	sequence_stream dseq;
+	const uint8_t *matrix = score_matrix.matrix8u();
+	static thread_local vector<uint16_t> query_rows;
+	query_rows.resize(qlen * channels);
+	__m128i subject_letters, scores;
+	const uint8_t *s = reinterpret_cast<const uint8_t*>(&subject_letters);
+	uint8_t *sc = reinterpret_cast<uint8_t*>(&scores);
+
+	vector<sequence>::const_iterator subject_it (subjects.begin());
+	while(subject_it < subjects.end()) {
+
+		const size_t first = subject_it - subjects.begin();
+		const unsigned n_subject (std::min(channels, (unsigned)(subjects.end() - subject_it)));
+		vector<sequence>::const_iterator subject_end (subject_it + n_subject);
+		for(unsigned i = 0; i < qlen; ++i)
+			for(unsigned k = 0; k < channels; ++k)
+				query_rows[i * channels + k] = k < n_subject ? uint16_t((uint8_t)queries[first + k][i] << 5) : 0;
+		sv best;
+		dseq.reset();
+		dp.clear();
+
+		for(unsigned j=0;j<slen;++j) {
+			typename DP_matrix<uint8_t>::Column_iterator it (dp.begin(j));
+			sv vgap, hgap, column_best;
+			subject_letters = dseq.get(subject_it, subject_end, j, uint8_t());
+
+			while(!it.at_end()) {
+				const uint16_t *q = &query_rows[it.row_pos_ * channels];
+				for(unsigned k = 0; k < channels; ++k)
+					sc[k] = matrix[q[k] + s[k]];
+				hgap = it.hgap();
+				sv next = cell_update<uint8_t>(it.diag(), sv(scores), extend_penalty, open_penalty, hgap, vgap, column_best, vbias);
+				it.set_hgap(hgap);
+				it.set_score(next);
+				++it;
+			}
+			best.max(column_best);
+		}
+
+		for(unsigned i=0;i<n_subject;++i)
+			if(best[i] >= filter_score)
+				f(int(first + i), *(subject_it + i), best[i]);
+		subject_it += n_subject;
+	}
+}
+
 #endif
 
 #endif /* SSE_SW_H_ */
@@ -16,8 +16,12 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ****/
 
+#include <algorithm>
+#include <limits.h>
 #include "dp.h"
 #include "../basic/score_matrix.h"
+#include "../util/simd.h"
+#include "../util/intrin.h"
 
 int xdrop_ungapped(const Letter *query, const Letter *subject, unsigned seed_len, unsigned &delta, unsigned &len)
 {
@@ -212,4 +216,269 @@ int xdrop_ungapped_right(const Letter *query, const Letter *subject, int &len)
 		++n;
 	}
 	return score;
-}
\ No newline at end of file
+}
+
+// Number of hits ahead of the current one whose letters are prefetched. The seed positions are scattered over the
+// reference block, so the extensions are mostly bound by memory latency.
+static const size_t PREFETCH_DISTANCE = 8;
+
+static void prefetch(const Letter *query, const Letter *subject)
+{
+#ifdef __SSE2__
+	_mm_prefetch((const char*)query - 32, _MM_HINT_T0);
+	_mm_prefetch((const char*)query + 32, _MM_HINT_T0);
+	_mm_prefetch((const char*)subject - 32, _MM_HINT_T0);
+	_mm_prefetch((const char*)subject + 32, _MM_HINT_T0);
+#endif
+}
+
+// Continues an ungapped extension along a diagonal at q, s in direction dir for at most window positions. score and st
+// are the best and the running score, count is the number of extended positions and best the number of positions up
+// to the last improvement of the score.
+static void extend(const Letter *q, const Letter *s, int dir, unsigned window, int &score, int &st, unsigned &count, unsigned &best)
+{
+	while (score - st < config.raw_ungapped_xdrop
+		&& count < window
+		&& *q != sequence::DELIMITER
+		&& *s != sequence::DELIMITER)
+	{
+		st += score_matrix(*q, *s);
+		++count;
+		if (st > score) {
+			score = st;
+			best = count;
+		}
+		q += dir;
+		s += dir;
+	}
+}
+
+#ifdef __SSE2__
+
+namespace {
+
+// Ungapped extension along a diagonal in blocks of 8 positions, starting at q, s and moving in direction dir for at
+// most window positions. score and st are the best and the running score; count receives the number of extended
+// positions and best the number of positions up to the last improvement of the score. Pairs with a delimiter have a
+// score below STOP_SCORE in the 16 bit matrix. Up to 7 letters beyond the end of the extension are read.
+template<int dir>
+void extend_diagonal(const Letter *q, const Letter *s, unsigned window, int &score, int &st, unsigned &count, unsigned &best)
+{
+	enum { STOP_SCORE = -8192 };
+	const int16_t *matrix = score_matrix.matrix16();
+	const __m128i xdrop = _mm_set1_epi16((short)config.raw_ungapped_xdrop), stop_score = _mm_set1_epi16(STOP_SCORE),
+		lanes = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7), zero = _mm_setzero_si128();
+	int16_t prefix[8], prefix_max[8];
+	count = 0;
+	best = 0;
+	while (count < window) {
+		const auto sc = [matrix, q, s](int i) {
+			return matrix[(int(q[i * dir]) << 5) + int(s[i * dir])];
+		};
+		const __m128i v = _mm_setr_epi16(sc(0), sc(1), sc(2), sc(3), sc(4), sc(5), sc(6), sc(7)),
+			delimiter = _mm_cmplt_epi16(v, stop_score);
+		// Prefix sums and maxima relative to st.
+		__m128i p = _mm_andnot_si128(delimiter, v);
+		p = _mm_add_epi16(p, _mm_slli_si128(p, 2));
+		p = _mm_add_epi16(p, _mm_slli_si128(p, 4));
+		p = _mm_add_epi16(p, _mm_slli_si128(p, 8));
+		__m128i m = _mm_max_epi16(p, _mm_set1_epi16((short)(score - st)));
+		m = _mm_max_epi16(m, _mm_slli_si128(m, 2));
+		m = _mm_max_epi16(m, _mm_slli_si128(m, 4));
+		m = _mm_max_epi16(m, _mm_slli_si128(m, 8));
+		// A position is not extended if it has a delimiter, is beyond the window or the x-drop was reached before it.
+		const __m128i dropped = _mm_cmpeq_epi16(_mm_cmplt_epi16(_mm_sub_epi16(m, p), xdrop), zero),
+			outside = _mm_cmpeq_epi16(_mm_cmplt_epi16(lanes, _mm_set1_epi16((short)std::min(window - count, 8u))), zero),
+			blocked = _mm_or_si128(_mm_or_si128(delimiter, outside), _mm_slli_si128(dropped, 2));
+		const int mask = _mm_movemask_epi8(blocked), n = mask == 0 ? 8 : ctz((uint64_t)mask) / 2;
+		if (n > 0) {
+			_mm_storeu_si128((__m128i*)prefix, p);
+			_mm_storeu_si128((__m128i*)prefix_max, m);
+			const int top = prefix_max[n - 1];
+			if (top > score - st) {
+				const int first = _mm_movemask_epi8(_mm_cmpeq_epi16(p, _mm_set1_epi16((short)top)));
+				best = count + ctz((uint64_t)first) / 2 + 1;
+			}
+			score = st + top;
+			st += prefix[n - 1];
+			count += n;
+		}
+		if (n < 8 || (_mm_movemask_epi8(dropped) & 0x8000))
+			break;
+		q += 8 * dir;
+		s += 8 * dir;
+	}
+}
+
+}
+
+#endif
+
+// Extends hit i to the left of query[i], subject[i] for at most window_left positions and to the right of
+// query[i] + right_offset, subject[i] + right_offset for at most window_right positions. score[i] receives the sum of the
+// gains of both extensions, delta[i] and len[i] the length of the left and the right extension: the number of extended
+// positions if _count is set, otherwise the number of positions up to the last improvement of the score.
+// With SSE2, 8 hits are extended at a time, one per 16 bit lane. A lane switches to the right extension of its hit or
+// to the next hit as soon as its extension terminates, so lanes are not held up by long extensions of other hits.
+// Extensions that come close to overflowing the 16 bit lanes and the last hits of the batch are completed by the
+// scalar code.
+template<bool _count, typename _t>
+static void extend_hits(const Letter *const *query, const Letter *const *subject, size_t n, unsigned window_left, unsigned window_right, ptrdiff_t right_offset, int *score, _t *delta, _t *len)
+{
+	const auto left = [&](size_t i, const Letter *q, const Letter *s, int sc, int st, unsigned count, unsigned best) {
+		extend(q, s, -1, window_left, sc, st, count, best);
+		score[i] = sc;
+		delta[i] = (_t)(_count ? count : best);
+	};
+	const auto right = [&](size_t i, const Letter *q, const Letter *s, int sc, int st, unsigned count, unsigned best) {
+		extend(q, s, 1, window_right, sc, st, count, best);
+		score[i] += sc;
+		len[i] = (_t)(_count ? count : best);
+	};
+
+	for (size_t i = 0; i < std::min(n, 2 * PREFETCH_DISTANCE); ++i)
+		prefetch(query[i], subject[i]);
+
+#ifdef __SSE2__
+	enum { LANES = 8, STOP_SCORE = -8192, LIMIT = 16384 };
+	if (n >= LANES && window_left > 0 && window_right > 0 && config.raw_ungapped_xdrop > 0 && config.raw_ungapped_xdrop < LIMIT) {
+		const int16_t *matrix = score_matrix.matrix16();
+		const __m128i xdrop = _mm_set1_epi16((short)(config.raw_ungapped_xdrop - 1)), stop_score = _mm_set1_epi16(STOP_SCORE),
+			one = _mm_set1_epi16(1), limit = _mm_set1_epi16(LIMIT - 1);
+		const int16_t window16[2] = { (int16_t)(std::min(window_left, (unsigned)LIMIT) - 1), (int16_t)(std::min(window_right, (unsigned)LIMIT) - 1) };
+		const Letter *q[LANES], *s[LANES];
+		size_t hit[LANES];
+		int dir[LANES];
+		alignas(16) int16_t scores[LANES], st_a[LANES], score_a[LANES], count_a[LANES], best_a[LANES], window_a[LANES];
+
+		const auto start = [&](int l, size_t i, int d) {
+			const ptrdiff_t offset = d < 0 ? -1 : right_offset;
+			hit[l] = i;
+			dir[l] = d;
+			q[l] = query[i] + offset;
+			s[l] = subject[i] + offset;
+			st_a[l] = score_a[l] = count_a[l] = best_a[l] = 0;
+			window_a[l] = window16[d > 0];
+		};
+
+		for (int l = 0; l < LANES; ++l)
+			start(l, l, -1);
+		size_t next = LANES;
+		__m128i st = _mm_setzero_si128(), sc = st, count = st, best = st, window = _mm_load_si128((const __m128i*)window_a);
+		for (;;) {
+			for (int l = 0; l < LANES; ++l) {
+				scores[l] = matrix[(int(*q[l]) << 5) + int(*s[l])];
+				q[l] += dir[l];
+				s[l] += dir[l];
+			}
+			// Pairs with a delimiter have a score below STOP_SCORE in the 16 bit matrix and are not extended.
+			const __m128i v = _mm_load_si128((const __m128i*)scores), delimiter = _mm_cmplt_epi16(v, stop_score);
+			st = _mm_add_epi16(st, _mm_andnot_si128(delimiter, v));
+			count = _mm_add_epi16(count, _mm_andnot_si128(delimiter, one));
+			const __m128i improved = _mm_cmpgt_epi16(st, sc);
+			sc = _mm_max_epi16(sc, st);
+			best = _mm_or_si128(_mm_and_si128(improved, count), _mm_andnot_si128(improved, best));
+			const __m128i done = _mm_or_si128(_mm_or_si128(delimiter, _mm_cmpgt_epi16(_mm_sub_epi16(sc, st), xdrop)),
+				_mm_or_si128(_mm_cmpgt_epi16(count, window), _mm_cmpgt_epi16(sc, limit)));
+			int mask = _mm_movemask_epi8(done) & 0x5555;
+			if (mask == 0)
+				continue;
+
+			_mm_store_si128((__m128i*)st_a, st);
+			_mm_store_si128((__m128i*)score_a, sc);
+			_mm_store_si128((__m128i*)count_a, count);
+			_mm_store_si128((__m128i*)best_a, best);
+			const int delimiters = _mm_movemask_epi8(delimiter);
+			bool exhausted = false;
+			do {
+				const int l = ctz((uint64_t)mask) / 2;
+				mask &= mask - 1;
+				// The scalar code stops at the delimiter again, or continues an extension that was only interrupted by the limits.
+				const int back = (delimiters >> (2 * l)) & 1 ? dir[l] : 0;
+				if (dir[l] < 0) {
+					left(hit[l], q[l] - back, s[l] - back, score_a[l], st_a[l], count_a[l], best_a[l]);
+					start(l, hit[l], 1);
+				}
+				else {
+					right(hit[l], q[l] - back, s[l] - back, score_a[l], st_a[l], count_a[l], best_a[l]);
+					if (next < n) {
+						if (next + PREFETCH_DISTANCE < n)
+							prefetch(query[next + PREFETCH_DISTANCE], subject[next + PREFETCH_DISTANCE]);
+						start(l, next++, -1);
+					}
+					else {
+						hit[l] = SIZE_MAX;
+						exhausted = true;
+					}
+				}
+			} while (mask);
+
+			if (exhausted) {
+				for (int l = 0; l < LANES; ++l) {
+					if (hit[l] == SIZE_MAX)
+						continue;
+					if (dir[l] < 0) {
+						left(hit[l], q[l], s[l], score_a[l], st_a[l], count_a[l], best_a[l]);
+						right(hit[l], query[hit[l]] + right_offset, subject[hit[l]] + right_offset, 0, 0, 0, 0);
+					}
+					else
+						right(hit[l], q[l], s[l], score_a[l], st_a[l], count_a[l], best_a[l]);
+				}
+				return;
+			}
+
+			st = _mm_load_si128((const __m128i*)st_a);
+			sc = _mm_load_si128((const __m128i*)score_a);
+			count = _mm_load_si128((const __m128i*)count_a);
+			best = _mm_load_si128((const __m128i*)best_a);
+			window = _mm_load_si128((const __m128i*)window_a);
+		}
+	}
+#endif
+
+	for (size_t i = 0; i < n; ++i) {
+		if (i + 2 * PREFETCH_DISTANCE < n)
+			prefetch(query[i + 2 * PREFETCH_DISTANCE], subject[i + 2 * PREFETCH_DISTANCE]);
+		left(i, query[i] - 1, subject[i] - 1, 0, 0, 0, 0);
+		right(i, query[i] + right_offset, subject[i] + right_offset, 0, 0, 0, 0);
+	}
+}
+
+void xdrop_ungapped(const Letter *const *query, const Letter *const *subject, unsigned seed_len, size_t n, int *score, unsigned *delta, unsigned *len)
+{
+	assert(seed_len >= config.seed_anchor);
+	const unsigned window_left = std::max(config.window, (unsigned)config.seed_anchor) - config.seed_anchor,
+		window_right = std::max(config.window, seed_len - config.seed_anchor) - (seed_len - config.seed_anchor);
+	extend_hits<true>(query, subject, n, window_left, window_right, seed_len, score, delta, len);
+	for (size_t i = 0; i < n; ++i) {
+		for (unsigned j = 0; j < seed_len; ++j)
+			score[i] += score_matrix(query[i][j], subject[i][j]);
+		len[i] += delta[i] + seed_len;
+	}
+}
+
+void xdrop_ungapped(const Letter *const *query, const Letter *const *subject, size_t n, int *score, int *delta, int *len)
+{
+#ifdef __SSE2__
+	// These extensions mostly run along homologous diagonals and are long, so extending one hit at a time in blocks of 8
+	// positions is faster than the lanes of extend_hits.
+	for (size_t i = 0; i < std::min(n, PREFETCH_DISTANCE); ++i)
+		prefetch(query[i], subject[i]);
+	for (size_t i = 0; i < n; ++i) {
+		if (i + PREFETCH_DISTANCE < n)
+			prefetch(query[i + PREFETCH_DISTANCE], subject[i + PREFETCH_DISTANCE]);
+		int sc = 0, st = 0;
+		unsigned d, l, count;
+		extend_diagonal<-1>(query[i] - 1, subject[i] - 1, UINT_MAX, sc, st, count, d);
+		st = sc;
+		extend_diagonal<1>(query[i], subject[i], UINT_MAX, sc, st, count, l);
+		score[i] = sc;
+		delta[i] = (int)d;
+		len[i] = (int)(d + l);
+	}
+#else
+	extend_hits<false>(query, subject, n, UINT_MAX, UINT_MAX, 0, score, delta, len);
+	for (size_t i = 0; i < n; ++i)
+		len[i] += delta[i];
+#endif
+}
@@ -148,163 +148,138 @@ const char* Blast_tab_format::field_desc[] = {
 	"Query strand"						// 57
 };
 
-Blast_tab_format::Blast_tab_format() :
-	Output_format(blast_tab)
+namespace {
+
+enum { SSEQ = 1, BTOP = 2, QSEQ_GAPPED = 4, SSEQ_GAPPED = 8 };
+
+// Columns that are built by walking the transcript, computed in a single pass for all of them.
+struct Transcript_strings
 {
-	static const unsigned stdf[] = { 0, 5, 23, 22, 25, 27, 13, 14, 15, 16, 19, 20 };
-	const vector<string> &f = config.output_format;
-	if (f.size() <= 1) {
-		fields = vector<unsigned>(stdf, stdf + 12);
-		return;
-	}
-	for (vector<string>::const_iterator i = f.begin() + 1; i != f.end(); ++i) {
-		int j = get_idx(field_str, sizeof(field_str) / sizeof(field_str[0]), i->c_str());
-		if(j == -1)
-			throw std::runtime_error(string("Invalid output field: ") + *i);
-		if (j == 34)
-			needs_taxon_id_lists = true;
-		if (j == 35) {
-			needs_taxon_scientific_names = true;
-			needs_taxon_id_lists = true;
+	void parse(const Hsp_context &r, unsigned fields)
+	{
+		sseq.clear();
+		btop.clear();
+		qseq_gapped.clear();
+		sseq_gapped.clear();
+		unsigned n_matches = 0;
+		for (Hsp_context::Iterator i = r.begin(); i.good(); ++i) {
+			const Edit_operation op = i.op();
+			if ((fields & SSEQ) && op != op_insertion)
+				sseq.push_back(i.subject());
+			if (fields & QSEQ_GAPPED)
+				qseq_gapped << i.query_char();
+			if (fields & SSEQ_GAPPED)
+				sseq_gapped << i.subject_char();
+			if (!(fields & BTOP))
+				continue;
+			if (op == op_match) {
+				++n_matches;
+				continue;
+			}
+			if (n_matches > 0) {
+				btop << n_matches;
+				n_matches = 0;
+			}
+			switch (op) {
+			case op_substitution:
+			case op_frameshift_forward:
+			case op_frameshift_reverse:
+				btop << i.query_char() << i.subject_char();
+				break;
+			case op_insertion:
+				btop << i.query_char() << '-';
+				break;
+			case op_deletion:
+				btop << '-' << i.subject_char();
+				break;
+			default:
+				;
+			}
 		}
-		fields.push_back(j);
-		if (j == 6 || j == 39 || j == 40 || j == 34)
-			config.salltitles = true;
-		if (j == 48)
-			config.use_lazy_dict = true;
-		if (j == 49 || j == 53)
-			config.store_query_quality = true;
+		if (n_matches > 0)
+			btop << n_matches;
 	}
+	vector<Letter> sseq;
+	TextBuffer btop, qseq_gapped, sseq_gapped;
+};
+
+void write_buffer(TextBuffer &out, const TextBuffer &buf)
+{
+	out.write_raw(buf.get_begin(), buf.size());
 }
 
+}
+
+struct Blast_tab_format::Row
+{
+	const Hsp_context &r;
+	const Metadata &metadata;
+	const Transcript_strings &transcript;
+};
+
 void print_staxids(TextBuffer &out, unsigned subject_global_id, const Metadata &metadata)
 {
 	out.print((*metadata.taxon_list)[subject_global_id], ';');
 }
 
-void Blast_tab_format::print_match(const Hsp_context& r, const Metadata &metadata, TextBuffer &out)
+static Blast_tab_format::Column_writer column_writer(unsigned field)
 {
-	for (vector<unsigned>::const_iterator i = fields.begin(); i != fields.end(); ++i) {
-		switch (*i) {
-		case 0:
-			out.write_until(r.query_name, Const::id_delimiters);
-			break;
-		case 4:
-			out << r.query.source().length();
-			break;
-		case 5:
-			print_title(out, r.subject_name, false, false, "<>");
-			break;
-		case 6:
-			print_title(out, r.subject_name, false, true, "<>");
-			break;
-		case 12:
-			out << r.subject_len;
-			break;
-		case 13:
-			out << r.oriented_query_range().begin_ + 1;
-			break;
-		case 14:
-			out << r.oriented_query_range().end_ + 1;
-			break;
-		case 15:
-			out << r.subject_range().begin_ + 1;
-			break;
-		case 16:
-			out << r.subject_range().end_;
-			break;
-		case 17:
-			r.query.source().print(out, r.query_source_range().begin_, r.query_source_range().end_, input_value_traits);
-			break;
-		case 18:
-		{
-			vector<Letter> seq;
-			seq.reserve(r.subject_range().length());
-			for (Hsp_context::Iterator j = r.begin(); j.good(); ++j)
-				if (!(j.op() == op_insertion))
-					seq.push_back(j.subject());
-			out << sequence(seq);
-			break;
-		}
-		case 19:
-			out.print_e(r.evalue());
-			break;
-		case 20:
-			out << r.bit_score();
-			break;
-		case 21:
-			out << r.score();
-			break;
-		case 22:
-			out << r.length();
-			break;
-		case 23:
-			out << (double)r.identities() * 100 / r.length();
-			break;
-		case 24:
-			out << r.identities();
-			break;
-		case 25:
-			out << r.mismatches();
-			break;
-		case 26:
-			out << r.positives();
-			break;
-		case 27:
-			out << r.gap_openings();
-			break;
-		case 28:
-			out << r.gaps();
-			break;
-		case 29:
-			out << (double)r.positives() * 100.0 / r.length();
-			break;
-		case 31:
-			out << r.blast_query_frame();
-			break;
-		case 33:
-		{
-			unsigned n_matches = 0;
-			for (Hsp_context::Iterator i = r.begin(); i.good(); ++i) {
-				switch (i.op()) {
-				case op_match:
-					++n_matches;
-					break;
-				case op_substitution:
-				case op_frameshift_forward:
-				case op_frameshift_reverse:
-					if (n_matches > 0) {
-						out << n_matches;
-						n_matches = 0;
-					}
-					out << i.query_char() << i.subject_char();
-					break;
-				case op_insertion:
-					if (n_matches > 0) {
-						out << n_matches;
-						n_matches = 0;
-					}
-					out << i.query_char() << '-';
-					break;
-				case op_deletion:
-					if (n_matches > 0) {
-						out << n_matches;
-						n_matches = 0;
-					}
-					out << '-' << i.subject_char();
-					break;
-				}
-			}
-			if (n_matches > 0)
-				out << n_matches;
-		}
-			break;
-		case 34:
-			print_staxids(out, r.orig_subject_id, metadata);
-			break;
-		case 35: {
-			const vector<string> &names = *metadata.taxonomy_scientific_names;
-			const vector<unsigned> tax_id = (*metadata.taxon_list)[r.orig_subject_id];
+	typedef Blast_tab_format::Row Row;
+	switch (field) {
+	case 0:
+		return [](const Row &row, TextBuffer &out) { out.write_until(row.r.query_name, Const::id_delimiters); };
+	case 4:
+		return [](const Row &row, TextBuffer &out) { out << row.r.query.source().length(); };
+	case 5:
+		return [](const Row &row, TextBuffer &out) { Output_format::print_title(out, row.r.subject_name, false, false, "<>"); };
+	case 6:
+		return [](const Row &row, TextBuffer &out) { Output_format::print_title(out, row.r.subject_name, false, true, "<>"); };
+	case 12:
+		return [](const Row &row, TextBuffer &out) { out << row.r.subject_len; };
+	case 13:
+		return [](const Row &row, TextBuffer &out) { out << row.r.oriented_query_range().begin_ + 1; };
+	case 14:
+		return [](const Row &row, TextBuffer &out) { out << row.r.oriented_query_range().end_ + 1; };
+	case 15:
+		return [](const Row &row, TextBuffer &out) { out << row.r.subject_range().begin_ + 1; };
+	case 16:
+		return [](const Row &row, TextBuffer &out) { out << row.r.subject_range().end_; };
+	case 17:
+		return [](const Row &row, TextBuffer &out) { row.r.query.source().print(out, row.r.query_source_range().begin_, row.r.query_source_range().end_, input_value_traits); };
+	case 18:
+		return [](const Row &row, TextBuffer &out) { out << sequence(row.transcript.sseq); };
+	case 19:
+		return [](const Row &row, TextBuffer &out) { out.print_e(row.r.evalue()); };
+	case 20:
+		return [](const Row &row, TextBuffer &out) { out << row.r.bit_score(); };
+	case 21:
+		return [](const Row &row, TextBuffer &out) { out << row.r.score(); };
+	case 22:
+		return [](const Row &row, TextBuffer &out) { out << row.r.length(); };
+	case 23:
+		return [](const Row &row, TextBuffer &out) { out << (double)row.r.identities() * 100 / row.r.length(); };
+	case 24:
+		return [](const Row &row, TextBuffer &out) { out << row.r.identities(); };
+	case 25:
+		return [](const Row &row, TextBuffer &out) { out << row.r.mismatches(); };
+	case 26:
+		return [](const Row &row, TextBuffer &out) { out << row.r.positives(); };
+	case 27:
+		return [](const Row &row, TextBuffer &out) { out << row.r.gap_openings(); };
+	case 28:
+		return [](const Row &row, TextBuffer &out) { out << row.r.gaps(); };
+	case 29:
+		return [](const Row &row, TextBuffer &out) { out << (double)row.r.positives() * 100.0 / row.r.length(); };
+	case 31:
+		return [](const Row &row, TextBuffer &out) { out << row.r.blast_query_frame(); };
+	case 33:
+		return [](const Row &row, TextBuffer &out) { write_buffer(out, row.transcript.btop); };
+	case 34:
+		return [](const Row &row, TextBuffer &out) { print_staxids(out, row.r.orig_subject_id, row.metadata); };
+	case 35:
+		return [](const Row &row, TextBuffer &out) {
+			const vector<string> &names = *row.metadata.taxonomy_scientific_names;
+			const vector<unsigned> &tax_id = (*row.metadata.taxon_list)[row.r.orig_subject_id];
 			for (size_t i = 0; i < tax_id.size(); ++i) {
 				if (i > 0)
 					out << ';';
@@ -313,65 +288,105 @@ void Blast_tab_format::print_match(const Hsp_context& r, const Metadata &metadat
 				else
 					out << tax_id[i];
 			}
-			break;
+		};
+	case 39:
+		return [](const Row &row, TextBuffer &out) { Output_format::print_title(out, row.r.subject_name, true, false, "<>"); };
+	case 40:
+		return [](const Row &row, TextBuffer &out) { Output_format::print_title(out, row.r.subject_name, true, true, "<>"); };
+	case 43:
+		return [](const Row &row, TextBuffer &out) { out << (double)row.r.query_source_range().length()*100.0 / row.r.query.source().length(); };
+	case 45:
+		return [](const Row &row, TextBuffer &out) { out << row.r.query_name; };
+	case 46:
+		return [](const Row &row, TextBuffer &out) { out << row.r.sw_score() - row.r.bit_score(); };
+	case 47:
+		return [](const Row &row, TextBuffer &out) { out << row.r.time(); };
+	case 48:
+		return [](const Row &row, TextBuffer &out) { out << row.r.subject_seq; };
+	case 49:
+		return [](const Row &row, TextBuffer &out) { out << (query_qual && (*query_qual)[row.r.query_id].present() ? (*query_qual)[row.r.query_id].substr(row.r.query_source_range().begin_, row.r.query_source_range().end_).c_str() : "*"); };
+	case 50:
+		return [](const Row &row, TextBuffer &out) { out << query_block_to_database_id[row.r.query_id]; };
+	case 51:
+		return [](const Row &row, TextBuffer &out) { out << row.r.orig_subject_id; };
+	case 52:
+		return [](const Row &row, TextBuffer &out) { out << (double)row.r.subject_range().length() * 100.0 / row.r.subject_len; };
+	case 53:
+		return [](const Row &row, TextBuffer &out) { out << (query_qual && (*query_qual)[row.r.query_id].present() ? (*query_qual)[row.r.query_id].c_str() : "*"); };
+	case 54:
+		return [](const Row &row, TextBuffer &out) { row.r.query.source().print(out, input_value_traits); };
+	case 55:
+		return [](const Row &row, TextBuffer &out) { write_buffer(out, row.transcript.qseq_gapped); };
+	case 56:
+		return [](const Row &row, TextBuffer &out) { write_buffer(out, row.transcript.sseq_gapped); };
+	case 57:
+		return [](const Row &row, TextBuffer &out) {
+			if (align_mode.query_translated)
+				out << ((row.r.blast_query_frame() > 0) ? '+' : '-');
+			else
+				out << '+';
+		};
+	default:
+		throw std::runtime_error(string("Invalid output field: ") + Blast_tab_format::field_str[field]);
+	}
+}
+
+const unsigned Blast_tab_format::field_count = sizeof(Blast_tab_format::field_str) / sizeof(Blast_tab_format::field_str[0]);
+
+Blast_tab_format::Blast_tab_format() :
+	Output_format(blast_tab),
+	transcript_strings_(0)
+{
+	static const unsigned stdf[] = { 0, 5, 23, 22, 25, 27, 13, 14, 15, 16, 19, 20 };
+	const vector<string> &f = config.output_format;
+	if (f.size() <= 1)
+		fields = vector<unsigned>(stdf, stdf + 12);
+	else
+		for (vector<string>::const_iterator i = f.begin() + 1; i != f.end(); ++i) {
+			int j = get_idx(field_str, field_count, i->c_str());
+			if(j == -1)
+				throw std::runtime_error(string("Invalid output field: ") + *i);
+			if (j == 34)
+				needs_taxon_id_lists = true;
+			if (j == 35) {
+				needs_taxon_scientific_names = true;
+				needs_taxon_id_lists = true;
+			}
+			fields.push_back(j);
+			if (j == 6 || j == 39 || j == 40 || j == 34)
+				config.salltitles = true;
+			if (j == 48)
+				config.use_lazy_dict = true;
+			if (j == 49 || j == 53)
+				config.store_query_quality = true;
 		}
-		case 39:
-			print_title(out, r.subject_name, true, false, "<>");
-			break;
-		case 40:
-			print_title(out, r.subject_name, true, true, "<>");
-			break;
-		case 43:
-			out << (double)r.query_source_range().length()*100.0 / r.query.source().length();
-			break;
-		case 45:
-			out << r.query_name;
-			break;
-		case 46:
-			out << r.sw_score() - r.bit_score();
-			break;
-		case 47:
-			out << r.time();
-			break;
-		case 48:
-			out << r.subject_seq;
-			break;
-		case 49:
-			out << (query_qual && (*query_qual)[r.query_id].present() ? (*query_qual)[r.query_id].substr(r.query_source_range().begin_, r.query_source_range().end_).c_str() : "*");
-			break;
-		case 50:
-			out << query_block_to_database_id[r.query_id];
-			break;
-		case 51:
-			out << r.orig_subject_id;
-			break;
-		case 52:
-			out << (double)r.subject_range().length() * 100.0 / r.subject_len;
-			break;
-		case 53:
-			out << (query_qual && (*query_qual)[r.query_id].present() ? (*query_qual)[r.query_id].c_str() : "*");
+	for (vector<unsigned>::const_iterator i = fields.begin(); i != fields.end(); ++i) {
+		columns_.push_back(column_writer(*i));
+		switch (*i) {
+		case 18:
+			transcript_strings_ |= SSEQ;
 			break;
-		case 54:
-			r.query.source().print(out, input_value_traits);
+		case 33:
+			transcript_strings_ |= BTOP;
 			break;
 		case 55:
-			for (Hsp_context::Iterator i = r.begin(); i.good(); ++i)
-				out << i.query_char();
+			transcript_strings_ |= QSEQ_GAPPED;
 			break;
 		case 56:
-			for (Hsp_context::Iterator i = r.begin(); i.good(); ++i)
-				out << i.subject_char();
-			break;
-		case 57:
-			if (align_mode.query_translated)
-				out << ((r.blast_query_frame() > 0) ? '+' : '-');
-			else
-				out << '+';
-			break;
-		default:
-			throw std::runtime_error(string("Invalid output field: ") + field_str[*i]);
+			transcript_strings_ |= SSEQ_GAPPED;
 		}
-		if (i < fields.end() - 1)
+	}
+}
+
+void Blast_tab_format::print_match(const Hsp_context& r, const Metadata &metadata, TextBuffer &out)
+{
+	static thread_local Transcript_strings transcript;
+	if (transcript_strings_)
+		transcript.parse(r, transcript_strings_);
+	const Row row = { r, metadata, transcript };
+	for (vector<Column_writer>::const_iterator i = columns_.begin(); i != columns_.end(); ++i) {
+		(*i)(row, out);
+		if (i < columns_.end() - 1)
 			out << '\t';
 	}
 	out << '\n';
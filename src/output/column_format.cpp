@@ -0,0 +1,351 @@
+/****
+DIAMOND protein aligner
+Copyright (C) 2013-2019 Benjamin Buchfink <buchfink@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+****/
+
+#include <string.h>
+#include <algorithm>
+#include <limits>
+#include "output_format.h"
+#include "../util/io/input_file.h"
+#include "../util/io/output_file.h"
+#include "../util/log_stream.h"
+
+using namespace std;
+
+// File layout (native byte order):
+// header   uint64 magic, uint32 version, uint32 column count, per column: uint8 type, name (zero-terminated)
+// chunk    uint32 rows (> 0), query id (zero-terminated), uint32 query length, then the columns in header order:
+//          integer columns as uint8 width (1, 2 or 4 bytes, the least that holds all values of the chunk) followed by rows values,
+//          double columns as arrays of rows values, string columns as uint32 lengths[rows] followed by the characters,
+//          query columns (qseqid) take no space, their value is the query id of the chunk
+// end      uint32 0
+
+const uint64_t Column_format::MAGIC = 0x4c4f43444e4d44ULL; // "DMNDCOL"
+const uint32_t Column_format::VERSION = 1;
+
+namespace {
+
+const char* type_str[] = { "uint32", "int32", "double", "string", "query" };
+
+int field_type(unsigned field)
+{
+	switch (field) {
+	case 0:
+		return Column_format::QUERY;
+	case 4:
+	case 12:
+	case 21:
+	case 22:
+	case 24:
+	case 25:
+	case 26:
+	case 27:
+	case 28:
+	case 51:
+		return Column_format::UINT32;
+	case 13:
+	case 14:
+	case 15:
+	case 16:
+	case 31:
+		return Column_format::INT32;
+	case 19:
+	case 20:
+	case 23:
+	case 29:
+	case 43:
+	case 52:
+		return Column_format::DOUBLE;
+	case 5:
+	case 6:
+	case 39:
+	case 40:
+		return Column_format::STRING;
+	default:
+		return -1;
+	}
+}
+
+template<typename _t, typename _narrow8, typename _narrow16>
+void write_packed(TextBuffer &out, const vector<char> &v)
+{
+	const _t *p = (const _t*)v.data(), *end = p + v.size() / sizeof(_t);
+	const std::pair<const _t*, const _t*> r = std::minmax_element(p, end);
+	if (*r.first >= std::numeric_limits<_narrow8>::min() && *r.second <= std::numeric_limits<_narrow8>::max()) {
+		out.write((uint8_t)1);
+		for (; p < end; ++p)
+			out.write((_narrow8)*p);
+	}
+	else if (*r.first >= std::numeric_limits<_narrow16>::min() && *r.second <= std::numeric_limits<_narrow16>::max()) {
+		out.write((uint8_t)2);
+		for (; p < end; ++p)
+			out.write((_narrow16)*p);
+	}
+	else {
+		out.write((uint8_t)4);
+		out.write_raw(v.data(), v.size());
+	}
+}
+
+template<typename _t, typename _narrow8, typename _narrow16>
+void read_packed(InputFile &in, uint32_t rows, vector<char> &v)
+{
+	uint8_t width;
+	in.read(width);
+	v.resize(rows * sizeof(_t));
+	_t *p = (_t*)v.data();
+	if (width == 1) {
+		vector<_narrow8> buf(rows);
+		if (in.read(buf.data(), rows) != rows)
+			throw EndOfStream();
+		std::copy(buf.begin(), buf.end(), p);
+	}
+	else if (width == 2) {
+		vector<_narrow16> buf(rows);
+		if (in.read(buf.data(), rows) != rows)
+			throw EndOfStream();
+		std::copy(buf.begin(), buf.end(), p);
+	}
+	else if (width == 4) {
+		if (in.read(p, rows) != rows)
+			throw EndOfStream();
+	}
+	else
+		throw std::runtime_error("Invalid column width in column file.");
+}
+
+template<typename _t>
+void push(vector<char> &v, _t x)
+{
+	const size_t n = v.size();
+	v.resize(n + sizeof(_t));
+	memcpy(&v[n], &x, sizeof(_t));
+}
+
+}
+
+Column_format::Column_format() :
+	Output_format(column),
+	query_len_(0),
+	rows_(0)
+{
+	static const unsigned stdf[] = { 0, 5, 23, 22, 25, 27, 13, 14, 15, 16, 19, 20 };
+	const vector<string> &f = config.output_format;
+	if (f.size() <= 1)
+		fields = vector<unsigned>(stdf, stdf + 12);
+	else for (vector<string>::const_iterator i = f.begin() + 1; i < f.end(); ++i) {
+		const int j = get_idx(Blast_tab_format::field_str, Blast_tab_format::field_count, i->c_str());
+		if (j == -1)
+			throw std::runtime_error(string("Invalid output field: ") + *i);
+		if (field_type(j) == -1)
+			throw std::runtime_error(string("Output field not supported by the binary column format: ") + *i);
+		fields.push_back(j);
+		if (j == 6 || j == 39 || j == 40)
+			config.salltitles = true;
+	}
+	columns_.resize(fields.size());
+	strings_.resize(fields.size());
+}
+
+void Column_format::print_header(Consumer &f, int mode, const char *matrix, int gap_open, int gap_extend, double evalue, const char *first_query_name, unsigned first_query_len) const
+{
+	TextBuffer out;
+	out.write(MAGIC).write(VERSION).write((uint32_t)fields.size());
+	for (vector<unsigned>::const_iterator i = fields.begin(); i < fields.end(); ++i) {
+		out.write((uint8_t)field_type(*i));
+		out.write_c_str(Blast_tab_format::field_str[*i]);
+	}
+	f.consume(out.get_begin(), out.size());
+}
+
+void Column_format::print_query_intro(size_t query_num, const char *query_name, unsigned query_len, TextBuffer &out, bool unaligned) const
+{
+	if (unaligned)
+		return;
+	query_name_.assign(query_name, find_first_of(query_name, Const::id_delimiters));
+	query_len_ = query_len;
+}
+
+void Column_format::print_match(const Hsp_context& r, const Metadata &metadata, TextBuffer &out)
+{
+	static thread_local TextBuffer title;
+	for (size_t i = 0; i < fields.size(); ++i) {
+		vector<char> &c = columns_[i];
+		switch (fields[i]) {
+		case 0: break;
+		case 4: push(c, (uint32_t)r.query.source().length()); break;
+		case 12: push(c, (uint32_t)r.subject_len); break;
+		case 13: push(c, (int32_t)r.oriented_query_range().begin_ + 1); break;
+		case 14: push(c, (int32_t)r.oriented_query_range().end_ + 1); break;
+		case 15: push(c, (int32_t)r.subject_range().begin_ + 1); break;
+		case 16: push(c, (int32_t)r.subject_range().end_); break;
+		case 19: push(c, r.evalue()); break;
+		case 20: push(c, r.bit_score()); break;
+		case 21: push(c, (uint32_t)r.score()); break;
+		case 22: push(c, (uint32_t)r.length()); break;
+		case 23: push(c, (double)r.identities() * 100 / r.length()); break;
+		case 24: push(c, (uint32_t)r.identities()); break;
+		case 25: push(c, (uint32_t)r.mismatches()); break;
+		case 26: push(c, (uint32_t)r.positives()); break;
+		case 27: push(c, (uint32_t)r.gap_openings()); break;
+		case 28: push(c, (uint32_t)r.gaps()); break;
+		case 29: push(c, (double)r.positives() * 100.0 / r.length()); break;
+		case 31: push(c, (int32_t)r.blast_query_frame()); break;
+		case 43: push(c, (double)r.query_source_range().length()*100.0 / r.query.source().length()); break;
+		case 51: push(c, (uint32_t)r.orig_subject_id); break;
+		case 52: push(c, (double)r.subject_range().length() * 100.0 / r.subject_len); break;
+		default:
+			title.clear();
+			print_title(title, r.subject_name, fields[i] >= 39, fields[i] == 6 || fields[i] == 40, "<>");
+			push(c, (uint32_t)title.size());
+			strings_[i].insert(strings_[i].end(), title.get_begin(), title.get_begin() + title.size());
+		}
+	}
+	++rows_;
+}
+
+void Column_format::print_query_epilog(TextBuffer &out, const char *query_title, bool unaligned, const Parameters &parameters) const
+{
+	if (unaligned || rows_ == 0)
+		return;
+	out.write(rows_);
+	out.write_c_str(query_name_.c_str(), query_name_.length());
+	out.write(query_len_);
+	for (size_t i = 0; i < fields.size(); ++i) {
+		switch (field_type(fields[i])) {
+		case UINT32:
+			write_packed<uint32_t, uint8_t, uint16_t>(out, columns_[i]);
+			break;
+		case INT32:
+			write_packed<int32_t, int8_t, int16_t>(out, columns_[i]);
+			break;
+		case QUERY:
+			break;
+		default:
+			out.write_raw(columns_[i].data(), columns_[i].size());
+			out.write_raw(strings_[i].data(), strings_[i].size());
+		}
+		columns_[i].clear();
+		strings_[i].clear();
+	}
+	rows_ = 0;
+}
+
+void Column_format::print_footer(Consumer &f) const
+{
+	const uint32_t end = 0;
+	f.consume((const char*)&end, sizeof(end));
+}
+
+bool Column_format::is_column_file(const string &file_name)
+{
+	InputFile f(file_name);
+	uint64_t magic = 0;
+	const bool r = f.read(&magic, 1) == 1 && magic == MAGIC;
+	f.close();
+	return r;
+}
+
+void Column_format::view(const string &file_name)
+{
+	InputFile in(file_name);
+	uint64_t magic;
+	uint32_t version, n;
+	in.read(magic);
+	in.read(version);
+	if (version > VERSION)
+		throw std::runtime_error("Column file was written by a newer version of DIAMOND.");
+	in.read(n);
+	vector<int> type(n);
+	vector<string> name(n);
+	for (uint32_t i = 0; i < n; ++i) {
+		uint8_t t;
+		in.read(t);
+		in >> name[i];
+		if (t > QUERY)
+			throw std::runtime_error("Invalid column type in file " + file_name);
+		type[i] = t;
+		verbose_stream << "Column " << name[i] << ": " << type_str[t] << endl;
+	}
+
+	OutputFile out_file(config.output_file, config.compression == 1);
+	TextBuffer out;
+	string query;
+	vector<vector<char>> data(n);
+	vector<vector<uint32_t>> string_begin(n);
+	uint32_t rows, query_len;
+	while (in.read(rows), rows > 0) {
+		in >> query;
+		in.read(query_len);
+		for (uint32_t i = 0; i < n; ++i) {
+			if (type[i] == QUERY)
+				continue;
+			if (type[i] == UINT32) {
+				read_packed<uint32_t, uint8_t, uint16_t>(in, rows, data[i]);
+				continue;
+			}
+			if (type[i] == INT32) {
+				read_packed<int32_t, int8_t, int16_t>(in, rows, data[i]);
+				continue;
+			}
+			data[i].resize(rows * (type[i] == DOUBLE ? sizeof(double) : sizeof(uint32_t)));
+			if (in.read(data[i].data(), data[i].size()) != data[i].size())
+				throw EndOfStream();
+			if (type[i] != STRING)
+				continue;
+			const uint32_t *len = (const uint32_t*)data[i].data();
+			string_begin[i].resize(rows + 1);
+			string_begin[i][0] = 0;
+			for (uint32_t j = 0; j < rows; ++j)
+				string_begin[i][j + 1] = string_begin[i][j] + len[j];
+			data[i].resize(data[i].size() + string_begin[i][rows]);
+			if (in.read(data[i].data() + rows * sizeof(uint32_t), string_begin[i][rows]) != string_begin[i][rows])
+				throw EndOfStream();
+		}
+		for (uint32_t j = 0; j < rows; ++j) {
+			for (uint32_t i = 0; i < n; ++i) {
+				if (i > 0)
+					out << '\t';
+				const char *p = data[i].data();
+				switch (type[i]) {
+				case QUERY:
+					out << query;
+					break;
+				case UINT32:
+					out << ((const uint32_t*)p)[j];
+					break;
+				case INT32:
+					out << ((const int32_t*)p)[j];
+					break;
+				case DOUBLE:
+					if (name[i] == "evalue")
+						out.print_e(((const double*)p)[j]);
+					else
+						out << ((const double*)p)[j];
+					break;
+				default:
+					out.write_raw(p + rows * sizeof(uint32_t) + string_begin[i][j], string_begin[i][j + 1] - string_begin[i][j]);
+				}
+			}
+			out << '\n';
+		}
+		out_file.consume(out.get_begin(), out.size());
+		out.clear();
+	}
+	in.close();
+	out_file.finalize();
+}
@@ -21,6 +21,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <string>
 #include <exception>
+#include <string.h>
+#include <zlib.h>
 #include "../util/ptr_vector.h"
 #include "../basic/config.h"
 #include "../basic/const.h"
@@ -33,10 +35,10 @@ using std::string;
 
 struct DAA_header1
 {
-	enum { VERSION = 1, COMPATIBILITY_VERSION = 0 };
-	DAA_header1():
+	enum { VERSION = 2, COMPATIBILITY_VERSION = 0, UNCOMPRESSED_VERSION = 1, BLOCK_COMPRESSED_VERSION = 2 };
+	DAA_header1(uint64_t version = UNCOMPRESSED_VERSION):
 		magic_number (0x3c0e53476d3ee36bllu),
-		version (VERSION)
+		version (version)
 	{ }
 	uint64_t magic_number, version;
 };
@@ -89,7 +91,7 @@ struct DAA_header2
 		memset(block_size, 0, sizeof(block_size));
 		strcpy(this->score_matrix, score_matrix.c_str());
 	}
-	typedef enum { empty = 0, alignments = 1, ref_names = 2, ref_lengths = 3 } Block_type;
+	typedef enum { empty = 0, alignments = 1, ref_names = 2, ref_lengths = 3, query_index = 4, block_index = 5 } Block_type;
 	uint64_t diamond_build, db_seqs, db_seqs_used, db_letters, flags, query_records;
 	int32_t mode, gap_open, gap_extend, reward, penalty, reserved1, reserved2, reserved3;
 	double k, lambda, evalue, reserved5;
@@ -98,12 +100,22 @@ struct DAA_header2
 	char block_type[256];
 };
 
+// In block compressed files (version 2) the alignments block is a sequence of deflate compressed blocks of whole query
+// records, each preceded by its compressed and uncompressed size. The block index lists the offset and first query of each block.
+struct DAA_block
+{
+	uint64_t offset, first_query;
+};
+
 struct DAA_file
 {
 
+	enum { QUERY_INDEX_BLOCK = 256 };
+
 	DAA_file(const string& file_name):
 		f_ (file_name),
-		query_count_ (0)
+		query_count_ (0),
+		block_pos_ (0)
 	{
 		f_.read(&h1_, 1);
 		if(h1_.magic_number != DAA_header1().magic_number)
@@ -128,6 +140,16 @@ struct DAA_file
 		}
 		ref_len_.resize((size_t)h2_.db_seqs_used);
 		f_.read(ref_len_.data(), (size_t)h2_.db_seqs_used);
+		if (h2_.block_type[3] == DAA_header2::query_index) {
+			query_offset_.resize((size_t)h2_.block_size[3] / sizeof(uint64_t));
+			f_.read(query_offset_.data(), query_offset_.size());
+		}
+		else if (h2_.block_type[3] == DAA_header2::block_index) {
+			blocks_.resize((size_t)h2_.block_size[3] / sizeof(DAA_block));
+			f_.read(blocks_.data(), blocks_.size());
+		}
+		if (block_compressed() && h2_.block_type[3] != DAA_header2::block_index)
+			throw std::runtime_error("Invalid DAA file. Block index is missing.");
 
 		f_.seek(sizeof(DAA_header1) + sizeof(DAA_header2));
 	}
@@ -199,15 +221,109 @@ struct DAA_file
 		return ref_len_;
 	}
 
-	bool read_query_buffer(BinaryBuffer &buf, size_t &query_num)
+	bool block_compressed() const
 	{
-		uint32_t size;
-		f_.read(&size, 1);
-		if(size == 0)
+		return h1_.version == DAA_header1::BLOCK_COMPRESSED_VERSION;
+	}
+
+	// Standard input is not checked, so that it can still be read as another format.
+	static bool is_daa(const string &file_name)
+	{
+		if (file_name.empty() || file_name == "-")
+			return false;
+		InputFile f(file_name);
+		uint64_t magic = 0;
+		const bool r = f.read(&magic, 1) == 1 && magic == DAA_header1().magic_number;
+		f.close();
+		return r;
+	}
+
+	bool has_query_index() const
+	{
+		return h2_.block_type[3] == DAA_header2::query_index || h2_.block_type[3] == DAA_header2::block_index;
+	}
+
+	// Units of random access: compressed blocks, or groups of QUERY_INDEX_BLOCK queries for uncompressed files.
+	size_t block_count() const
+	{
+		return block_compressed() ? blocks_.size() : (query_offset_.size() + QUERY_INDEX_BLOCK - 1) / QUERY_INDEX_BLOCK;
+	}
+
+	size_t block_first_query(size_t block) const
+	{
+		return block_compressed() ? (size_t)blocks_[block].first_query : block * QUERY_INDEX_BLOCK;
+	}
+
+	// Reads the query records of a block into buf, requires the index block. Safe to call concurrently on different files.
+	void read_block(InputFile &f, size_t block, vector<char> &buf) const
+	{
+		if (block_compressed()) {
+			f.seek(alignments_offset() + (size_t)blocks_[block].offset);
+			if (!read_compressed_block(f, buf))
+				throw std::runtime_error("Invalid DAA file. Block index does not match the alignments.");
+			return;
+		}
+		const size_t begin = query_offset(block_first_query(block)),
+			end = block + 1 < block_count() ? query_offset(block_first_query(block + 1)) : alignments_offset() + (size_t)h2_.block_size[0] - sizeof(uint32_t);
+		f.seek(begin);
+		buf.resize(end - begin);
+		f.read(buf.data(), buf.size());
+	}
+
+	static bool next_query_record(const vector<char> &block, size_t &pos, BinaryBuffer &buf)
+	{
+		if (pos >= block.size())
 			return false;
+		uint32_t size;
+		memcpy(&size, &block[pos], sizeof(uint32_t));
+		pos += sizeof(uint32_t);
 		buf.clear();
-		buf.resize(size);
-		f_.read(buf.data(), size);
+		buf.insert(buf.end(), block.begin() + pos, block.begin() + pos + size);
+		pos += size;
+		return true;
+	}
+
+	// Positions the file so that the next call to read_query_buffer returns the given query.
+	void seek_query(size_t query_num)
+	{
+		if (!has_query_index() || query_num >= h2_.query_records)
+			throw std::runtime_error("Query number out of range or DAA file has no query index.");
+		if (block_compressed()) {
+			size_t b = 0;
+			while (b + 1 < blocks_.size() && blocks_[b + 1].first_query <= query_num)
+				++b;
+			f_.seek(alignments_offset() + (size_t)blocks_[b].offset);
+			read_compressed_block(f_, block_);
+			block_pos_ = 0;
+			BinaryBuffer buf;
+			for (query_count_ = (size_t)blocks_[b].first_query; query_count_ < query_num; ++query_count_)
+				next_query_record(block_, block_pos_, buf);
+		}
+		else {
+			f_.seek(query_offset(query_num));
+			query_count_ = query_num;
+		}
+	}
+
+	bool read_query_buffer(BinaryBuffer &buf, size_t &query_num)
+	{
+		if (block_compressed()) {
+			while (block_pos_ >= block_.size()) {
+				if (!read_compressed_block(f_, block_))
+					return false;
+				block_pos_ = 0;
+			}
+			next_query_record(block_, block_pos_, buf);
+		}
+		else {
+			uint32_t size;
+			f_.read(&size, 1);
+			if (size == 0)
+				return false;
+			buf.clear();
+			buf.resize(size);
+			f_.read(buf.data(), size);
+		}
 		query_num = query_count_++;
 		return true;
 	}
@@ -220,6 +336,36 @@ private:
 	DAA_header2 h2_;
 	PtrVector<string> ref_name_;
 	vector<uint32_t> ref_len_;
+	vector<uint64_t> query_offset_;
+	vector<DAA_block> blocks_;
+	vector<char> block_;
+	size_t block_pos_;
+
+	static size_t alignments_offset()
+	{
+		return sizeof(DAA_header1) + sizeof(DAA_header2);
+	}
+
+	size_t query_offset(size_t query_num) const
+	{
+		return alignments_offset() + (size_t)query_offset_[query_num];
+	}
+
+	static bool read_compressed_block(InputFile &f, vector<char> &buf)
+	{
+		uint32_t size, raw_size;
+		f.read(&size, 1);
+		if (size == 0)
+			return false;
+		f.read(&raw_size, 1);
+		vector<char> in(size);
+		f.read(in.data(), size);
+		buf.resize(raw_size);
+		uLongf len = raw_size;
+		if (uncompress((Bytef*)buf.data(), &len, (const Bytef*)in.data(), size) != Z_OK || len != raw_size)
+			throw std::runtime_error("Error decompressing DAA block.");
+		return true;
+	}
 
 };
 
@@ -20,6 +20,14 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define DAA_WRITE_H_
 
 #include <limits>
+#include <algorithm>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <string.h>
+#include <zlib.h>
 #include <stdint.h>
 #include "output.h"
 #include "daa_file.h"
@@ -30,14 +38,6 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "../data/ref_dictionary.h"
 #include "../util/io/consumer.h"
 
-inline void init_daa(OutputFile &f)
-{
-	DAA_header1 h1;
-	f.write(&h1, 1);	
-	DAA_header2 h2_;
-	f.write(&h2_, 1);
-}
-
 inline size_t write_daa_query_record(TextBuffer &buf, const char *query_name, const sequence &query)
 {
 	size_t seek_pos = buf.size();
@@ -76,78 +76,298 @@ inline void write_daa_record(TextBuffer &buf, const Hsp &match, size_t subject_i
 	buf << match.transcript.data();
 }
 
-inline void finish_daa(OutputFile &f, const DatabaseFile &db)
+// Writes a DAA file. The alignments block is passed through consume() while the offset of each query record is
+// recorded for the query index block. With block compression, records are collected into blocks of about
+// DAA_BLOCK_SIZE bytes which are deflated independently. The blocks are deflated by the writer's own threads and
+// written in order by the thread that finishes the first pending block, so that consume() only copies the records.
+struct DAA_writer : public Consumer
 {
-	DAA_header2 h2_(db.ref_header.sequences,
-		config.db_size,
-		score_matrix.gap_open(),
-		score_matrix.gap_extend(),
-		config.reward,
-		config.penalty,
-		score_matrix.k(),
-		score_matrix.lambda(),
-		config.max_evalue,
-		to_lower_case(config.matrix),
-		align_mode.mode);
-
-	h2_.block_type[0] = DAA_header2::alignments;
-	h2_.block_type[1] = DAA_header2::ref_names;
-	h2_.block_type[2] = DAA_header2::ref_lengths;
-
-	const ReferenceDictionary &dict = ReferenceDictionary::get();
-
-	uint32_t size = 0;
-	f.write(&size, 1);
-	h2_.block_size[0] = f.tell() - sizeof(DAA_header1) - sizeof(DAA_header2);
-	h2_.db_seqs_used = dict.seqs();
-	h2_.query_records = statistics.get(Statistics::ALIGNED);
-
-	size_t s = 0;
-	for (PtrVector<string>::const_iterator i = dict.name_.begin(); i != dict.name_.end(); ++i) {
-		f << **i;
-		s += (*i)->length() + 1;
+
+	enum { DAA_BLOCK_SIZE = 1 << 20, MAX_PENDING_PER_THREAD = 2 };
+
+	DAA_writer(const string &file_name, bool block_compressed = false):
+		f_(file_name),
+		block_compressed_(block_compressed),
+		pos_(0),
+		record_end_(0),
+		header_fill_(0),
+		queries_(0),
+		alignments_size_(0),
+		block_first_query_(0),
+		writing_(false),
+		stop_(false)
+	{
+		DAA_header1 h1(block_compressed ? DAA_header1::BLOCK_COMPRESSED_VERSION : DAA_header1::UNCOMPRESSED_VERSION);
+		f_.write(&h1, 1);
+		DAA_header2 h2_;
+		f_.write(&h2_, 1);
+		if (block_compressed)
+			for (unsigned i = 0; i < std::max(config.threads_, 1u); ++i)
+				threads_.emplace_back(&DAA_writer::compress_worker, this);
 	}
-	h2_.block_size[1] = s;
 
-	f.write(dict.len_.data(), dict.len_.size());
-	h2_.block_size[2] = dict.len_.size() * sizeof(uint32_t);
+	virtual ~DAA_writer()
+	{
+		stop_threads();
+		for (Block *b : pending_)
+			delete b;
+		for (Block *b : free_)
+			delete b;
+	}
 
-	f.seek(sizeof(DAA_header1));
-	f.write(&h2_, 1);
-}
+	virtual void consume(const char *ptr, size_t n) override
+	{
+		if (block_compressed_)
+			raw_.insert(raw_.end(), ptr, ptr + n);
+		else
+			f_.write_raw(ptr, n);
+		const uint64_t end = pos_ + n;
+		while (record_end_ + header_fill_ < end) {
+			const size_t begin = size_t(record_end_ + header_fill_ - pos_);
+			if (header_fill_ == 0) {
+				if (!block_compressed_)
+					query_offset_.push_back(record_end_);
+				++queries_;
+			}
+			const size_t k = std::min(sizeof(uint32_t) - header_fill_, n - begin);
+			memcpy(header_ + header_fill_, ptr + begin, k);
+			header_fill_ += k;
+			if (header_fill_ < sizeof(uint32_t))
+				break;
+			uint32_t size;
+			memcpy(&size, header_, sizeof(uint32_t));
+			record_end_ += sizeof(uint32_t) + size;
+			header_fill_ = 0;
+		}
+		pos_ = end;
+		if (block_compressed_ && record_end_ == end && raw_.size() >= DAA_BLOCK_SIZE)
+			write_block();
+	}
 
-inline void finish_daa(OutputFile &f, DAA_file &daa_in) {
-	DAA_header2 h2_(daa_in.db_seqs(),
-		daa_in.db_letters(),
-		daa_in.gap_open_penalty(),
-		daa_in.gap_extension_penalty(),
-		daa_in.match_reward(),
-		daa_in.mismatch_penalty(),
-		daa_in.kappa(),
-		daa_in.lambda(),
-		daa_in.evalue(),
-		daa_in.score_matrix(),
-		daa_in.mode());
-
-	h2_.block_type[0] = DAA_header2::alignments;
-	h2_.block_type[1] = DAA_header2::ref_names;
-	h2_.block_type[2] = DAA_header2::ref_lengths;
-
-	uint32_t size = 0;
-	f.write(&size, 1);
-	h2_.block_size[0] = f.tell() - sizeof(DAA_header1) - sizeof(DAA_header2);
-	h2_.db_seqs_used = daa_in.db_seqs_used();
-	h2_.query_records = daa_in.query_records();
-
-	for (size_t i = 0; i < daa_in.db_seqs_used(); ++i)
-		f << daa_in.ref_name(i);
-	h2_.block_size[1] = daa_in.block_size(1);
-
-	f.write(daa_in.ref_len().data(), daa_in.ref_len().size());
-	h2_.block_size[2] = daa_in.block_size(2);
-
-	f.seek(sizeof(DAA_header1));
-	f.write(&h2_, 1);
-}
+	virtual void finalize() override
+	{
+		f_.finalize();
+	}
+
+	void finish(const DatabaseFile &db)
+	{
+		DAA_header2 h2_(db.total_sequences(),
+			config.db_size,
+			score_matrix.gap_open(),
+			score_matrix.gap_extend(),
+			config.reward,
+			config.penalty,
+			score_matrix.k(),
+			score_matrix.lambda(),
+			config.max_evalue,
+			to_lower_case(config.matrix),
+			align_mode.mode);
+
+		const ReferenceDictionary &dict = ReferenceDictionary::get();
+
+		finish_alignments(h2_);
+		h2_.db_seqs_used = dict.seqs();
+		h2_.query_records = statistics.get(Statistics::ALIGNED);
+
+		const uint32_t n = config.no_dict ? 0 : dict.seqs();
+		size_t s = 0;
+		for (uint32_t i = 0; i < n; ++i) {
+			const char *name = dict.entry(i).name;
+			const size_t l = strlen(name) + 1;
+			f_.write(name, l);
+			s += l;
+		}
+		h2_.block_size[1] = s;
+
+		for (uint32_t i = 0; i < n; ++i)
+			f_.write(dict.entry(i).len);
+		h2_.block_size[2] = n * sizeof(uint32_t);
+
+		finish_index(h2_);
+	}
+
+	void finish(DAA_file &daa_in)
+	{
+		DAA_header2 h2_(daa_in.db_seqs(),
+			daa_in.db_letters(),
+			daa_in.gap_open_penalty(),
+			daa_in.gap_extension_penalty(),
+			daa_in.match_reward(),
+			daa_in.mismatch_penalty(),
+			daa_in.kappa(),
+			daa_in.lambda(),
+			daa_in.evalue(),
+			daa_in.score_matrix(),
+			daa_in.mode());
+
+		finish_alignments(h2_);
+		h2_.db_seqs_used = daa_in.db_seqs_used();
+		h2_.query_records = daa_in.query_records();
+
+		for (size_t i = 0; i < daa_in.db_seqs_used(); ++i)
+			f_ << daa_in.ref_name(i);
+		h2_.block_size[1] = daa_in.block_size(1);
+
+		f_.write(daa_in.ref_len().data(), daa_in.ref_len().size());
+		h2_.block_size[2] = daa_in.block_size(2);
+
+		finish_index(h2_);
+	}
+
+private:
+
+	void finish_alignments(DAA_header2 &h2_)
+	{
+		h2_.block_type[0] = DAA_header2::alignments;
+		h2_.block_type[1] = DAA_header2::ref_names;
+		h2_.block_type[2] = DAA_header2::ref_lengths;
+		h2_.block_type[3] = DAA_header2::query_index;
+
+		if (!raw_.empty())
+			write_block();
+		if (block_compressed_) {
+			{
+				std::unique_lock<std::mutex> lock(mtx_);
+				written_.wait(lock, [this] { return pending_.empty() || error_; });
+			}
+			stop_threads();
+			if (error_)
+				std::rethrow_exception(error_);
+		}
+		uint32_t size = 0;
+		f_.write(&size, 1);
+		h2_.block_size[0] = f_.tell() - sizeof(DAA_header1) - sizeof(DAA_header2);
+	}
+
+	void finish_index(DAA_header2 &h2_)
+	{
+		if (block_compressed_) {
+			h2_.block_type[3] = DAA_header2::block_index;
+			f_.write(blocks_.data(), blocks_.size());
+			h2_.block_size[3] = blocks_.size() * sizeof(DAA_block);
+		}
+		else {
+			f_.write(query_offset_.data(), query_offset_.size());
+			h2_.block_size[3] = query_offset_.size() * sizeof(uint64_t);
+		}
+
+		f_.seek(sizeof(DAA_header1));
+		f_.write(&h2_, 1);
+	}
+
+	struct Block
+	{
+		vector<char> raw, compressed;
+		uint64_t first_query;
+		bool done;
+	};
+
+	// Queues the collected records for compression. Waits while too many blocks are pending.
+	void write_block()
+	{
+		std::unique_lock<std::mutex> lock(mtx_);
+		written_.wait(lock, [this] { return pending_.size() < MAX_PENDING_PER_THREAD * threads_.size() || error_; });
+		if (error_)
+			std::rethrow_exception(error_);
+		Block *b;
+		if (free_.empty())
+			b = new Block;
+		else {
+			b = free_.back();
+			free_.pop_back();
+		}
+		b->raw.swap(raw_);
+		b->first_query = block_first_query_;
+		b->done = false;
+		block_first_query_ = queries_;
+		pending_.push_back(b);
+		jobs_.push_back(b);
+		job_ready_.notify_one();
+	}
+
+	void compress_worker()
+	{
+		std::unique_lock<std::mutex> lock(mtx_);
+		while (true) {
+			job_ready_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+			if (jobs_.empty())
+				return;
+			Block *b = jobs_.front();
+			jobs_.pop_front();
+			lock.unlock();
+			uLongf size = compressBound((uLong)b->raw.size());
+			b->compressed.resize(size);
+			const bool ok = compress2((Bytef*)b->compressed.data(), &size, (const Bytef*)b->raw.data(), (uLong)b->raw.size(), Z_DEFAULT_COMPRESSION) == Z_OK;
+			b->compressed.resize(size);
+			lock.lock();
+			b->done = true;
+			if (!ok && !error_)
+				error_ = std::make_exception_ptr(std::runtime_error("Error compressing DAA block."));
+			write_done_blocks(lock);
+		}
+	}
+
+	// Writes the finished blocks at the front of the queue. Only one thread writes at a time, blocks finished by other
+	// threads meanwhile are picked up by the writing thread.
+	void write_done_blocks(std::unique_lock<std::mutex> &lock)
+	{
+		if (writing_)
+			return;
+		writing_ = true;
+		while (!pending_.empty() && pending_.front()->done && !error_) {
+			Block *b = pending_.front();
+			lock.unlock();
+			try {
+				const DAA_block block = { alignments_size_, b->first_query };
+				blocks_.push_back(block);
+				const uint32_t sizes[2] = { (uint32_t)b->compressed.size(), (uint32_t)b->raw.size() };
+				f_.write(sizes, 2);
+				f_.write(b->compressed.data(), b->compressed.size());
+				alignments_size_ += sizeof(sizes) + b->compressed.size();
+			}
+			catch (...) {
+				lock.lock();
+				error_ = std::current_exception();
+				break;
+			}
+			b->raw.clear();
+			lock.lock();
+			pending_.pop_front();
+			free_.push_back(b);
+		}
+		writing_ = false;
+		written_.notify_all();
+	}
+
+	void stop_threads()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx_);
+			stop_ = true;
+		}
+		job_ready_.notify_all();
+		for (std::thread &t : threads_)
+			t.join();
+		threads_.clear();
+	}
+
+	OutputFile f_;
+	const bool block_compressed_;
+	uint64_t pos_, record_end_;
+	size_t header_fill_;
+	char header_[sizeof(uint32_t)];
+	uint64_t queries_, alignments_size_, block_first_query_;
+	vector<uint64_t> query_offset_;
+	vector<char> raw_;
+	vector<DAA_block> blocks_;
+	std::deque<Block*> pending_, jobs_;
+	vector<Block*> free_;
+	bool writing_, stop_;
+	std::exception_ptr error_;
+	std::mutex mtx_;
+	std::condition_variable job_ready_, written_;
+	vector<std::thread> threads_;
+
+};
 
 #endif /* DAA_WRITE_H_ */
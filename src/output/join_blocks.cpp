@@ -17,6 +17,11 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ****/
 
 #include <memory>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "output.h"
 #include "../util/io/temp_file.h"
 #include "../data/queries.h"
@@ -29,74 +34,101 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 using namespace std;
 
+struct JoinQuery
+{
+	unsigned query_id, unaligned_from;
+	vector<BinaryBuffer> buf;
+};
+
+// Merges the block files by query id on a separate thread, keeping a bounded number of queries read ahead.
 struct JoinFetcher
 {
-	static void init(const PtrVector<TempFile> &tmp_file)
+	JoinFetcher(PtrVector<InputFile> &input_files, size_t limit):
+		query_last((unsigned)-1),
+		limit_(limit),
+		next_(0),
+		at_end_(false)
 	{
-		for (PtrVector<TempFile>::const_iterator i = tmp_file.begin(); i != tmp_file.end(); ++i) {
-			files.push_back(new InputFile(**i));
-			query_ids.push_back(0);
-			files.back().read(&query_ids.back(), 1);
+		files_.swap(input_files);
+		for (unsigned i = 0; i < files_.size(); ++i) {
+			unsigned query_id;
+			files_[i].read(&query_id, 1);
+			if (query_id != IntermediateRecord::FINISHED)
+				heap_.emplace_back(query_id, i);
 		}
-		query_last = (unsigned)-1;
+		std::make_heap(heap_.begin(), heap_.end(), std::greater<pair<unsigned, unsigned>>());
+		thread_ = thread(&JoinFetcher::fetch_worker, this);
 	}
-	static void finish()
+	bool get(size_t &n, JoinQuery *&query)
 	{
-		for (PtrVector<InputFile>::iterator i = files.begin(); i != files.end(); ++i)
-			(*i)->close_and_delete();
-		files.clear();
-		query_ids.clear();
+		std::unique_lock<std::mutex> lock(mtx_);
+		while (queue_.empty() && !at_end_)
+			cond_.wait(lock);
+		if (queue_.empty())
+			return false;
+		query = queue_.front();
+		queue_.pop_front();
+		n = next_++;
+		cond_.notify_all();
+		return true;
 	}
-	static unsigned next()
+	void finish(bool delete_files)
 	{
-		return *std::min_element(query_ids.begin(), query_ids.end());
+		thread_.join();
+		for (PtrVector<InputFile>::iterator i = files_.begin(); i != files_.end(); ++i)
+			if (delete_files)
+				(*i)->close_and_delete();
+			else
+				(*i)->close();
+		files_.clear();
 	}
-	void fetch(unsigned b)
+	unsigned query_last;
+private:
+	void fetch(unsigned b, BinaryBuffer &buf)
 	{
-		unsigned size;
-		files[b].read(&size, 1);
-		buf[b].clear();
-		buf[b].resize(size);
-		files[b].read(buf[b].data(), size);
-		files[b].read(&query_ids[b], 1);
+		unsigned size, query_id;
+		files_[b].read(&size, 1);
+		buf.resize(size);
+		files_[b].read(buf.data(), size);
+		files_[b].read(&query_id, 1);
+		if (query_id != IntermediateRecord::FINISHED) {
+			heap_.emplace_back(query_id, b);
+			std::push_heap(heap_.begin(), heap_.end(), std::greater<pair<unsigned, unsigned>>());
+		}
 	}
-	JoinFetcher():
-		buf(current_ref_block)
-	{}
-	bool operator()()
+	void fetch_worker()
 	{
-		query_id = next();
-		unaligned_from = query_last + 1;
-		query_last = query_id;
-		for (unsigned i = 0; i < buf.size(); ++i)
-			if (query_ids[i] == query_id && query_id != IntermediateRecord::FINISHED)
-				fetch(i);
-			else
-				buf[i].clear();
-		return next() != IntermediateRecord::FINISHED;
-	}
-	static PtrVector<InputFile> files;
-	static vector<unsigned> query_ids;
-	static unsigned query_last;
-	vector<BinaryBuffer> buf;
-	unsigned query_id, unaligned_from;
-};
-
-PtrVector<InputFile> JoinFetcher::files;
-vector<unsigned> JoinFetcher::query_ids;
-unsigned JoinFetcher::query_last;
-
-struct JoinWriter
-{
-	JoinWriter(Consumer &f):
-		f_(f)
-	{}
-	void operator()(TextBuffer& buf)
-	{
-		f_.consume(buf.get_begin(), buf.size());
-		buf.clear();
+		while (!heap_.empty()) {
+			JoinQuery *query = new JoinQuery;
+			query->query_id = heap_.front().first;
+			query->unaligned_from = query_last + 1;
+			query->buf.resize(files_.size());
+			query_last = query->query_id;
+			while (!heap_.empty() && heap_.front().first == query->query_id) {
+				const unsigned b = heap_.front().second;
+				std::pop_heap(heap_.begin(), heap_.end(), std::greater<pair<unsigned, unsigned>>());
+				heap_.pop_back();
+				fetch(b, query->buf[b]);
+			}
+			std::unique_lock<std::mutex> lock(mtx_);
+			while (queue_.size() >= limit_)
+				cond_.wait(lock);
+			queue_.push_back(query);
+			cond_.notify_all();
+		}
+		std::lock_guard<std::mutex> lock(mtx_);
+		at_end_ = true;
+		cond_.notify_all();
 	}
-	Consumer &f_;
+	PtrVector<InputFile> files_;
+	vector<pair<unsigned, unsigned>> heap_;
+	const size_t limit_;
+	size_t next_;
+	bool at_end_;
+	std::deque<JoinQuery*> queue_;
+	std::mutex mtx_;
+	std::condition_variable cond_;
+	thread thread_;
 };
 
 struct Join_record
@@ -112,17 +144,18 @@ struct Join_record
 		return block_ < rhs.block_ || (block_ == rhs.block_ && info_.subject_id < rhs.info_.subject_id);
 	}
 
-	Join_record(unsigned ref_block, unsigned subject, BinaryBuffer::Iterator &it):
+	Join_record(unsigned ref_block, unsigned subject, BinaryBuffer::Iterator &it, uint32_t subject_id_offset):
 		block_(ref_block)
 	{
 		info_.read(it);
+		info_.subject_id += subject_id_offset;
 		same_subject_ = info_.subject_id == subject;
 	}
 
-	static bool push_next(unsigned block, unsigned subject, BinaryBuffer::Iterator &it, vector<Join_record> &v)
+	static bool push_next(unsigned block, unsigned subject, BinaryBuffer::Iterator &it, vector<Join_record> &v, uint32_t subject_id_offset)
 	{
 		if (it.good()) {
-			v.push_back(Join_record(block, subject, it));
+			v.push_back(Join_record(block, subject, it, subject_id_offset));
 			return true;
 		}
 		else
@@ -137,11 +170,12 @@ struct Join_record
 
 struct BlockJoiner
 {
-	BlockJoiner(vector<BinaryBuffer> &buf)
+	BlockJoiner(vector<BinaryBuffer> &buf, const vector<uint32_t> &subject_id_offset):
+		subject_id_offset(subject_id_offset)
 	{
-		for (unsigned i = 0; i < current_ref_block; ++i) {
+		for (unsigned i = 0; i < buf.size(); ++i) {
 			it.push_back(buf[i].begin());
-			Join_record::push_next(i, std::numeric_limits<unsigned>::max(), it.back(), records);
+			Join_record::push_next(i, std::numeric_limits<unsigned>::max(), it.back(), records, offset(i));
 		}
 		std::make_heap(records.begin(), records.end());
 	}
@@ -160,20 +194,25 @@ struct BlockJoiner
 			target_hsp.push_back(next.info_);
 			std::pop_heap(records.begin(), records.end());
 			records.pop_back();
-			if (Join_record::push_next(block, subject, it[block], records))
+			if (Join_record::push_next(block, subject, it[block], records, offset(block)))
 				std::push_heap(records.begin(), records.end());
 		} while (!records.empty());
 		return true;
 	}
+	uint32_t offset(unsigned block) const
+	{
+		return subject_id_offset.empty() ? 0 : subject_id_offset[block];
+	}
 	vector<Join_record> records;
 	vector<BinaryBuffer::Iterator> it;
+	const vector<uint32_t> &subject_id_offset;
 };
 
-void join_query(vector<BinaryBuffer> &buf, TextBuffer &out, Statistics &statistics, unsigned query, const char *query_name, unsigned query_source_len, Output_format &f, const Metadata &metadata)
+void join_query(vector<BinaryBuffer> &buf, const vector<uint32_t> &subject_id_offset, TextBuffer &out, Statistics &statistics, unsigned query, const char *query_name, unsigned query_source_len, Output_format &f, const Metadata &metadata)
 {
 	const ReferenceDictionary& dict = ReferenceDictionary::get();
 	TranslatedSequence query_seq(get_translated_query(query));
-	BlockJoiner joiner(buf);
+	BlockJoiner joiner(buf, subject_id_offset);
 	vector<IntermediateRecord> target_hsp;
 	unique_ptr<TargetCulling> culling(TargetCulling::get());
 
@@ -214,23 +253,23 @@ void join_query(vector<BinaryBuffer> &buf, TextBuffer &out, Statistics &statisti
 	}
 }
 
-void join_worker(Task_queue<TextBuffer, JoinWriter> *queue, const Parameters *params, const Metadata *metadata)
+void join_worker(JoinFetcher *fetcher, const vector<uint32_t> *subject_id_offset, const Parameters *params, const Metadata *metadata)
 {
-	JoinFetcher fetcher;
 	size_t n;
-	TextBuffer *out;
+	JoinQuery *query;
 	Statistics stat;
 	const String_set<0>& qids = query_ids::get();
 
-	while (queue->get(n, out, fetcher) && fetcher.query_id != IntermediateRecord::FINISHED) {
+	while (fetcher->get(n, query)) {
+		TextBuffer *out = OutputSink::get().get_buffer();
 		stat.inc(Statistics::ALIGNED);
 		size_t seek_pos;
 
-		const char * query_name = qids[qids.check_idx(fetcher.query_id)].c_str();
-		const sequence query_seq = align_mode.query_translated ? query_source_seqs::get()[fetcher.query_id] : query_seqs::get()[fetcher.query_id];
+		const char * query_name = qids[qids.check_idx(query->query_id)].c_str();
+		const sequence query_seq = align_mode.query_translated ? query_source_seqs::get()[query->query_id] : query_seqs::get()[query->query_id];
 
 		if (*output_format != Output_format::daa && config.report_unaligned != 0) {
-			for (unsigned i = fetcher.unaligned_from; i < fetcher.query_id; ++i) {
+			for (unsigned i = query->unaligned_from; i < query->query_id; ++i) {
 				output_format->print_query_intro(i, query_ids::get()[i].c_str(), get_source_query_len(i), *out, true);
 				output_format->print_query_epilog(*out, query_ids::get()[i].c_str(), true, *params);
 			}
@@ -241,44 +280,52 @@ void join_worker(Task_queue<TextBuffer, JoinWriter> *queue, const Parameters *pa
 		if (*f == Output_format::daa)
 			seek_pos = write_daa_query_record(*out, query_name, query_seq);
 		else
-			f->print_query_intro(fetcher.query_id, query_name, (unsigned)query_seq.length(), *out, false);
+			f->print_query_intro(query->query_id, query_name, (unsigned)query_seq.length(), *out, false);
 
-		join_query(fetcher.buf, *out, stat, fetcher.query_id, query_name, (unsigned)query_seq.length(), *f, *metadata);
+		join_query(query->buf, *subject_id_offset, *out, stat, query->query_id, query_name, (unsigned)query_seq.length(), *f, *metadata);
 
 		if (*f == Output_format::daa)
 			finish_daa_query_record(*out, seek_pos);
 		else
 			f->print_query_epilog(*out, query_name, false, *params);
 
-		queue->push(n);
+		delete query;
+		OutputSink::get().push(n, out);
 	}
 
 	statistics += stat;
 }
 
 void join_blocks(unsigned ref_blocks, Consumer &master_out, const PtrVector<TempFile> &tmp_file, const Parameters &params, const Metadata &metadata, DatabaseFile &db_file)
+{
+	PtrVector<InputFile> files;
+	for (PtrVector<TempFile>::const_iterator i = tmp_file.begin(); i != tmp_file.end(); ++i)
+		files.push_back(new InputFile(**i));
+	join_blocks(files, vector<uint32_t>(), master_out, params, metadata, db_file, true);
+}
+
+void join_blocks(PtrVector<InputFile> &files, const vector<uint32_t> &subject_id_offset, Consumer &master_out, const Parameters &params, const Metadata &metadata, DatabaseFile &db_file, bool delete_files)
 {
 	//ReferenceDictionary::get().init_rev_map();
 	task_timer timer("Building reference dictionary", 3);
 	if (config.use_lazy_dict)
 		ReferenceDictionary::get().build_lazy_dict(db_file);
 	timer.go("Joining output blocks");
-	JoinFetcher::init(tmp_file);
-	JoinWriter writer(master_out);
-	Task_queue<TextBuffer, JoinWriter> queue(3 * config.threads_, writer);
+	JoinFetcher fetcher(files, 4 * config.threads_);
+	OutputSink::instance = unique_ptr<OutputSink>(new OutputSink(0, &master_out));
 	vector<thread> threads;
 	for (unsigned i = 0; i < config.threads_; ++i)
-		threads.emplace_back(join_worker, &queue, &params, &metadata);
+		threads.emplace_back(join_worker, &fetcher, &subject_id_offset, &params, &metadata);
 	for (auto &t : threads)
 		t.join();
-	JoinFetcher::finish();
+	fetcher.finish(delete_files);
 	if (*output_format != Output_format::daa && config.report_unaligned != 0) {
 		TextBuffer out;
-		for (unsigned i = JoinFetcher::query_last + 1; i < query_ids::get().get_length(); ++i) {
+		for (unsigned i = fetcher.query_last + 1; i < query_ids::get().get_length(); ++i) {
 			output_format->print_query_intro(i, query_ids::get()[i].c_str(), get_source_query_len(i), out, true);
 			output_format->print_query_epilog(out, query_ids::get()[i].c_str(), true, params);
 		}
-		writer(out);
+		master_out.consume(out.get_begin(), out.size());
 	}
 	if (config.use_lazy_dict) {
 		timer.go("Deallocating dictionary");
@@ -21,6 +21,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <memory>
 #include <map>
+#include <vector>
 #include <mutex>
 #include "../util/io/output_file.h"
 #include "../basic/packed_transcript.h"
@@ -116,6 +117,7 @@ struct IntermediateRecord
 };
 
 void join_blocks(unsigned ref_blocks, Consumer &master_out, const PtrVector<TempFile> &tmp_file, const Parameters &params, const Metadata &metadata, DatabaseFile &db_file);
+void join_blocks(PtrVector<InputFile> &files, const vector<uint32_t> &subject_id_offset, Consumer &master_out, const Parameters &params, const Metadata &metadata, DatabaseFile &db_file, bool delete_files);
 
 struct OutputSink
 {
@@ -123,8 +125,12 @@ struct OutputSink
 		f_(f),
 		next_(begin),
 		size_(0),
-		max_size_(0)
+		max_size_(0),
+		free_size_(0)
 	{}
+	~OutputSink();
+	// Returns an empty buffer for the output of one query, reusing the memory of buffers already written.
+	TextBuffer* get_buffer();
 	void push(size_t n, TextBuffer *buf);
 	size_t size() const
 	{
@@ -148,7 +154,10 @@ private:
 	std::mutex mtx_;
 	Consumer* const f_;
 	std::map<size_t, TextBuffer*> backlog_;
-	size_t next_, size_, max_size_;
+	std::vector<TextBuffer*> free_;
+	size_t next_, size_, max_size_, free_size_;
+	// Total allocation size of the buffers kept for reuse.
+	enum { MAX_FREE_SIZE = 16 << 20 };
 };
 
 void heartbeat_worker(size_t qend);
@@ -109,8 +109,10 @@ Output_format* get_output_format()
 		return new Taxon_format;
 	else if (f[0] == "paf" || f[0] == "103")
 		return new PAF_format;
+	else if (f[0] == "104")
+		return new Column_format;
 	else
-		throw std::runtime_error("Invalid output format. Allowed values: 0,5,6,100,101,102");
+		throw std::runtime_error("Invalid output format. Allowed values: 0,5,6,100,101,102,103,104");
 }
 
 void init_output(bool have_taxon_id_lists, bool have_taxon_nodes, bool have_taxon_scientific_names)
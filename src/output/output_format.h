@@ -59,7 +59,7 @@ struct Output_format
 	}
 	unsigned code;
 	bool needs_taxon_id_lists, needs_taxon_nodes, needs_taxon_scientific_names;
-	enum { daa, blast_tab, blast_xml, sam, blast_pairwise, null, taxon, paf };
+	enum { daa, blast_tab, blast_xml, sam, blast_pairwise, null, taxon, paf, column };
 };
 
 extern std::unique_ptr<Output_format> output_format;
@@ -89,6 +89,7 @@ struct DAA_format : public Output_format
 struct Blast_tab_format : public Output_format
 {
 	static const char* field_str[], *field_desc[];
+	static const unsigned field_count;
 	Blast_tab_format();
 	virtual void print_header(Consumer &f, int mode, const char *matrix, int gap_open, int gap_extend, double evalue, const char *first_query_name, unsigned first_query_len) const override;
 	virtual void print_query_intro(size_t query_num, const char *query_name, unsigned query_len, TextBuffer &out, bool unaligned) const override;
@@ -100,6 +101,40 @@ struct Blast_tab_format : public Output_format
 		return new Blast_tab_format(*this);
 	}
 	vector<unsigned> fields;
+	struct Row;
+	typedef void (*Column_writer)(const Row &row, TextBuffer &out);
+private:
+	// The fields compiled into writers, plus the strings that need a walk over the transcript.
+	vector<Column_writer> columns_;
+	unsigned transcript_strings_;
+};
+
+// Binary output that stores the fields of the hits of each query as typed column arrays.
+struct Column_format : public Output_format
+{
+	enum { UINT32, INT32, DOUBLE, STRING, QUERY };
+	static const uint64_t MAGIC;
+	static const uint32_t VERSION;
+	Column_format();
+	virtual void print_header(Consumer &f, int mode, const char *matrix, int gap_open, int gap_extend, double evalue, const char *first_query_name, unsigned first_query_len) const override;
+	virtual void print_query_intro(size_t query_num, const char *query_name, unsigned query_len, TextBuffer &out, bool unaligned) const override;
+	virtual void print_match(const Hsp_context& r, const Metadata &metadata, TextBuffer &out) override;
+	virtual void print_query_epilog(TextBuffer &out, const char *query_title, bool unaligned, const Parameters &parameters) const override;
+	virtual void print_footer(Consumer &f) const override;
+	virtual ~Column_format()
+	{ }
+	virtual Output_format* clone() const override
+	{
+		return new Column_format(*this);
+	}
+	static bool is_column_file(const string &file_name);
+	// Converts a column file to tabular text, written to the output file.
+	static void view(const string &file_name);
+	vector<unsigned> fields;
+private:
+	mutable string query_name_;
+	mutable uint32_t query_len_, rows_;
+	mutable vector<vector<char>> columns_, strings_;
 };
 
 struct PAF_format : public Output_format
@@ -18,11 +18,29 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "output.h"
 #include "../data/queries.h"
+#include "../basic/config.h"
 
 using namespace std;
 
 unique_ptr<OutputSink> OutputSink::instance;
 
+OutputSink::~OutputSink()
+{
+	for (vector<TextBuffer*>::iterator i = free_.begin(); i < free_.end(); ++i)
+		delete *i;
+}
+
+TextBuffer* OutputSink::get_buffer()
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	if (free_.empty())
+		return new TextBuffer;
+	TextBuffer *buf = free_.back();
+	free_.pop_back();
+	free_size_ -= buf->alloc_size();
+	return buf;
+}
+
 void OutputSink::push(size_t n, TextBuffer *buf)
 {
 	mtx_.lock();
@@ -56,14 +74,28 @@ void OutputSink::flush(TextBuffer *buf)
 				f_->consume((*j)->get_begin(), (*j)->size());
 				if (*j != buf)
 					size += (*j)->alloc_size();
-				delete *j;
 			}
 		}
-		out.clear();
 		mtx_.lock();
 		size_ -= size;
+		for (vector<TextBuffer*>::iterator j = out.begin(); j < out.end(); ++j)
+			if (*j && free_size_ + (*j)->alloc_size() <= MAX_FREE_SIZE) {
+				(*j)->clear();
+				free_.push_back(*j);
+				free_size_ += (*j)->alloc_size();
+			}
+			else
+				delete *j;
+		out.clear();
 	} while ((i = backlog_.begin()) != backlog_.end() && i->first == n);
 	next_ = n;
+	// Without a backlog, each thread holds at most one buffer at a time, so the buffers kept for the backlog are released.
+	if (backlog_.empty())
+		while (free_.size() > (size_t)config.threads_) {
+			free_size_ -= free_.back()->alloc_size();
+			delete free_.back();
+			free_.pop_back();
+		}
 	mtx_.unlock();
 }
 
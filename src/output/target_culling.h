@@ -28,8 +28,10 @@ struct TargetCulling
 {
 	virtual int cull(const Target &t) const = 0;
 	virtual int cull(const vector<IntermediateRecord> &target_hsp) const = 0;
+	virtual int cull(const TargetArrays &targets, size_t i) const = 0;
 	virtual void add(const Target &t) = 0;
 	virtual void add(const vector<IntermediateRecord> &target_hsp) = 0;
+	virtual void add(const TargetArrays &targets, size_t i) = 0;
 	virtual ~TargetCulling() = default;
 	enum { FINISHED = 0, NEXT = 1, INCLUDE = 2};
 	static TargetCulling* get();
@@ -59,6 +61,15 @@ struct GlobalCulling : public TargetCulling
 		else
 			return n_ < config.max_alignments ? INCLUDE : FINISHED;
 	}
+	virtual int cull(const TargetArrays &targets, size_t i) const
+	{
+		if (top_score_ == 0)
+			return INCLUDE;
+		if (config.toppercent < 100.0)
+			return (1.0 - (double)targets.filter_score[i] / top_score_) * 100.0 <= config.toppercent ? INCLUDE : FINISHED;
+		else
+			return n_ < config.max_alignments ? INCLUDE : FINISHED;
+	}
 	virtual void add(const Target &t)
 	{
 		if (top_score_ == 0)
@@ -71,6 +82,12 @@ struct GlobalCulling : public TargetCulling
 			top_score_ = target_hsp[0].score;
 		++n_;
 	}
+	virtual void add(const TargetArrays &targets, size_t i)
+	{
+		if (top_score_ == 0)
+			top_score_ = targets.filter_score[i];
+		++n_;
+	}
 	virtual ~GlobalCulling() = default;
 private:
 	size_t n_;
@@ -111,6 +128,20 @@ struct RangeCulling : public TargetCulling
 		}
 		return (double)c / l * 100.0 < config.query_range_cover ? INCLUDE : NEXT;
 	}
+	virtual int cull(const TargetArrays &targets, size_t i) const
+	{
+		int c = 0, l = 0;
+		for (size_t j = targets.hsp_begin[i]; j < targets.hsp_begin[i + 1]; ++j) {
+			if (config.toppercent == 100.0)
+				c += p_.covered(targets.hsp_range[j]);
+			else {
+				const int cutoff = int((double)targets.hsp_score[j] / (1.0 - config.toppercent / 100.0));
+				c += p_.covered(targets.hsp_range[j], cutoff, IntervalPartition::MaxScore());
+			}
+			l += targets.hsp_range[j].length();
+		}
+		return (double)c / l * 100.0 < config.query_range_cover ? INCLUDE : NEXT;
+	}
 	virtual void add(const Target &t)
 	{
 		for (std::list<Hsp>::const_iterator i = t.hsps.begin(); i != t.hsps.end(); ++i)
@@ -121,6 +152,11 @@ struct RangeCulling : public TargetCulling
 		for (std::vector<IntermediateRecord>::const_iterator i = target_hsp.begin(); i != target_hsp.end(); ++i)
 			p_.insert(i->absolute_query_range(), i->score);
 	}
+	virtual void add(const TargetArrays &targets, size_t i)
+	{
+		for (size_t j = targets.hsp_begin[i]; j < targets.hsp_begin[i + 1]; ++j)
+			p_.insert(targets.hsp_range[j], targets.hsp_score[j]);
+	}
 	virtual ~RangeCulling() = default;
 private:
 	IntervalPartition p_;
@@ -17,6 +17,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ****/
 
 #include <memory>
+#include <stdlib.h>
 #include "../basic/config.h"
 #include "../util/io/output_file.h"
 #include "../util/text_buffer.h"
@@ -30,6 +31,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "../basic/parameters.h"
 #include "../data/metadata.h"
 #include "daa_write.h"
+#include "../util/parallel/thread_pool.h"
 
 using namespace std;
 
@@ -38,18 +40,20 @@ const unsigned view_buf_size = 32;
 struct View_writer
 {
 	View_writer() :
-		f_(new OutputFile(config.output_file, config.compression == 1))
+		f_(*output_format == Output_format::daa
+			? (Consumer*)new DAA_writer(config.output_file, config.daa_block_compression)
+			: new OutputFile(config.output_file, config.compression == 1))
 	{ }
 	void operator()(TextBuffer &buf)
 	{
-		f_->write(buf.get_begin(), buf.size());
+		f_->consume(buf.get_begin(), buf.size());
 		buf.clear();
 	}
 	~View_writer()
 	{
-		f_->close();
+		f_->finalize();
 	}
-	unique_ptr<OutputFile> f_;
+	unique_ptr<Consumer> f_;
 };
 
 struct View_fetcher
@@ -125,8 +129,35 @@ void view_worker(DAA_file *daa, View_writer *writer, Task_queue<TextBuffer, View
 	}
 }
 
+// Formats a block of an indexed DAA file, each thread reading through its own file handle.
+void view_block(size_t block, size_t thread_id, DAA_file *daa, PtrVector<InputFile> *files, Output_format *format, const Parameters *params, const Metadata *metadata)
+{
+	try {
+		vector<char> data;
+		daa->read_block((*files)[thread_id], block, data);
+		BinaryBuffer buf;
+		TextBuffer *out = OutputSink::get().get_buffer();
+		size_t pos = 0, query_num = daa->block_first_query(block);
+		while (DAA_file::next_query_record(data, pos, buf)) {
+			DAA_query_record r(*daa, buf, query_num++);
+			view_query(r, *out, *format, *params, *metadata);
+		}
+		OutputSink::get().push(block, out);
+	}
+	catch (std::exception &e) {
+		std::cout << e.what() << std::endl;
+		std::terminate();
+	}
+}
+
 void view()
 {
+	if (Column_format::is_column_file(config.daa_file)) {
+		task_timer timer("Converting column file");
+		Column_format::view(config.daa_file);
+		return;
+	}
+
 	task_timer timer("Loading subject IDs");
 	DAA_file daa(config.daa_file);
 	score_matrix = Score_matrix("", daa.lambda(), daa.kappa(), daa.gap_open_penalty(), daa.gap_extension_penalty(), daa.db_letters());
@@ -146,25 +177,56 @@ void view()
 
 	timer.go("Generating output");
 	View_writer writer;
-	if (*output_format == Output_format::daa)
-		init_daa(*writer.f_);
+
+	vector<size_t> selected;
+	for (vector<string>::const_iterator i = config.view_query_num.begin(); i != config.view_query_num.end(); ++i) {
+		char *end;
+		selected.push_back((size_t)strtoull(i->c_str(), &end, 10));
+		if (i->empty() || *end != '\0')
+			throw std::runtime_error("Invalid query number: " + *i);
+	}
+	if (!selected.empty())
+		daa.seek_query(selected.front());
 
 	BinaryBuffer buf;
 	size_t query_num;
 	if (daa.read_query_buffer(buf, query_num)) {
 		DAA_query_record r(daa, buf, query_num);
-		TextBuffer out;
-		view_query(r, out, *output_format, params, metadata);
-
 		output_format->print_header(*writer.f_, daa.mode(), daa.score_matrix(), daa.gap_open_penalty(), daa.gap_extension_penalty(), daa.evalue(), r.query_name.c_str(), (unsigned)r.query_len());
-		writer(out);
 
-		vector<thread> threads;
-		Task_queue<TextBuffer, View_writer> queue(3 * config.threads_, writer);
-		for (size_t i = 0; i < config.threads_; ++i)
-			threads.emplace_back(view_worker, &daa, &writer, &queue, output_format.get(), &params, &metadata);
-		for (auto &t : threads)
-			t.join();
+		if (!selected.empty()) {
+			TextBuffer out;
+			for (vector<size_t>::const_iterator i = selected.begin(); i != selected.end(); ++i) {
+				if (i != selected.begin()) {
+					daa.seek_query(*i);
+					daa.read_query_buffer(buf, query_num);
+				}
+				DAA_query_record r(daa, buf, query_num);
+				view_query(r, out, *output_format, params, metadata);
+				writer(out);
+			}
+		}
+		else if (daa.has_query_index()) {
+			PtrVector<InputFile> files;
+			for (size_t i = 0; i < config.threads_; ++i)
+				files.push_back(new InputFile(config.daa_file));
+			OutputSink::instance = unique_ptr<OutputSink>(new OutputSink(0, writer.f_.get()));
+			Util::Parallel::scheduled_thread_pool_auto(config.threads_, daa.block_count(), view_block, &daa, &files, output_format.get(), &params, &metadata);
+			for (PtrVector<InputFile>::iterator i = files.begin(); i != files.end(); ++i)
+				(*i)->close();
+		}
+		else {
+			TextBuffer out;
+			view_query(r, out, *output_format, params, metadata);
+			writer(out);
+
+			vector<thread> threads;
+			Task_queue<TextBuffer, View_writer> queue(3 * config.threads_, writer);
+			for (size_t i = 0; i < config.threads_; ++i)
+				threads.emplace_back(view_worker, &daa, &writer, &queue, output_format.get(), &params, &metadata);
+			for (auto &t : threads)
+				t.join();
+		}
 	}
 	else {
 		TextBuffer out;
@@ -173,7 +235,7 @@ void view()
 	}
 
 	if (*output_format == Output_format::daa)
-		finish_daa(*writer.f_, daa);
+		static_cast<DAA_writer&>(*writer.f_).finish(daa);
 	else
 		output_format->print_footer(*writer.f_);
 }
@@ -23,6 +23,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <memory>
 #include <fstream>
 #include <limits>
+#include <sstream>
 #include "../util/system/system.h"
 #include "../util/util.h"
 #include "../basic/config.h"
@@ -34,14 +35,17 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "../util/log_stream.h"
 #include "../dp/dp.h"
 #include "../basic/masking.h"
+#include "../util/parallel/thread_pool.h"
 
 using namespace std;
 
 namespace Workflow { namespace Cluster {
 
-struct Neighbors : public vector<vector<int>>, public Consumer {
+static const size_t output_batch_size = 4096;
+
+struct Neighbors : public Util::Algo::WeightedGraph, public Consumer {
 	Neighbors(size_t n):
-		vector<vector<int>>(n)
+		Util::Algo::WeightedGraph((int)n)
 	{}
 	virtual void consume(const char *ptr, size_t n) override {
 		int query, subject, count;
@@ -53,11 +57,9 @@ struct Neighbors : public vector<vector<int>>, public Consumer {
 				throw runtime_error("Cluster format error.");
 			ptr += count;
 			//cout << query << '\t' << subject << '\t' << qcov << '\t' << scov << '\t' << endl;
-			(*this)[query].push_back(subject);
-			edges.push_back({ query, subject, (int)bitscore });
+			add_edge(query, subject, (int)bitscore);
 		}
 	}
-	vector<Util::Algo::Edge> edges;
 };
 
 vector<bool> rep_bitset(const vector<int> &centroid, const vector<bool> *superset = nullptr) {
@@ -89,9 +91,34 @@ vector<int> cluster(DatabaseFile &db, const vector<bool> *filter) {
 	opt.db_filter = filter;
 
 	Workflow::Search::run(opt);
-	
-	return Util::Algo::greedy_vortex_cover_weighted(nb.edges, (int)db.ref_header.sequences);
-	//return greedy_vortex_cover(nb);
+
+	task_timer timer("Computing greedy vertex cover");
+	nb.finish();
+	return Util::Algo::greedy_vortex_cover_weighted(nb, config.threads_);
+}
+
+void align_to_representative(size_t i, size_t thread_id, const vector<int> *centroid, const vector<unsigned> *rep_block_id, const Sequence_set *rep_seqs, const String_set<0> *rep_ids, size_t begin, vector<string> *ids, vector<vector<char>> *seqs, vector<string> *lines) {
+	const int seq_id = int(begin + i);
+	const unsigned r = (*rep_block_id)[(*centroid)[seq_id]];
+	vector<char> &seq = (*seqs)[i];
+	std::ostringstream out;
+	out.precision(3);
+	out << blast_id((*ids)[i]) << '\t'
+		<< blast_id((*rep_ids)[r].c_str()) << '\t';
+
+	if (seq_id == (*centroid)[seq_id])
+		out << "100\t100\t100\t0" << endl;
+	else {
+		Hsp hsp;
+		size_t n;
+		Masking::get().bit_to_hard_mask(seq.data(), seq.size(), n);
+		smith_waterman(sequence(seq), (*rep_seqs)[r], hsp);
+		out << hsp.id_percent() << '\t'
+			<< hsp.query_cover_percent((unsigned)seq.size()) << '\t'
+			<< hsp.subject_cover_percent((unsigned)(*rep_seqs)[r].length()) << '\t'
+			<< score_matrix.bitscore(hsp.score) << endl;
+	}
+	(*lines)[i] = out.str();
 }
 
 void run() {
@@ -126,30 +153,17 @@ void run() {
 		rep_block_id[rep_database_id[i]] = (unsigned)i;
 
 	ostream *out = config.output_file.empty() ? &cout : new ofstream(config.output_file.c_str());
-	vector<char> seq;
-	string id;
+	vector<vector<char>> seqs(output_batch_size);
+	vector<string> ids(output_batch_size), lines(output_batch_size);
 	db->seek_direct();
-	Hsp hsp;
-	size_t n;
-	out->precision(3);
-
-	for (int i = 0; i < (int)db->ref_header.sequences; ++i) {
-		db->read_seq(id, seq);
-		const unsigned r = rep_block_id[centroid2[i]];
-
-		(*out) << blast_id(id) << '\t'
-			<< blast_id((*rep_ids)[r].c_str()) << '\t';		
-		
-		if ((int)i == centroid2[i])
-			(*out) << "100\t100\t100\t0" << endl;
-		else {
-			Masking::get().bit_to_hard_mask(seq.data(), seq.size(), n);
-			smith_waterman(sequence(seq), (*rep_seqs)[r], hsp);
-			(*out) << hsp.id_percent() << '\t'
-				<< hsp.query_cover_percent((unsigned)seq.size()) << '\t'
-				<< hsp.subject_cover_percent((unsigned)(*rep_seqs)[r].length()) << '\t'
-				<< score_matrix.bitscore(hsp.score) << endl;
-		}
+
+	for (size_t begin = 0; begin < seq_count; begin += output_batch_size) {
+		const size_t n = std::min(output_batch_size, seq_count - begin);
+		for (size_t i = 0; i < n; ++i)
+			db->read_seq(ids[i], seqs[i]);
+		Util::Parallel::scheduled_thread_pool_auto(config.threads_, n, align_to_representative, &centroid2, &rep_block_id, (const Sequence_set*)rep_seqs, (const String_set<0>*)rep_ids, begin, &ids, &seqs, &lines);
+		for (size_t i = 0; i < n; ++i)
+			(*out) << lines[i];
 	}
 
 	db->close();
@@ -38,6 +38,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "../util/io/consumer.h"
 #include "../util/parallel/thread_pool.h"
 #include "../util/system/system.h"
+#include "../util/system/buffer_pool.h"
+#include "work_queue.h"
 
 using namespace std;
 
@@ -48,16 +50,17 @@ void run_ref_chunk(DatabaseFile &db_file,
 	unsigned query_chunk,
 	pair<size_t, size_t> query_len_bounds,
 	char *query_buffer,
-	Consumer &master_out,
+	Consumer *master_out,
 	PtrVector<TempFile> &tmp_file,
 	const Parameters &params,
 	const Metadata &metadata,
-	const vector<unsigned> &block_to_database_id)
+	const vector<unsigned> &block_to_database_id,
+	WorkQueue *work_queue)
 {
 	log_stream << "Current RSS: " << getCurrentRSS() << ", Peak RSS: " << getPeakRSS() << endl;
 
 	task_timer timer;
-	if (config.masking == 1) {
+	if (config.masking == 1 && !db_file.has_masking()) {
 		timer.go("Masking reference");
 		size_t n = mask_seqs(*ref_seqs::data_, Masking::get());
 		timer.finish();
@@ -75,7 +78,10 @@ void run_ref_chunk(DatabaseFile &db_file,
 	ReferenceDictionary::get().init(safe_cast<unsigned>(ref_seqs::get().get_length()), block_to_database_id);
 
 	timer.go("Allocating buffers");
-	char *ref_buffer = SeedArray::alloc_buffer(ref_hst);
+	const bool query_loc32 = seed_loc32(query_seqs::data_->raw_len()), loc32 = query_loc32 && seed_loc32(ref_seqs::data_->raw_len());
+	char *ref_buffer = alloc_seed_buffer(ref_hst, loc32);
+	// the query buffer is sized for 32 bit locations whenever the query block allows it
+	char *wide_query_buffer = query_loc32 && !loc32 ? alloc_seed_buffer(query_hst, false) : 0;
 
 	timer.go("Initializing temporary storage");
 	Trace_pt_buffer::instance = new Trace_pt_buffer(query_seqs::data_->get_length() / align_mode.query_contexts,
@@ -84,19 +90,26 @@ void run_ref_chunk(DatabaseFile &db_file,
 	timer.finish();
 	
 	for (unsigned i = 0; i < shapes.count(); ++i)
-		search_shape(i, query_chunk, query_buffer, ref_buffer);
+		search_shape(i, query_chunk, wide_query_buffer ? wide_query_buffer : query_buffer, ref_buffer, loc32);
 
 	timer.go("Deallocating buffers");
-	delete[] ref_buffer;
+	BufferPool::get().free(ref_buffer);
+	BufferPool::get().free(wide_query_buffer);
+	if (config.release_buffers)
+		BufferPool::get().clear();
 
 	Consumer* out;
-	if (blocked_processing) {
+	if (work_queue) {
+		timer.go("Opening intermediate output file");
+		out = new OutputFile(work_queue->output_file(query_chunk, current_ref_block, true));
+	}
+	else if (blocked_processing) {
 		timer.go("Opening temporary output file");
 		tmp_file.push_back(new TempFile());
 		out = &tmp_file.back();
 	}
 	else
-		out = &master_out;
+		out = master_out;
 
 	timer.go("Computing alignments");
 	align_queries(*Trace_pt_buffer::instance, out, params, metadata);
@@ -105,25 +118,67 @@ void run_ref_chunk(DatabaseFile &db_file,
 	if (blocked_processing)
 		IntermediateRecord::finish_file(*out);
 
+	if (work_queue) {
+		timer.go("Closing intermediate output file");
+		static_cast<OutputFile*>(out)->close();
+		delete out;
+		OutputFile dict(work_queue->dict_file(query_chunk, current_ref_block, true));
+		ReferenceDictionary::get().save(dict);
+		dict.close();
+		ReferenceDictionary::get().clear();
+		work_queue->commit(query_chunk, current_ref_block);
+	}
+
 	timer.go("Deallocating reference");
 	delete ref_seqs::data_;
 	delete ref_ids::data_;
 	timer.finish();
 }
 
+void free_queries()
+{
+	delete query_seqs::data_;
+	delete query_ids::data_;
+	delete query_source_seqs::data_;
+	delete query_qual;
+}
+
+// Claims the first open work unit of a query chunk, before the queries are loaded, masked and indexed. On success the
+// database is positioned at the claimed reference block. Otherwise ref_block is set to the number of reference blocks.
+bool claim_first_unit(DatabaseFile &db_file, WorkQueue &work_queue, unsigned query_chunk, const vector<bool> *db_filter, unsigned &ref_block)
+{
+	db_file.rewind();
+	for (ref_block = 0; ; ++ref_block) {
+		const size_t pos = db_file.tell_seq();
+		const bool claimed = work_queue.claim(query_chunk, ref_block);
+		if (!db_file.skip_seqs((size_t)(config.chunk_size*1e9), db_filter)) {
+			if (claimed)
+				work_queue.release(query_chunk, ref_block);
+			return false;
+		}
+		if (claimed) {
+			db_file.seek_seq(pos);
+			return true;
+		}
+	}
+}
+
 void run_query_chunk(DatabaseFile &db_file,
 	Timer &total_timer,
 	unsigned query_chunk,
-	Consumer &master_out,
+	bool first_chunk,
+	unsigned first_ref_block,
+	Consumer *master_out,
 	OutputFile *unaligned_file,
 	OutputFile *aligned_file,
 	const Metadata &metadata,
-	const Options &options)
+	const Options &options,
+	WorkQueue *work_queue)
 {
-	const Parameters params(db_file.ref_header.sequences, db_file.ref_header.letters);
+	const Parameters params(db_file.total_sequences(), db_file.total_letters());
 
 	task_timer timer("Building query seed set");
-	if (query_chunk == 0)
+	if (first_chunk)
 		setup_search_cont();
 	if (config.algo == -1) {
 		query_seeds = new Seed_set(query_seqs::get(), SINGLE_INDEXED_SEED_SPACE_MAX_COVERAGE);
@@ -144,7 +199,7 @@ void run_query_chunk(DatabaseFile &db_file,
 	}
 	else
 		timer.finish();
-	if (query_chunk == 0)
+	if (first_chunk)
 		setup_search();
 	if (config.algo == Config::double_indexed && config.small_query) {
 		timer.go("Building query seed hash set");
@@ -158,32 +213,46 @@ void run_query_chunk(DatabaseFile &db_file,
 	timer.finish();
 
 	timer.go("Allocating buffers");
-	char *query_buffer = SeedArray::alloc_buffer(query_hst);
+	char *query_buffer = alloc_seed_buffer(query_hst, seed_loc32(query_seqs::data_->raw_len()));
 	PtrVector<TempFile> tmp_file;
 	query_aligned.clear();
 	query_aligned.insert(query_aligned.end(), query_ids::get().get_length(), false);
-	db_file.rewind();
+	if (!work_queue)
+		db_file.rewind();
 	vector<unsigned> block_to_database_id;
+	const vector<bool> *db_filter = options.db_filter ? options.db_filter : metadata.taxon_filter;
 	timer.finish();
 	
-	for (current_ref_block = 0; db_file.load_seqs(block_to_database_id,
-		(size_t)(config.chunk_size*1e9),
-		&ref_seqs::data_,
-		&ref_ids::data_,
-		true,
-		options.db_filter ? options.db_filter : metadata.taxon_filter); ++current_ref_block)
-		run_ref_chunk(db_file, total_timer, query_chunk, query_len_bounds, query_buffer, master_out, tmp_file, params, metadata, block_to_database_id);
+	for (current_ref_block = first_ref_block; ; ++current_ref_block) {
+		if (work_queue && current_ref_block > first_ref_block && !work_queue->claim(query_chunk, current_ref_block)) {
+			if (!db_file.skip_seqs((size_t)(config.chunk_size*1e9), db_filter))
+				break;
+			continue;
+		}
+		if (!db_file.load_seqs(block_to_database_id, (size_t)(config.chunk_size*1e9), &ref_seqs::data_, &ref_ids::data_, true, db_filter, db_file.has_masking())) {
+			if (work_queue)
+				work_queue->release(query_chunk, current_ref_block);
+			break;
+		}
+		if (work_queue) {
+			message_stream << "Processing work unit: query block " << query_chunk << ", reference block " << current_ref_block << "." << endl;
+			blocked_processing = true;
+		}
+		run_ref_chunk(db_file, total_timer, query_chunk, query_len_bounds, query_buffer, master_out, tmp_file, params, metadata, block_to_database_id, work_queue);
+	}
 
 	timer.go("Deallocating buffers");
-	delete[] query_buffer;
+	BufferPool::get().free(query_buffer);
+	if (blocked_processing && !work_queue)
+		BufferPool::get().clear();
 	delete query_seeds;
 	query_seeds = 0;
 
 	log_stream << "Current RSS: " << getCurrentRSS() << ", Peak RSS: " << getPeakRSS() << endl;
 
-	if (blocked_processing) {
+	if (blocked_processing && !work_queue) {
 		timer.go("Joining output blocks");
-		join_blocks(current_ref_block, master_out, tmp_file, params, metadata, db_file);
+		join_blocks(current_ref_block, *master_out, tmp_file, params, metadata, db_file);
 	}
 
 	if (unaligned_file) {
@@ -196,14 +265,76 @@ void run_query_chunk(DatabaseFile &db_file,
 	}
 
 	timer.go("Deallocating queries");
-	delete query_seqs::data_;
-	delete query_ids::data_;
-	delete query_source_seqs::data_;
-	delete query_qual;
+	free_queries();
 	if (*output_format != Output_format::daa)
 		ReferenceDictionary::get().clear();
 }
 
+void join_work_units(DatabaseFile &db_file, WorkQueue &work_queue, unsigned query_chunks, unsigned ref_blocks, const Metadata &metadata)
+{
+	task_timer timer("Opening the output file", true);
+	unique_ptr<Consumer> master_out(*output_format == Output_format::daa
+		? (Consumer*)new DAA_writer(config.output_file, config.daa_block_compression)
+		: new OutputFile(config.output_file, config.compression == 1));
+	TextInputFile query_file(config.query_file);
+	const Sequence_file_format *format_n = guess_format(query_file);
+	const Parameters params(db_file.total_sequences(), db_file.total_letters());
+	timer.finish();
+
+	for (unsigned query_chunk = 0; query_chunk < query_chunks; ++query_chunk) {
+		timer.go("Loading query sequences");
+		if (!load_seqs(query_file, *format_n, &query_seqs::data_, query_ids::data_, &query_source_seqs::data_,
+			config.store_query_quality ? &query_qual : nullptr,
+			(size_t)(config.chunk_size * 1e9), config.qfilt))
+			throw std::runtime_error("Query file does not match the work units in --parallel-tmpdir.");
+
+		if (query_chunk == 0 && *output_format != Output_format::daa)
+			output_format->print_header(*master_out, align_mode.mode, config.matrix.c_str(), score_matrix.gap_open(), score_matrix.gap_extend(), config.max_evalue, query_ids::get()[0].c_str(),
+				unsigned(align_mode.query_translated ? query_source_seqs::get()[0].length() : query_seqs::get()[0].length()));
+
+		if (config.masking == 1) {
+			timer.go("Masking queries");
+			mask_seqs(*query_seqs::data_, Masking::get());
+		}
+
+		timer.go("Loading reference dictionaries");
+		PtrVector<InputFile> files;
+		vector<uint32_t> subject_id_offset;
+		for (unsigned ref_block = 0; ref_block < ref_blocks; ++ref_block) {
+			subject_id_offset.push_back(ReferenceDictionary::get().seqs());
+			InputFile dict(work_queue.dict_file(query_chunk, ref_block));
+			ReferenceDictionary::get().load(dict);
+			dict.close();
+			files.push_back(new InputFile(work_queue.output_file(query_chunk, ref_block)));
+		}
+
+		timer.go("Joining output blocks");
+		current_ref_block = ref_blocks;
+		join_blocks(files, subject_id_offset, *master_out, params, metadata, db_file, false);
+
+		timer.go("Deallocating queries");
+		delete query_seqs::data_;
+		delete query_ids::data_;
+		delete query_source_seqs::data_;
+		delete query_qual;
+		query_qual = nullptr;
+		if (*output_format != Output_format::daa)
+			ReferenceDictionary::get().clear();
+		timer.finish();
+	}
+
+	timer.go("Closing the output file");
+	query_file.close();
+	if (*output_format == Output_format::daa)
+		static_cast<DAA_writer&>(*master_out).finish(db_file);
+	else
+		output_format->print_footer(*master_out);
+	master_out->finalize();
+
+	timer.go("Deleting work units");
+	work_queue.remove_units(query_chunks, ref_blocks);
+}
+
 void master_thread(DatabaseFile *db_file, Timer &total_timer, Metadata &metadata, const Options &options)
 {
 	task_timer timer("Opening the input file", true);
@@ -218,20 +349,38 @@ void master_thread(DatabaseFile *db_file, Timer &total_timer, Metadata &metadata
 
 	current_query_chunk = 0;
 
-	timer.go("Opening the output file");
-	Consumer *master_out(options.consumer ? options.consumer : new OutputFile(config.output_file, config.compression == 1));
-	if (*output_format == Output_format::daa)
-		init_daa(*static_cast<OutputFile*>(master_out));
+	unique_ptr<WorkQueue> work_queue;
+	Consumer *master_out = nullptr;
+	if ((config.multiprocessing || !config.checkpoint.empty()) && !options.self && !options.consumer)
+		work_queue.reset(new WorkQueue(config.multiprocessing ? config.parallel_tmpdir : config.checkpoint));
+	else {
+		timer.go("Opening the output file");
+		if (options.consumer)
+			master_out = options.consumer;
+		else if (*output_format == Output_format::daa)
+			master_out = new DAA_writer(config.output_file, config.daa_block_compression);
+		else
+			master_out = new OutputFile(config.output_file, config.compression == 1);
+	}
 	unique_ptr<OutputFile> unaligned_file, aligned_file;
 	if (!config.unaligned.empty())
 		unaligned_file = unique_ptr<OutputFile>(new OutputFile(config.unaligned));
 	if (!config.aligned_file.empty())
 		aligned_file = unique_ptr<OutputFile>(new OutputFile(config.aligned_file));
 	timer.finish();
+	if (work_queue)
+		work_queue->init(string(Const::version_string) + '\1' + std::to_string(config.command) + '\1' + config.query_file + '\1' + config.database + '\1' + std::to_string(config.chunk_size) + '\1' + config.search_signature, config.resume, config.multiprocessing);
 
 	size_t query_file_offset = 0;
+	const vector<bool> *db_filter = options.db_filter ? options.db_filter : metadata.taxon_filter;
+	bool first_chunk = true;
 
 	for (;; ++current_query_chunk) {
+		unsigned first_ref_block = 0;
+		const bool open_unit = !work_queue || claim_first_unit(*db_file, *work_queue, current_query_chunk, db_filter, first_ref_block);
+		if (!open_unit)
+			current_ref_block = first_ref_block;
+
 		task_timer timer("Loading query sequences", true);
 
 		if (options.self) {
@@ -248,13 +397,22 @@ void master_thread(DatabaseFile *db_file, Timer &total_timer, Metadata &metadata
 		else
 			if (!load_seqs(*query_file, *format_n, &query_seqs::data_, query_ids::data_, &query_source_seqs::data_,
 				config.store_query_quality ? &query_qual : nullptr,
-				(size_t)(config.chunk_size * 1e9), config.qfilt))
+				(size_t)(config.chunk_size * 1e9), config.qfilt)) {
+				if (work_queue && open_unit)
+					work_queue->release(current_query_chunk, first_ref_block);
 				break;
+			}
 
 		timer.finish();
+		if (!open_unit) {
+			// The queries are only read to find the end of the chunk.
+			free_queries();
+			message_stream << "Query block " << current_query_chunk << ": no open work units." << endl;
+			continue;
+		}
 		query_seqs::data_->print_stats();
 
-		if (current_query_chunk == 0 && *output_format != Output_format::daa)
+		if (current_query_chunk == 0 && master_out && *output_format != Output_format::daa)
 			output_format->print_header(*master_out, align_mode.mode, config.matrix.c_str(), score_matrix.gap_open(), score_matrix.gap_extend(), config.max_evalue, query_ids::get()[0].c_str(),
 				unsigned(align_mode.query_translated ? query_source_seqs::get()[0].length() : query_seqs::get()[0].length()));
 
@@ -264,21 +422,35 @@ void master_thread(DatabaseFile *db_file, Timer &total_timer, Metadata &metadata
 			timer.finish();
 		}
 
-		run_query_chunk(*db_file, total_timer, current_query_chunk, *master_out, unaligned_file.get(), aligned_file.get(), metadata, options);
+		run_query_chunk(*db_file, total_timer, current_query_chunk, first_chunk, first_ref_block, master_out, unaligned_file.get(), aligned_file.get(), metadata, options, work_queue.get());
+		first_chunk = false;
 	}
 
+	timer.go("Deallocating buffers");
+	BufferPool::get().clear();
+	timer.finish();
+
 	if (query_file) {
 		timer.go("Closing the input file");
 		query_file->close();
 	}
 
-	timer.go("Closing the output file");
-	if (*output_format == Output_format::daa)
-		finish_daa(*static_cast<OutputFile*>(master_out), *db_file);
-	else
-		output_format->print_footer(*master_out);
-	master_out->finalize();
-	if (!options.consumer) delete master_out;
+	if (work_queue) {
+		timer.finish();
+		if (work_queue->complete(current_query_chunk, current_ref_block) && work_queue->claim_join())
+			join_work_units(*db_file, *work_queue, current_query_chunk, current_ref_block, metadata);
+		else
+			message_stream << "Remaining work units are processed by other processes." << endl;
+	}
+	else {
+		timer.go("Closing the output file");
+		if (*output_format == Output_format::daa)
+			static_cast<DAA_writer*>(master_out)->finish(*db_file);
+		else
+			output_format->print_footer(*master_out);
+		master_out->finalize();
+		if (!options.consumer) delete master_out;
+	}
 	if (unaligned_file.get())
 		unaligned_file->close();
 	if (aligned_file.get())
@@ -327,8 +499,10 @@ void run(const Options &options)
 	verbose_stream << "Sequences = " << db_file->ref_header.sequences << endl;
 	verbose_stream << "Letters = " << db_file->ref_header.letters << endl;
 	verbose_stream << "Block size = " << (size_t)(config.chunk_size * 1e9) << endl;
-	Config::set_option(config.db_size, (uint64_t)db_file->ref_header.letters);
-	score_matrix.set_db_letters(db_file->ref_header.letters);
+	if (db_file->header2.db_letters != 0)
+		verbose_stream << "Shard of a database with " << db_file->total_sequences() << " sequences, " << db_file->total_letters() << " letters" << endl;
+	Config::set_option(config.db_size, db_file->total_letters());
+	score_matrix.set_db_letters(db_file->total_letters());
 
 	set_max_open_files(config.query_bins * config.threads_ + unsigned(db_file->ref_header.letters / (size_t)(config.chunk_size * 1e9)) + 16);
 
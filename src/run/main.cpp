@@ -33,6 +33,8 @@ using std::endl;
 void model_seqs();
 void opt();
 void run_masker();
+void test_masking();
+void test_bloom_filter();
 void fastq2fasta();
 void view();
 void db_info();
@@ -49,6 +51,8 @@ void translate();
 void filter_blasttab();
 void show_cbs();
 void simulate_seqs();
+void mcl();
+void merge_shards();
 void benchmark();
 
 extern "C" {
@@ -70,7 +74,10 @@ extern "C" int main(int ac, const char* av[])
 			cout << Const::program_name << " version " << Const::version_string << endl;
 			break;
 		case Config::makedb:
-			make_db();
+			if (config.append)
+				append_db();
+			else
+				make_db();
 			break;
 		case Config::blastp:
 		case Config::blastx:
@@ -94,6 +101,12 @@ extern "C" int main(int ac, const char* av[])
 		case Config::mask:
 			run_masker();
 			break;
+		case Config::test_masking:
+			test_masking();
+			break;
+		case Config::test_bloom_filter:
+			test_bloom_filter();
+			break;
 		case Config::fastq2fasta:
 			fastq2fasta();
 			break;
@@ -130,6 +143,15 @@ extern "C" int main(int ac, const char* av[])
 		case Config::simulate_seqs:
 			simulate_seqs();
 			break;
+		case Config::mcl:
+			mcl();
+			break;
+		case Config::dbsplit:
+			split_db();
+			break;
+		case Config::merge_shards:
+			merge_shards();
+			break;
 		case Config::benchmark:
 			benchmark();
 			break;
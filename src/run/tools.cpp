@@ -23,6 +23,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <iostream>
 #include <sstream>
 #include <memory>
+#include <random>
+#include <algorithm>
 #include "tools.h"
 #include "../basic/config.h"
 #include "../data/sequence_set.h"
@@ -33,6 +35,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "../basic/masking.h"
 #include "../dp/dp.h"
 #include "../basic/packed_transcript.h"
+#include "../util/data_structures/bloom_filter.h"
 
 using namespace std;
 
@@ -142,6 +145,93 @@ void run_masker()
 	}
 }
 
+// Checks the vectorised tantan masks against lib/tantan, on the query file or on a generated set of sequences with
+// tandem repeats.
+void test_masking()
+{
+	vector<vector<Letter> > seqs;
+	if (!config.query_file.empty()) {
+		TextInputFile f(config.query_file);
+		vector<Letter> seq;
+		vector<char> id;
+		const FASTA_format format;
+		while (format.get_seq(id, seq, f))
+			seqs.push_back(seq);
+		f.close();
+	}
+	else {
+		std::mt19937 rng(0);
+		for (size_t i = 0; i < 2000; ++i) {
+			vector<Letter> seq;
+			const size_t len = 1 + rng() % 1000;
+			while (seq.size() < len) {
+				if (rng() % 4 == 0) {
+					const size_t period = 1 + rng() % 60, copies = 2 + rng() % 10, begin = seq.size();
+					for (size_t j = 0; j < period; ++j)
+						seq.push_back((Letter)(rng() % 20));
+					for (size_t j = period; j < period * copies; ++j)
+						seq.push_back(rng() % 8 == 0 ? (Letter)(rng() % 20) : seq[begin + j - period]);
+				}
+				else
+					seq.push_back(rng() % 50 == 0 ? value_traits.mask_char : (Letter)(rng() % 20));
+			}
+			seq.resize(len);
+			seqs.push_back(seq);
+		}
+	}
+
+	size_t letters = 0, masked = 0, diff = 0;
+	vector<Letter> seq2;
+	for (vector<Letter> &seq : seqs) {
+		seq2 = seq;
+		Masking::get()(seq.data(), seq.size());
+		Masking::get().mask_reference(seq2.data(), seq2.size());
+		for (size_t i = 0; i < seq.size(); ++i) {
+			if (seq[i] != seq2[i])
+				++diff;
+			if (seq2[i] == value_traits.mask_char)
+				++masked;
+		}
+		letters += seq.size();
+	}
+	cout << "#Sequences: " << seqs.size() << ", #Letters: " << letters << ", #Masked: " << masked << ", #Differences: " << diff << endl;
+	if (diff > 0)
+		throw std::runtime_error("Masks differ from lib/tantan.");
+}
+
+// Checks that Blocked_bloom_filter has no false negatives and a false positive rate close to the expected one, for random
+// keys and for consecutive keys like the packed seeds of a query set.
+void test_bloom_filter()
+{
+	// Expected rate at 16 bits per key is about 0.1%.
+	const size_t keys = 1000000, bits_per_key = 16;
+	const double max_rate = 0.003;
+	std::mt19937_64 rng(0);
+	for (int consecutive = 0; consecutive < 2; ++consecutive) {
+		vector<uint64_t> v(2 * keys);
+		for (size_t i = 0; i < v.size(); ++i)
+			v[i] = consecutive ? i * 7 : rng();
+		std::shuffle(v.begin(), v.end(), rng);
+		Blocked_bloom_filter filter(keys, bits_per_key);
+		for (size_t i = 0; i < keys; ++i)
+			filter.insert(v[i]);
+		size_t false_neg = 0, false_pos = 0;
+		for (size_t i = 0; i < keys; ++i) {
+			if (!filter.contains(v[i]))
+				++false_neg;
+			if (filter.contains(v[keys + i]))
+				++false_pos;
+		}
+		const double rate = (double)false_pos / keys;
+		cout << (consecutive ? "Consecutive" : "Random") << " keys: #Keys: " << keys << ", Size: " << filter.size() << ", Load: " << filter.load()
+			<< ", #False negatives: " << false_neg << ", False positive rate: " << rate << endl;
+		if (false_neg > 0)
+			throw std::runtime_error("Bloom filter has false negatives.");
+		if (rate > max_rate)
+			throw std::runtime_error("Bloom filter false positive rate exceeds " + std::to_string(max_rate) + '.');
+	}
+}
+
 void fastq2fasta()
 {
 	unique_ptr<TextInputFile> f(new TextInputFile(config.query_file));
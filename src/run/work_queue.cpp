@@ -0,0 +1,265 @@
+/****
+DIAMOND protein aligner
+Copyright (C) 2013-2019 Benjamin Buchfink <buchfink@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+****/
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdexcept>
+#include <stdlib.h>
+#include <chrono>
+#ifdef _MSC_VER
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "work_queue.h"
+#include "../util/util.h"
+#include "../util/system/system.h"
+#include "../util/io/input_file.h"
+#include "../util/io/output_file.h"
+#include "../util/log_stream.h"
+
+using std::string;
+using std::runtime_error;
+
+namespace Workflow { namespace Search {
+
+WorkQueue::WorkQueue(const string &dir):
+	dir_(dir.empty() ? string() : dir + dir_separator),
+	owner_(host_name() + ':' + std::to_string(process_id())),
+	shared_(true),
+	stop_(false)
+{
+	if (!dir.empty() && !exists(dir))
+		throw runtime_error("Directory for parallel processing does not exist: " + dir);
+	heartbeat_ = std::thread(&WorkQueue::heartbeat, this);
+}
+
+WorkQueue::~WorkQueue()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		stop_ = true;
+	}
+	cv_.notify_all();
+	heartbeat_.join();
+}
+
+void WorkQueue::heartbeat()
+{
+	std::unique_lock<std::mutex> lock(mtx_);
+	while (!cv_.wait_for(lock, std::chrono::seconds(HEARTBEAT_SECONDS), [this]() { return stop_; }))
+		for (std::set<string>::const_iterator i = held_.begin(); i != held_.end(); ++i)
+			touch(*i);
+}
+
+// Records the parameters that define the work units in the directory, or checks them against the ones recorded.
+// Unless the search is resumed, a recorded search may only be shared by the processes of a --multiprocessing run.
+// Resuming releases the locks of units that were claimed but not finished by processes that are gone, and leaves the
+// units that running processes are working on to them.
+void WorkQueue::init(const string &signature, bool resume, bool shared)
+{
+	shared_ = shared;
+	signature_ = signature;
+	const string file = dir_ + "diamond-search";
+	if (exists(file)) {
+		if (recorded_signature() != signature)
+			throw runtime_error("The directory " + dir_ + " holds the work units of a different search.");
+		if (!resume && !shared)
+			throw runtime_error("The directory " + dir_ + " holds an unfinished search. Use --resume to continue it.");
+	}
+	else {
+		OutputFile f(file + ".tmp");
+		f << signature;
+		f.close();
+		if (rename((file + ".tmp").c_str(), file.c_str()) != 0)
+			throw runtime_error("Error renaming file " + file + ".tmp");
+	}
+	if (!resume)
+		return;
+
+	unsigned finished_units = 0, released = 0, running = 0;
+	for (unsigned i = 0; exists(file_name(i, 0, ".lock")); ++i)
+		for (unsigned j = 0; exists(file_name(i, j, ".lock")); ++j)
+			if (finished(i, j))
+				++finished_units;
+			else if (lock_alive(file_name(i, j, ".lock")))
+				++running;
+			else {
+				release(i, j);
+				++released;
+			}
+	const string join_lock = dir_ + "diamond-join.lock";
+	if (exists(join_lock)) {
+		if (lock_alive(join_lock))
+			throw runtime_error("The output in " + dir_ + " is being joined by a running process.");
+		remove_file(join_lock);
+	}
+	message_stream << "Resuming search: " << finished_units << " work units finished, " << released << " unfinished units released, "
+		<< running << " units in progress by running processes." << std::endl;
+}
+
+bool WorkQueue::lock_alive(const string &file_name) const
+{
+	const double age = file_age(file_name);
+	if (age < 0 || age > STALE_SECONDS)
+		return false;
+	string owner;
+	try {
+		InputFile f(file_name);
+		f.read_until(owner, '\n');
+		f.close();
+	}
+	catch (std::exception&) {
+		return true;
+	}
+	const size_t i = owner.rfind(':');
+	if (i == string::npos || owner.substr(0, i) != host_name())
+		return true;
+	const int pid = atoi(owner.c_str() + i + 1);
+	return pid == process_id() || process_alive(pid);
+}
+
+string WorkQueue::recorded_signature() const
+{
+	const string file = dir_ + "diamond-search";
+	if (!exists(file))
+		return string();
+	InputFile f(file);
+	string s;
+	f >> s;
+	f.close();
+	return s;
+}
+
+// Deletes the joined units and the files of the search. In a shared directory the search record goes first: other
+// processes may still be scanning for unclaimed units, and claim() refuses the units of a search that is no longer
+// recorded, so that the removed locks are not taken up again.
+void WorkQueue::remove_units(unsigned query_chunks, unsigned ref_blocks)
+{
+	if (shared_)
+		remove_file(dir_ + "diamond-search");
+	for (unsigned i = 0; i < query_chunks; ++i)
+		for (unsigned j = 0; j < ref_blocks; ++j) {
+			remove_file(output_file(i, j));
+			remove_file(dict_file(i, j));
+			remove_file(file_name(i, j, ".lock"));
+		}
+	release_lock(dir_ + "diamond-join.lock");
+	if (!shared_)
+		remove_file(dir_ + "diamond-search");
+}
+
+void WorkQueue::remove_file(const string &file_name) const
+{
+	if (remove(file_name.c_str()) != 0)
+		throw runtime_error("Error deleting file " + file_name);
+}
+
+string WorkQueue::file_name(unsigned query_chunk, unsigned ref_block, const char *ext) const
+{
+	return dir_ + "diamond-q" + std::to_string(query_chunk) + "-b" + std::to_string(ref_block) + ext;
+}
+
+// Creates the lock file unless it exists, writes the owner into it and starts its heartbeat.
+bool WorkQueue::create_lock(const string &file_name)
+{
+	const string owner = owner_ + '\n';
+#ifdef _MSC_VER
+	const int fd = _open(file_name.c_str(), _O_CREAT | _O_EXCL | _O_WRONLY, _S_IREAD | _S_IWRITE);
+	if (fd < 0) {
+		if (errno == EEXIST)
+			return false;
+		throw runtime_error("Error creating file " + file_name);
+	}
+	const bool ok = _write(fd, owner.data(), (unsigned)owner.length()) == (int)owner.length();
+	_close(fd);
+#else
+	const int fd = open(file_name.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+	if (fd < 0) {
+		if (errno == EEXIST)
+			return false;
+		perror(0);
+		throw runtime_error("Error creating file " + file_name);
+	}
+	const bool ok = write(fd, owner.data(), owner.length()) == (ssize_t)owner.length();
+	close(fd);
+#endif
+	if (!ok)
+		throw runtime_error("Error writing file " + file_name);
+	std::lock_guard<std::mutex> lock(mtx_);
+	held_.insert(file_name);
+	return true;
+}
+
+void WorkQueue::release_lock(const string &file_name)
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx_);
+		held_.erase(file_name);
+	}
+	remove_file(file_name);
+}
+
+bool WorkQueue::claim(unsigned query_chunk, unsigned ref_block)
+{
+	if (!create_lock(file_name(query_chunk, ref_block, ".lock")))
+		return false;
+	if (shared_ && recorded_signature() != signature_) {
+		release(query_chunk, ref_block);
+		return false;
+	}
+	return true;
+}
+
+void WorkQueue::release(unsigned query_chunk, unsigned ref_block)
+{
+	release_lock(file_name(query_chunk, ref_block, ".lock"));
+}
+
+void WorkQueue::commit(unsigned query_chunk, unsigned ref_block)
+{
+	if (rename(dict_file(query_chunk, ref_block, true).c_str(), dict_file(query_chunk, ref_block).c_str()) != 0
+		|| rename(output_file(query_chunk, ref_block, true).c_str(), output_file(query_chunk, ref_block).c_str()) != 0)
+		throw runtime_error("Error renaming file " + output_file(query_chunk, ref_block, true));
+	std::lock_guard<std::mutex> lock(mtx_);
+	held_.erase(file_name(query_chunk, ref_block, ".lock"));
+}
+
+bool WorkQueue::finished(unsigned query_chunk, unsigned ref_block) const
+{
+	return exists(output_file(query_chunk, ref_block));
+}
+
+bool WorkQueue::complete(unsigned query_chunks, unsigned ref_blocks) const
+{
+	for (unsigned i = 0; i < query_chunks; ++i)
+		for (unsigned j = 0; j < ref_blocks; ++j)
+			if (!finished(i, j))
+				return false;
+	return true;
+}
+
+bool WorkQueue::claim_join()
+{
+	return create_lock(dir_ + "diamond-join.lock");
+}
+
+}}
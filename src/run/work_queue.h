@@ -0,0 +1,85 @@
+/****
+DIAMOND protein aligner
+Copyright (C) 2013-2019 Benjamin Buchfink <buchfink@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+****/
+
+#ifndef WORK_QUEUE_H_
+#define WORK_QUEUE_H_
+
+#include <string>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+namespace Workflow { namespace Search {
+
+// Queue of (query chunk, reference block) work units shared by several processes through a directory.
+// A unit is claimed by exclusively creating its lock file and is finished once its output file has been
+// renamed into place. The finished units remain in the directory until the output has been joined, so that
+// an interrupted search can be resumed. The process that joins the output removes all files of the search.
+// A lock file holds its owner as host:pid. While a process works on a unit or the join, a heartbeat thread refreshes
+// the modification time of its lock, so that --resume can tell the locks of running processes from stale ones.
+struct WorkQueue
+{
+
+	enum { HEARTBEAT_SECONDS = 60, STALE_SECONDS = 600 };
+
+	WorkQueue(const std::string &dir);
+	~WorkQueue();
+	void init(const std::string &signature, bool resume, bool shared);
+	void remove_units(unsigned query_chunks, unsigned ref_blocks);
+	bool claim(unsigned query_chunk, unsigned ref_block);
+	void release(unsigned query_chunk, unsigned ref_block);
+	void commit(unsigned query_chunk, unsigned ref_block);
+	bool finished(unsigned query_chunk, unsigned ref_block) const;
+	bool complete(unsigned query_chunks, unsigned ref_blocks) const;
+	bool claim_join();
+
+	std::string output_file(unsigned query_chunk, unsigned ref_block, bool tmp = false) const
+	{
+		return file_name(query_chunk, ref_block, tmp ? ".out.tmp" : ".out");
+	}
+
+	std::string dict_file(unsigned query_chunk, unsigned ref_block, bool tmp = false) const
+	{
+		return file_name(query_chunk, ref_block, tmp ? ".dict.tmp" : ".dict");
+	}
+
+private:
+
+	std::string file_name(unsigned query_chunk, unsigned ref_block, const char *ext) const;
+	std::string recorded_signature() const;
+	void remove_file(const std::string &file_name) const;
+	bool create_lock(const std::string &file_name);
+	void release_lock(const std::string &file_name);
+	// True if the owner of the lock is still running: its heartbeat is recent and, for a lock of this host, its process exists.
+	bool lock_alive(const std::string &file_name) const;
+	void heartbeat();
+
+	const std::string dir_, owner_;
+	std::string signature_;
+	bool shared_, stop_;
+	std::set<std::string> held_;
+	std::mutex mtx_;
+	std::condition_variable cv_;
+	std::thread heartbeat_;
+
+};
+
+}}
+
+#endif
@@ -55,6 +55,11 @@ inline int stage2_ungapped(const Letter *query, const Letter *subject, unsigned
 	return xdrop_ungapped(query, subject, shapes[sid].length_, delta, len);
 }
 
+inline void stage2_ungapped(const Letter *const *query, const Letter *const *subject, unsigned sid, size_t n, int *score, unsigned *delta, unsigned *len)
+{
+	xdrop_ungapped(query, subject, shapes[sid].length_, n, score, delta, len);
+}
+
 #ifdef __SSE2__
 
 struct Byte_finger_print_48
@@ -118,7 +123,8 @@ struct Seed_filter
 		out(out),
 		sid(sid)
 	{}
-	void run(const Packed_loc *q, size_t nq, const Packed_loc *s, size_t ns);
+	template<typename _pos>
+	void run(const _pos *q, size_t nq, const _pos *s, size_t ns);
 	void tiled_search(vector<Finger_print>::const_iterator q,
 		vector<Finger_print>::const_iterator q_end,
 		vector<Finger_print>::const_iterator s,
@@ -133,11 +139,15 @@ struct Seed_filter
 	const unsigned sid;
 };
 
-void stage2_search(const Packed_loc *q,
-	const Packed_loc *s,
+template<typename _pos>
+void stage2_search(const _pos *q,
+	const _pos *s,
 	const vector<Stage1_hit> &hits,
 	Statistics &stats,
 	Trace_pt_buffer::Iterator &out,
 	const unsigned sid);
 
+// Verifies the seed hits that stage 2 of the calling thread holds back for batching.
+void stage2_flush(Statistics &stats, Trace_pt_buffer::Iterator &out);
+
 #endif /* ALIGN_RANGE_H_ */
@@ -21,6 +21,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <vector>
 #include <limits>
+#include <unordered_map>
 #include "trace_pt_buffer.h"
 #include "../dp/smith_waterman.h"
 #include "../basic/sequence.h"
@@ -31,6 +32,49 @@ using std::vector;
 
 #ifdef __SSE2__
 
+// Seed hits that score below the hit threshold and await gapped verification. Each SIMD channel aligns its own
+// query window, so that the hits of all query offsets and seed partitions of a search thread can share a kernel
+// call. The hits are grouped by the length of their query window, which bounds the band of the alignment, and each
+// group is verified once it fills all channels.
+struct Stage2_batch
+{
+
+	struct Group;
+
+	Stage2_batch():
+		pending_(0)
+	{}
+	Group& get(Loc q_pos, sequence &query, unsigned &left);
+	void push(Group &group, Loc q_pos, const sequence &query, unsigned left, Loc subject, Statistics &stats, Trace_pt_buffer::Iterator &out);
+	void check(Statistics &stats, Trace_pt_buffer::Iterator &out);
+	void flush(Statistics &stats, Trace_pt_buffer::Iterator &out);
+
+	struct Hit
+	{
+		Loc q_pos, s_pos;
+		unsigned left;
+	};
+
+	struct Group
+	{
+		vector<Hit> hits;
+		vector<sequence> queries;
+	};
+
+private:
+
+	enum { MAX_PENDING = 4096 };
+
+	void verify(Group &group, Statistics &stats, Trace_pt_buffer::Iterator &out);
+
+	std::unordered_map<uint32_t, Group> groups_;
+	vector<sequence> subjects_;
+	size_t pending_;
+
+};
+
+extern thread_local Stage2_batch stage2_batch;
+
 struct hit_filter
 {
 
@@ -41,33 +85,25 @@ struct hit_filter
 		seed_offset_ (std::numeric_limits<unsigned>::max()),
 		stats_ (stats),
 		q_pos_ (q_pos),
-		out_ (out)
-	{ subjects_.clear(); }
+		out_ (out),
+		group_ (0)
+	{ }
 
 	void push(Loc subject, int score)
 	{
 		if(score >= config.min_hit_raw_score)
 			push_hit(subject);
-		else
-			subjects_.push_back(ref_seqs::data_->fixed_window_infix(subject+ config.seed_anchor));
+		else {
+			if (group_ == 0)
+				group_ = &stage2_batch.get(q_pos_, query_, left_);
+			stage2_batch.push(*group_, q_pos_, query_, left_, subject, stats_, out_);
+		}
 	}
 
 	void finish()
 	{
-		if(subjects_.size() == 0)
-			return;
-		unsigned left;
-		sequence query (query_seqs::data_->window_infix(q_pos_ + config.seed_anchor, left));
-		smith_waterman(query,
-				subjects_,
-				config.hit_band,
-				left,
-				score_matrix.gap_open() + score_matrix.gap_extend(),
-				score_matrix.gap_extend(),
-				config.min_hit_raw_score,
-				*this,
-				uint8_t(),
-				stats_);
+		if (group_ != 0)
+			stage2_batch.check(stats_, out_);
 	}
 
 	void push_hit(Loc subject)
@@ -82,16 +118,15 @@ struct hit_filter
 		stats_.inc(Statistics::TENTATIVE_MATCHES4);
 	}
 
-	void operator()(int i, const sequence &seq, int score)
-	{ push_hit(ref_seqs::data_->position(seq.data()+config.window- config.seed_anchor)); stats_.inc(Statistics::GAPPED_HITS); }
-
 private:
 
 	unsigned q_num_, seed_offset_;
 	Statistics  &stats_;
 	Loc q_pos_;
 	Trace_pt_buffer::Iterator &out_;
-	static thread_local vector<sequence> subjects_;
+	Stage2_batch::Group *group_;
+	sequence query_;
+	unsigned left_;
 
 };
 
@@ -21,7 +21,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <stddef.h>
 
-void search_shape(unsigned sid, unsigned query_block, char *query_buffer, char *ref_buffer);
+void search_shape(unsigned sid, unsigned query_block, char *query_buffer, char *ref_buffer, bool loc32);
 bool use_single_indexed(double coverage, size_t query_letters, size_t ref_letters);
 
 extern const double SINGLE_INDEXED_SEED_SPACE_MAX_COVERAGE;
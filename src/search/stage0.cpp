@@ -31,43 +31,47 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 using namespace std;
 
+template<typename _pos>
 void seed_join_worker(
-	SeedArray *query_seeds,
-	SeedArray *ref_seeds,
+	SeedArray<_pos> *query_seeds,
+	SeedArray<_pos> *ref_seeds,
 	Atomic<unsigned> *seedp,
 	const SeedPartitionRange *seedp_range,
-	DoubleArray<SeedArray::_pos> *query_seed_hits,
-	DoubleArray<SeedArray::_pos> *ref_seeds_hits)
+	DoubleArray<_pos> *query_seed_hits,
+	DoubleArray<_pos> *ref_seeds_hits)
 {
 	unsigned p;
 	const unsigned bits = (unsigned)ceil(shapes[0].weight_ * Reduction::reduction.bit_size_exact()) - Const::seedp_bits;
 	while ((p = (*seedp)++) < seedp_range->end()) {
-		std::pair<DoubleArray<SeedArray::_pos>, DoubleArray<SeedArray::_pos>> join = hash_join(
-			Relation<SeedArray::Entry>(query_seeds->begin(p), query_seeds->size(p)),
-			Relation<SeedArray::Entry>(ref_seeds->begin(p), ref_seeds->size(p)),
+		std::pair<DoubleArray<_pos>, DoubleArray<_pos>> join = hash_join(
+			Relation<typename SeedArray<_pos>::Entry>(query_seeds->begin(p), query_seeds->size(p)),
+			Relation<typename SeedArray<_pos>::Entry>(ref_seeds->begin(p), ref_seeds->size(p)),
 			bits);
 		query_seed_hits[p] = join.first;
 		ref_seeds_hits[p] = join.second;
 	}
 }
 
-void search_worker(Atomic<unsigned> *seedp, const SeedPartitionRange *seedp_range, unsigned shape, size_t thread_id, DoubleArray<SeedArray::_pos> *query_seed_hits, DoubleArray<SeedArray::_pos> *ref_seed_hits)
+template<typename _pos>
+void search_worker(Atomic<unsigned> *seedp, const SeedPartitionRange *seedp_range, unsigned shape, size_t thread_id, DoubleArray<_pos> *query_seed_hits, DoubleArray<_pos> *ref_seed_hits)
 {
 	Trace_pt_buffer::Iterator* out = new Trace_pt_buffer::Iterator(*Trace_pt_buffer::instance, thread_id);
 	Statistics stats;
 	Seed_filter seed_filter(stats, *out, shape);
 	unsigned p;
 	while ((p = (*seedp)++) < seedp_range->end())
-		for (auto it = JoinIterator<SeedArray::_pos>(query_seed_hits[p].begin(), ref_seed_hits[p].begin()); it; ++it)
+		for (auto it = JoinIterator<_pos>(query_seed_hits[p].begin(), ref_seed_hits[p].begin()); it; ++it)
 			seed_filter.run(it.r->begin(), it.r->size(), it.s->begin(), it.s->size());
+	stage2_flush(stats, *out);
 	delete out;
 	statistics += stats;
 }
 
+template<typename _pos>
 void search_shape(unsigned sid, unsigned query_block, char *query_buffer, char *ref_buffer)
 {
 	::partition<unsigned> p(Const::seedp, config.lowmem);
-	DoubleArray<SeedArray::_pos> query_seed_hits[Const::seedp], ref_seed_hits[Const::seedp];
+	DoubleArray<_pos> query_seed_hits[Const::seedp], ref_seed_hits[Const::seedp];
 
 	for (unsigned chunk = 0; chunk < p.parts; ++chunk) {
 		message_stream << "Processing query block " << query_block << ", reference block " << current_ref_block << ", shape " << sid << ", index chunk " << chunk << '.' << endl;
@@ -75,22 +79,22 @@ void search_shape(unsigned sid, unsigned query_block, char *query_buffer, char *
 		current_range = range;
 
 		task_timer timer("Building reference seed array", true);
-		SeedArray *ref_idx;
+		SeedArray<_pos> *ref_idx;
 		if (config.algo == Config::query_indexed)
-			ref_idx = new SeedArray(*ref_seqs::data_, sid, ref_hst.get(sid), range, ref_hst.partition(), ref_buffer, query_seeds);
+			ref_idx = new SeedArray<_pos>(*ref_seqs::data_, sid, ref_hst.get(sid), range, ref_hst.partition(), ref_buffer, query_seeds);
 		else if (query_seeds_hashed != 0)
-			ref_idx = new SeedArray(*ref_seqs::data_, sid, ref_hst.get(sid), range, ref_hst.partition(), ref_buffer, query_seeds_hashed);
+			ref_idx = new SeedArray<_pos>(*ref_seqs::data_, sid, ref_hst.get(sid), range, ref_hst.partition(), ref_buffer, query_seeds_hashed);
 		else
-			ref_idx = new SeedArray(*ref_seqs::data_, sid, ref_hst.get(sid), range, ref_hst.partition(), ref_buffer, &no_filter);
+			ref_idx = new SeedArray<_pos>(*ref_seqs::data_, sid, ref_hst.get(sid), range, ref_hst.partition(), ref_buffer, &no_filter);
 
 		timer.go("Building query seed array");
-		SeedArray *query_idx = new SeedArray(*query_seqs::data_, sid, query_hst.get(sid), range, query_hst.partition(), query_buffer, &no_filter);
+		SeedArray<_pos> *query_idx = new SeedArray<_pos>(*query_seqs::data_, sid, query_hst.get(sid), range, query_hst.partition(), query_buffer, &no_filter);
 
 		timer.go("Computing hash join");
 		Atomic<unsigned> seedp(range.begin());
 		vector<thread> threads;
 		for (size_t i = 0; i < config.threads_; ++i)
-			threads.emplace_back(seed_join_worker, query_idx, ref_idx, &seedp, &range, query_seed_hits, ref_seed_hits);
+			threads.emplace_back(seed_join_worker<_pos>, query_idx, ref_idx, &seedp, &range, query_seed_hits, ref_seed_hits);
 		for (auto &t : threads)
 			t.join();
 
@@ -101,11 +105,19 @@ void search_shape(unsigned sid, unsigned query_block, char *query_buffer, char *
 		seedp = range.begin();
 		threads.clear();
 		for (size_t i = 0; i < config.threads_; ++i)
-			threads.emplace_back(search_worker, &seedp, &range, sid, i, query_seed_hits, ref_seed_hits);
+			threads.emplace_back(search_worker<_pos>, &seedp, &range, sid, i, query_seed_hits, ref_seed_hits);
 		for (auto &t : threads)
 			t.join();
 
 		delete ref_idx;
 		delete query_idx;
 	}
+}
+
+void search_shape(unsigned sid, unsigned query_block, char *query_buffer, char *ref_buffer, bool loc32)
+{
+	if (loc32)
+		search_shape<uint32_t>(sid, query_block, query_buffer, ref_buffer);
+	else
+		search_shape<Packed_loc>(sid, query_block, query_buffer, ref_buffer);
 }
\ No newline at end of file
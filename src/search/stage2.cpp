@@ -30,26 +30,126 @@ template<typename _score> thread_local vector<score_vector<_score>> DP_matrix<_s
 
 #ifdef __SSE2__
 
-thread_local vector<sequence> hit_filter::subjects_;
+thread_local Stage2_batch stage2_batch;
 
+Stage2_batch::Group& Stage2_batch::get(Loc q_pos, sequence &query, unsigned &left)
+{
+	query = query_seqs::data_->window_infix(q_pos + config.seed_anchor, left);
+	return groups_[(uint32_t)query.length()];
+}
+
+void Stage2_batch::push(Group &group, Loc q_pos, const sequence &query, unsigned left, Loc subject, Statistics &stats, Trace_pt_buffer::Iterator &out)
+{
+	group.hits.push_back({ q_pos, subject, left });
+	group.queries.push_back(query);
+	++pending_;
+	if (group.hits.size() == score_traits<uint8_t>::channels)
+		verify(group, stats, out);
+}
+
+void Stage2_batch::check(Statistics &stats, Trace_pt_buffer::Iterator &out)
+{
+	if (pending_ >= MAX_PENDING)
+		flush(stats, out);
+}
+
+void Stage2_batch::flush(Statistics &stats, Trace_pt_buffer::Iterator &out)
+{
+	for (std::unordered_map<uint32_t, Group>::iterator i = groups_.begin(); i != groups_.end(); ++i)
+		if (!i->second.hits.empty())
+			verify(i->second, stats, out);
+}
+
+struct Stage2_verified
+{
+	void operator()(int i, const sequence &seq, int score)
+	{
+		const Stage2_batch::Hit &h = hits[i];
+		const std::pair<size_t, size_t> l(query_seqs::data_->local_position(h.q_pos));
+		out.push(hit((unsigned)l.first, h.s_pos, (unsigned)l.second));
+		stats.inc(Statistics::GAPPED_HITS);
+		stats.inc(Statistics::TENTATIVE_MATCHES4);
+	}
+	const vector<Stage2_batch::Hit> &hits;
+	Statistics &stats;
+	Trace_pt_buffer::Iterator &out;
+};
+
+// The query windows of a group have the same length but may be anchored at different offsets. The subject windows
+// are extended to the left by the difference to the largest anchor offset so that all of them are aligned with a
+// common padding; the extension is clipped and does not take part in the alignment.
+void Stage2_batch::verify(Group &group, Statistics &stats, Trace_pt_buffer::Iterator &out)
+{
+	unsigned padding = 0;
+	for (vector<Hit>::const_iterator i = group.hits.begin(); i < group.hits.end(); ++i)
+		padding = std::max(padding, i->left);
+	subjects_.clear();
+	for (vector<Hit>::const_iterator i = group.hits.begin(); i < group.hits.end(); ++i) {
+		const sequence s(ref_seqs::data_->fixed_window_infix(i->s_pos + config.seed_anchor));
+		const unsigned d = padding - i->left;
+		subjects_.push_back(sequence(s.data() - d, s.length() + d, s.clipping_offset_ + (int)d));
+	}
+	Stage2_verified f = { group.hits, stats, out };
+	smith_waterman(group.queries,
+		subjects_,
+		config.hit_band,
+		padding,
+		score_matrix.gap_open() + score_matrix.gap_extend(),
+		score_matrix.gap_extend(),
+		config.min_hit_raw_score,
+		f,
+		stats);
+	pending_ -= group.hits.size();
+	group.hits.clear();
+	group.queries.clear();
+}
+
+// Ungapped extensions of all stage 1 hits of a seed, computed in batches that span the query offsets.
+struct Stage2_extensions
+{
+	template<typename _pos>
+	void run(const _pos *q, const _pos *s, const vector<Stage1_hit> &hits, unsigned sid)
+	{
+		const size_t n = hits.size();
+		query.resize(n);
+		subject.resize(n);
+		score.resize(n);
+		delta.resize(n);
+		len.resize(n);
+		for (size_t i = 0; i < n; ++i) {
+			query[i] = query_seqs::data_->data(q[hits[i].q]);
+			subject[i] = ref_seqs::data_->data(s[hits[i].s]);
+		}
+		stage2_ungapped(query.data(), subject.data(), sid, n, score.data(), delta.data(), len.data());
+	}
+	vector<const Letter*> query, subject;
+	vector<int> score;
+	vector<unsigned> delta, len;
+};
+
+thread_local Stage2_extensions stage2_extensions;
+
+template<typename _pos>
 void search_query_offset(Loc q,
-	const Packed_loc *s,
+	const _pos *s,
 	vector<Stage1_hit>::const_iterator hits,
 	vector<Stage1_hit>::const_iterator hits_end,
+	size_t ext,
 	Statistics &stats,
 	Trace_pt_buffer::Iterator &out,
 	const unsigned sid)
 {
 	const Letter* query = query_seqs::data_->data(q);
+	const Stage2_extensions &e = stage2_extensions;
 	hit_filter hf(stats, q, out);
 
-	for (vector<Stage1_hit>::const_iterator i = hits; i < hits_end; ++i) {
+	for (vector<Stage1_hit>::const_iterator i = hits; i < hits_end; ++i, ++ext) {
 		const Loc s_pos = s[i->s];
-		const Letter* subject = ref_seqs::data_->data(s_pos);
+		const Letter* subject = e.subject[ext];
 
-		unsigned delta, len;
-		int score;
-		if ((score = stage2_ungapped(query, subject, sid, delta, len)) < config.min_ungapped_raw_score)
+		const unsigned delta = e.delta[ext], len = e.len[ext];
+		const int score = e.score[ext];
+		if (score < config.min_ungapped_raw_score)
 			continue;
 
 		stats.inc(Statistics::TENTATIVE_MATCHES2);
@@ -64,10 +164,31 @@ void search_query_offset(Loc q,
 	hf.finish();
 }
 
+template<typename _pos>
+void stage2_search(const _pos *q,
+	const _pos *s,
+	const vector<Stage1_hit> &hits,
+	Statistics &stats,
+	Trace_pt_buffer::Iterator &out,
+	const unsigned sid)
+{
+	typedef Map<vector<Stage1_hit>::const_iterator, Stage1_hit::Query> Map_t;
+	stage2_extensions.run(q, s, hits, sid);
+	Map_t map(hits.begin(), hits.end());
+	for (Map_t::Iterator i = map.begin(); i.valid(); ++i)
+		search_query_offset(q[i.begin()->q], s, i.begin(), i.end(), i.begin() - hits.begin(), stats, out, sid);
+}
+
+void stage2_flush(Statistics &stats, Trace_pt_buffer::Iterator &out)
+{
+	stage2_batch.flush(stats, out);
+}
+
 #else
 
+template<typename _pos>
 void search_query_offset(Loc q,
-	const Packed_loc *s,
+	const _pos *s,
 	vector<Stage1_hit>::const_iterator hits,
 	vector<Stage1_hit>::const_iterator hits_end,
 	Statistics &stats,
@@ -113,10 +234,9 @@ void search_query_offset(Loc q,
 	}
 }
 
-#endif
-
-void stage2_search(const Packed_loc *q,
-	const Packed_loc *s,
+template<typename _pos>
+void stage2_search(const _pos *q,
+	const _pos *s,
 	const vector<Stage1_hit> &hits,
 	Statistics &stats,
 	Trace_pt_buffer::Iterator &out,
@@ -126,4 +246,13 @@ void stage2_search(const Packed_loc *q,
 	Map_t map(hits.begin(), hits.end());
 	for (Map_t::Iterator i = map.begin(); i.valid(); ++i)
 		search_query_offset(q[i.begin()->q], s, i.begin(), i.end(), stats, out, sid);
-}
\ No newline at end of file
+}
+
+void stage2_flush(Statistics &stats, Trace_pt_buffer::Iterator &out)
+{
+}
+
+#endif
+
+template void stage2_search<Packed_loc>(const Packed_loc*, const Packed_loc*, const vector<Stage1_hit>&, Statistics&, Trace_pt_buffer::Iterator&, const unsigned);
+template void stage2_search<uint32_t>(const uint32_t*, const uint32_t*, const vector<Stage1_hit>&, Statistics&, Trace_pt_buffer::Iterator&, const unsigned);
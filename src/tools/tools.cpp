@@ -1,14 +1,25 @@
 #include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <limits>
 #include "tsv_record.h"
 #include "../basic/config.h"
 #include "../util/math/sparse_matrix.h"
 #include "../basic/value.h"
 #include "../util/util.h"
 #include "../basic/sequence.h"
+#include "../util/io/output_file.h"
+#include "../util/log_stream.h"
+#include "../output/output_format.h"
+#include "../basic/score_matrix.h"
+#include "../util/io/text_input_file.h"
+#include "../output/daa_file.h"
+#include "../output/daa_record.h"
 
 using std::cout;
 using std::endl;
 using std::vector;
+using std::string;
 
 void filter_blasttab() {
 	TextInputFile in("");
@@ -27,9 +38,118 @@ void filter_blasttab() {
 	}
 }
 
+// Numbers the nodes of a graph by their labels in order of appearance.
+struct GraphLabels
+{
+	unsigned operator()(const string &label)
+	{
+		const auto i = label2id.emplace(label, (unsigned)labels.size());
+		if (i.second)
+			labels.push_back(label);
+		return i.first->second;
+	}
+	std::unordered_map<string, unsigned> label2id;
+	vector<string> labels;
+};
+
+// Reads edges, one per line: two node labels followed by other fields, the last of which is taken as the weight
+// (the bit score in DIAMOND's default tabular format).
+void read_graph_text(const string &file_name, GraphLabels &id, SparseMatrix::EdgeList &edges)
+{
+	static const char* delimiters = " \t\r";
+	TextInputFile in(file_name);
+	while (true) {
+		in.getline();
+		const string &line = in.line;
+		const size_t end = line.find_last_not_of(delimiters) + 1;
+		if (end > 0 && line[0] != '#') {
+			const size_t e1 = line.find_first_of(delimiters), b2 = line.find_first_not_of(delimiters, e1);
+			const size_t e2 = line.find_first_of(delimiters, b2), b3 = line.find_last_of(delimiters, end - 1);
+			if (e1 == string::npos || b2 == string::npos)
+				throw std::runtime_error("Invalid edge in line " + std::to_string(in.line_count) + ": " + line);
+			if (e2 == string::npos || e2 >= end)
+				throw std::runtime_error("Missing edge weight in line " + std::to_string(in.line_count) + ": " + line);
+			const char *w_begin = line.c_str() + b3 + 1;
+			char *w_end;
+			const float w = (float)strtod(w_begin, &w_end);
+			if (w_end != line.c_str() + end)
+				throw std::runtime_error("Invalid edge weight in line " + std::to_string(in.line_count) + ": " + line);
+			const unsigned a = id(line.substr(0, e1)), b = id(line.substr(b2, e2 - b2));
+			if (a != b && w > 0)
+				edges.add(a, b, w);
+		}
+		if (in.eof())
+			break;
+	}
+	in.close();
+}
+
+// Reads the hits of a DAA file as edges between the query and subject ids, weighted by the bit score.
+void read_graph_daa(const string &file_name, GraphLabels &id, SparseMatrix::EdgeList &edges)
+{
+	DAA_file daa(file_name);
+	score_matrix = Score_matrix("", daa.lambda(), daa.kappa(), daa.gap_open_penalty(), daa.gap_extension_penalty(), daa.db_letters());
+	BinaryBuffer buf;
+	size_t query_num;
+	while (daa.read_query_buffer(buf, query_num)) {
+		DAA_query_record r(daa, buf, query_num);
+		const unsigned a = id(blast_id(r.query_name));
+		for (DAA_query_record::Match_iterator i = r.begin(); i.good(); ++i) {
+			const unsigned b = id(blast_id(i->subject_name));
+			const float w = (float)score_matrix.bitscore(i->score);
+			if (a != b && w > 0)
+				edges.add(a, b, w);
+		}
+	}
+}
+
+// Markov clustering of the graph of hits read from the query file (-q, default stdin), written as one cluster of
+// node labels per line. The input is a DAA file or text edges such as DIAMOND's tabular output.
 void mcl() {
-	SparseMatrix graph(std::cin);
-	graph.print_stats();
+	static const double max_chaos = 1e-4;
+	static const unsigned max_iterations = 100;
+	task_timer timer("Reading the input graph");
+	GraphLabels id;
+	SparseMatrix::EdgeList edges;
+	if (DAA_file::is_daa(config.query_file))
+		read_graph_daa(config.query_file, id, edges);
+	else
+		read_graph_text(config.query_file, id, edges);
+	timer.go("Building the matrix");
+	const vector<string> &labels = id.labels;
+	SparseMatrix graph(std::move(edges), (unsigned)labels.size());
+	timer.finish();
+	message_stream << "Nodes = " << graph.rows() << ", edges = " << graph.nonzero << endl;
+
+	graph.add_loops();
+	graph.inflate(1.0);
+	for (unsigned i = 0; i < max_iterations; ++i) {
+		timer.go("Expansion and inflation");
+		graph = SparseMatrix::multiply(graph, graph, (float)config.mcl_prune, config.mcl_select);
+		const double chaos = graph.inflate(config.inflation);
+		timer.finish();
+		message_stream << "Iteration " << i + 1 << ": nonzero = " << graph.nonzero << ", chaos = " << chaos << endl;
+		if (chaos < max_chaos)
+			break;
+	}
+
+	timer.go("Writing clusters");
+	const vector<vector<unsigned>> clusters = graph.components();
+	OutputFile out(config.output_file);
+	TextBuffer buf;
+	for (const vector<unsigned> &c : clusters) {
+		for (vector<unsigned>::const_iterator i = c.begin(); i < c.end(); ++i) {
+			if (i > c.begin())
+				buf << '\t';
+			buf << labels[*i];
+		}
+		buf << '\n';
+		out.write(buf.get_begin(), buf.size());
+		buf.clear();
+	}
+	out.close();
+	timer.finish();
+	message_stream << "Clusters = " << clusters.size() << endl;
 }
 
 vector<char> generate_random_seq(size_t length)
@@ -47,4 +167,155 @@ void simulate_seqs() {
 		cout << ">" << i << endl;
 		cout << sequence(generate_random_seq(l)) << endl;
 	}
-}
\ No newline at end of file
+}
+
+// One search output of merge_shards, read a query at a time. The targets of a query are the runs of lines with the same
+// subject id, scored by the raw score and e-value of their first line.
+struct ShardOutput
+{
+	struct Target
+	{
+		int score;
+		double evalue;
+		string lines;
+	};
+	ShardOutput(const string &file_name, const std::unordered_map<string, size_t> &query_idx, const vector<unsigned> &fields):
+		in(file_name),
+		query_idx(query_idx)
+	{
+		for (size_t i = 0; i < fields.size(); ++i)
+			switch (fields[i]) {
+			case 0: qseqid = i; break;
+			case 5: sseqid = i; break;
+			case 19: evalue_col = i; break;
+			case 21: score_col = i; break;
+			}
+		next();
+	}
+	void next()
+	{
+		do
+			in.getline();
+		while (!in.eof() && !in.line.empty() && in.line[0] == '#');
+		if (in.eof() && in.line.empty()) {
+			query = std::numeric_limits<size_t>::max();
+			return;
+		}
+		tokens.clear();
+		size_t b = 0, e;
+		while ((e = in.line.find('\t', b)) != string::npos) {
+			tokens.push_back(in.line.substr(b, e - b));
+			b = e + 1;
+		}
+		tokens.push_back(in.line.substr(b));
+		if (tokens.size() <= std::max(std::max(qseqid, sseqid), std::max(score_col, evalue_col)))
+			throw std::runtime_error("Invalid line in " + in.file_name + ": " + in.line);
+		const std::unordered_map<string, size_t>::const_iterator i = query_idx.find(tokens[qseqid]);
+		if (i == query_idx.end())
+			throw std::runtime_error("Query " + tokens[qseqid] + " of " + in.file_name + " is not in the query file.");
+		query = i->second;
+	}
+	// Appends the targets of the current query, returns false if the query is reported as unaligned.
+	bool get(vector<Target> &targets, string &unaligned)
+	{
+		const size_t q = query;
+		bool aligned = false;
+		while (query == q) {
+			if (tokens[sseqid] == "*")
+				unaligned = in.line + '\n';
+			else {
+				if (!aligned || tokens[sseqid] != subject) {
+					Target t = { atoi(tokens[score_col].c_str()), atof(tokens[evalue_col].c_str()), string() };
+					targets.push_back(t);
+					subject = tokens[sseqid];
+				}
+				targets.back().lines += in.line;
+				targets.back().lines += '\n';
+				aligned = true;
+			}
+			next();
+		}
+		return aligned;
+	}
+	TextInputFile in;
+	const std::unordered_map<string, size_t> &query_idx;
+	size_t query, qseqid = 0, sseqid = 0, score_col = 0, evalue_col = 0;
+	vector<string> tokens;
+	string subject;
+};
+
+// Merges the tabular outputs of searches against the shards of a database into the output of a search against the whole
+// database. The targets of each query are ranked by raw score, or by e-value if the score field is not present, with ties
+// going to the earlier shard, and culled by the global --max-target-seqs or --top setting. The shards carry the size of
+// the whole database, so their e-values are comparable.
+void merge_shards()
+{
+	task_timer timer("Reading the query ids");
+	std::unordered_map<string, size_t> query_idx;
+	TextInputFile query_file(config.query_file);
+	bool fastq = false;
+	size_t n = 0;
+	while (query_file.getline(), !query_file.eof() || !query_file.line.empty()) {
+		if (query_file.line_count == 1)
+			fastq = query_file.line[0] == '@';
+		if ((fastq ? (query_file.line_count % 4 == 1) : (!query_file.line.empty() && query_file.line[0] == '>')))
+			query_idx.emplace(blast_id(query_file.line.substr(1)), n++);
+	}
+	query_file.close();
+	timer.finish();
+	message_stream << "Queries = " << n << endl;
+
+	Blast_tab_format format;
+	if (!config.output_format.empty() && config.output_format[0] != "tab" && config.output_format[0] != "6")
+		throw std::runtime_error("Merging is only supported for the BLAST tabular format.");
+	vector<unsigned> &fields = format.fields;
+	const bool by_score = std::find(fields.begin(), fields.end(), 21) != fields.end();
+	if (std::find(fields.begin(), fields.end(), 0) == fields.end() || std::find(fields.begin(), fields.end(), 5) == fields.end()
+		|| (!by_score && std::find(fields.begin(), fields.end(), 19) == fields.end()))
+		throw std::runtime_error("Merging requires the fields qseqid, sseqid and score or evalue.");
+	if (!by_score && config.toppercent < 100.0)
+		throw std::runtime_error("Merging with --top requires the field score.");
+
+	timer.go("Merging the shard outputs");
+	PtrVector<ShardOutput> shards;
+	for (vector<string>::const_iterator i = config.shard_outputs.begin(); i < config.shard_outputs.end(); ++i)
+		shards.push_back(new ShardOutput(*i, query_idx, fields));
+	OutputFile out(config.output_file);
+	TextBuffer buf;
+	vector<ShardOutput::Target> targets;
+	string unaligned;
+	const uint64_t max_targets = config.max_alignments == 0 ? std::numeric_limits<uint64_t>::max() : config.max_alignments;
+	size_t queries = 0, hits = 0;
+	while (true) {
+		size_t q = std::numeric_limits<size_t>::max();
+		for (PtrVector<ShardOutput>::iterator i = shards.begin(); i < shards.end(); ++i)
+			q = std::min(q, (*i)->query);
+		if (q == std::numeric_limits<size_t>::max())
+			break;
+		targets.clear();
+		unaligned.clear();
+		for (PtrVector<ShardOutput>::iterator i = shards.begin(); i < shards.end(); ++i)
+			if ((*i)->query == q)
+				(*i)->get(targets, unaligned);
+		if (targets.empty()) {
+			buf << unaligned;
+			continue;
+		}
+		std::stable_sort(targets.begin(), targets.end(), [by_score](const ShardOutput::Target &x, const ShardOutput::Target &y) {
+			return by_score ? x.score > y.score : x.evalue < y.evalue; });
+		const int top_score = targets.front().score;
+		for (size_t i = 0; i < targets.size(); ++i) {
+			if (config.toppercent < 100.0 ? (1.0 - (double)targets[i].score / top_score) * 100.0 > config.toppercent : i >= max_targets)
+				break;
+			buf << targets[i].lines;
+			++hits;
+		}
+		++queries;
+		out.write(buf.get_begin(), buf.size());
+		buf.clear();
+	}
+	out.write(buf.get_begin(), buf.size());
+	out.close();
+	timer.finish();
+	message_stream << "Merged " << shards.size() << " shard outputs, " << queries << " queries with " << hits << " targets." << endl;
+}
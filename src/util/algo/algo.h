@@ -1,20 +1,62 @@
 #ifndef UTIL_ALGO_ALGO_H_
 #define UTIL_ALGO_ALGO_H_
 
+#include <stddef.h>
 #include <vector>
+#include <utility>
 
 namespace Util { namespace Algo {
 
-struct Edge {
-	int v1, v2, weight;
-	bool operator<(const Edge &x) const {
-		return weight > x.weight;
+// Weighted directed graph in compressed sparse row format. Edges are appended
+// row by row as they arrive; rows that are not contiguous are merged in place by finish().
+struct WeightedGraph {
+
+	struct Edge {
+		int neighbor, weight;
+	};
+
+	WeightedGraph(int vertex_count);
+	void add_edge(int v1, int v2, int weight);
+	void finish();
+	// Moves the edges and the row index out of the graph, which is left empty.
+	void release(std::vector<Edge> &edges, std::vector<size_t> &row_begin);
+
+	int vertex_count() const {
+		return (int)row_begin_.size() - 1;
+	}
+	size_t edge_count() const {
+		return edges_.size();
+	}
+	size_t begin(int v) const {
+		return row_begin_[v];
+	}
+	size_t end(int v) const {
+		return row_begin_[v + 1];
 	}
+	int neighbor(size_t i) const {
+		return edges_[i].neighbor;
+	}
+	int weight(size_t i) const {
+		return edges_[i].weight;
+	}
+
+private:
+
+	size_t run_size(size_t first, size_t last) const;
+	void sort_runs(size_t first, size_t last, size_t offset);
+	void merge_runs(size_t first, size_t middle, size_t last, size_t offset);
+
+	int current_row_;
+	std::vector<std::pair<int, size_t>> runs_;
+	std::vector<size_t> row_begin_;
+	std::vector<Edge> edges_;
+
 };
 
 std::vector<int> greedy_vortex_cover(const std::vector<std::vector<int>> &neighbors);
-std::vector<int> greedy_vortex_cover_weighted(std::vector<Edge> &edges, int vortex_count);
+// Consumes the edges of the graph.
+std::vector<int> greedy_vortex_cover_weighted(WeightedGraph &graph, size_t thread_count);
 
 }}
 
-#endif
\ No newline at end of file
+#endif
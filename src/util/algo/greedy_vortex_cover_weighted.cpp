@@ -1,38 +1,297 @@
 #include <algorithm>
+#include <atomic>
+#include <numeric>
 #include "algo.h"
+#include "../parallel/thread_pool.h"
+#include "../log_stream.h"
 
 using namespace std;
 
 namespace Util { namespace Algo {
 
-int fix_centroid(vector<int> &centroid, int i) {
-	if (centroid[i] == i)
-		return i;
-	else
-		return centroid[i] = fix_centroid(centroid, centroid[i]);
-}
-
-vector<int> greedy_vortex_cover_weighted(vector<Edge> &edges, int vortex_count) {
-	sort(edges.begin(), edges.end());
-	vector<int> centroid, neighbors(vortex_count);
-	centroid.reserve(vortex_count);
-	for (int i = 0; i < vortex_count; ++i)
-		centroid.push_back(i);
-	for (Edge e : edges) {
-		++neighbors[e.v1];
-		++neighbors[e.v2];
-	}
-	for (Edge e : edges) {
-		if (centroid[e.v1] == e.v1 && centroid[e.v2] == e.v2) {
-			if (neighbors[e.v1] >= neighbors[e.v2])
-				centroid[e.v2] = e.v1;
-			else
-				centroid[e.v1] = e.v2;
+WeightedGraph::WeightedGraph(int vertex_count) :
+	current_row_(-1),
+	row_begin_(vertex_count + 1, 0)
+{}
+
+void WeightedGraph::add_edge(int v1, int v2, int weight) {
+	if (v1 != current_row_) {
+		runs_.emplace_back(v1, edges_.size());
+		current_row_ = v1;
+	}
+	edges_.push_back(Edge{ v2, weight });
+}
+
+size_t WeightedGraph::run_size(size_t first, size_t last) const {
+	size_t n = 0;
+	for (size_t i = first; i < last; ++i)
+		n += runs_[i].second;
+	return n;
+}
+
+// Stable merge sort of the runs by vertex. Runs are merged by rotating the edges in place as in std::inplace_merge
+// without a buffer, so that no second copy of the edges is needed.
+void WeightedGraph::sort_runs(size_t first, size_t last, size_t offset) {
+	if (last - first < 2)
+		return;
+	const size_t middle = first + (last - first) / 2;
+	sort_runs(first, middle, offset);
+	sort_runs(middle, last, offset + run_size(first, middle));
+	merge_runs(first, middle, last, offset);
+}
+
+void WeightedGraph::merge_runs(size_t first, size_t middle, size_t last, size_t offset) {
+	if (first == middle || middle == last)
+		return;
+	const auto less = [](const pair<int, size_t> &a, const pair<int, size_t> &b) { return a.first < b.first; };
+	size_t cut1, cut2;
+	if (middle - first == 1 && last - middle == 1) {
+		if (less(runs_[middle], runs_[first])) {
+			rotate(edges_.begin() + offset, edges_.begin() + offset + runs_[first].second, edges_.begin() + offset + runs_[first].second + runs_[middle].second);
+			swap(runs_[first], runs_[middle]);
 		}
+		return;
+	}
+	if (middle - first > last - middle) {
+		cut1 = first + (middle - first) / 2;
+		cut2 = lower_bound(runs_.begin() + middle, runs_.begin() + last, runs_[cut1], less) - runs_.begin();
+	}
+	else {
+		cut2 = middle + (last - middle) / 2;
+		cut1 = upper_bound(runs_.begin() + first, runs_.begin() + middle, runs_[cut2], less) - runs_.begin();
+	}
+	const size_t p1 = offset + run_size(first, cut1), p2 = p1 + run_size(cut1, middle), p3 = p2 + run_size(middle, cut2);
+	rotate(edges_.begin() + p1, edges_.begin() + p2, edges_.begin() + p3);
+	rotate(runs_.begin() + cut1, runs_.begin() + middle, runs_.begin() + cut2);
+	const size_t new_middle = cut1 + (cut2 - middle);
+	merge_runs(first, cut1, new_middle, offset);
+	merge_runs(new_middle, cut2, last, p1 + (p3 - p2));
+}
+
+void WeightedGraph::finish() {
+	const size_t n = runs_.size();
+	for (size_t i = 0; i < n; ++i)
+		runs_[i].second = (i + 1 < n ? runs_[i + 1].second : edges_.size()) - runs_[i].second;
+
+	bool sorted = true;
+	for (size_t i = 1; i < n; ++i)
+		if (runs_[i].first < runs_[i - 1].first) {
+			sorted = false;
+			break;
+		}
+	if (!sorted)
+		sort_runs(0, n, 0);
+
+	const int vertices = vertex_count();
+	size_t r = 0, p = 0;
+	for (int v = 0; v <= vertices; ++v) {
+		while (r < n && runs_[r].first < v)
+			p += runs_[r++].second;
+		row_begin_[v] = p;
+	}
+	runs_.clear();
+	runs_.shrink_to_fit();
+	current_row_ = -1;
+}
+
+void WeightedGraph::release(vector<Edge> &edges, vector<size_t> &row_begin) {
+	edges.clear();
+	edges.swap(edges_);
+	row_begin.clear();
+	row_begin.swap(row_begin_);
+}
+
+namespace {
+
+static const size_t vertex_partition_size = 4096;
+static const uint64_t DEAD = uint64_t(1) << 63;
+
+// Edge as seen from the vertex that is merged into the other one when the edge is accepted. The neighbor is the vertex
+// that wins the edge.
+typedef WeightedGraph::Edge LosingEdge;
+
+// Edges are processed in order of decreasing weight, ties are resolved by the vertex ids.
+inline bool before(int loser1, const LosingEdge &e1, int loser2, const LosingEdge &e2) {
+	if (e1.weight != e2.weight)
+		return e1.weight > e2.weight;
+	const int lo1 = min(loser1, e1.neighbor), lo2 = min(loser2, e2.neighbor);
+	if (lo1 != lo2)
+		return lo1 < lo2;
+	const int hi1 = max(loser1, e1.neighbor), hi2 = max(loser2, e2.neighbor);
+	if (hi1 != hi2)
+		return hi1 < hi2;
+	return loser1 < loser2;
+}
+
+struct Cover {
+
+	Cover(WeightedGraph &graph, size_t thread_count) :
+		graph(graph),
+		n(graph.vertex_count()),
+		threads(thread_count),
+		partitions((n + vertex_partition_size - 1) / vertex_partition_size),
+		degree(n),
+		begin(n + 1),
+		state(n)
+	{
+		count_degrees();
+		build_losing_edges();
+		run_rounds();
 	}
-	for (int i = 0; i < vortex_count; ++i)
-		fix_centroid(centroid, i);
-	return centroid;
+
+	template<typename _f>
+	void parallel_vertices(_f f) {
+		Util::Parallel::scheduled_thread_pool_auto(threads, partitions, [this, &f](size_t p, size_t thread_id) {
+			const int end = (int)min((p + 1) * vertex_partition_size, (size_t)n);
+			for (int v = int(p * vertex_partition_size); v < end; ++v)
+				f(v);
+		});
+	}
+
+	void count_degrees() {
+		parallel_vertices([this](int v) { degree[v].store(int(graph.end(v) - graph.begin(v)), memory_order_relaxed); });
+		parallel_vertices([this](int v) {
+			for (size_t i = graph.begin(v); i < graph.end(v); ++i)
+				degree[graph.neighbor(i)].fetch_add(1, memory_order_relaxed);
+		});
+	}
+
+	int loser(int v1, int v2) const {
+		return degree[v1].load(memory_order_relaxed) >= degree[v2].load(memory_order_relaxed) ? v2 : v1;
+	}
+
+	// The losing edges are built in the memory of the graph edges. The edges are permuted into buckets by losing vertex
+	// by following the permutation cycles, as in an in-place bucket sort. A slot is only written when an edge is placed in
+	// it, so an unplaced slot still holds its original edge, whose source vertex is found in the row index. Self loops
+	// go to a bucket behind the others and are dropped.
+	void build_losing_edges() {
+		vector<atomic<size_t>> fill(n + 1);
+		parallel_vertices([&fill](int v) { fill[v].store(0, memory_order_relaxed); });
+		fill[n].store(0, memory_order_relaxed);
+		parallel_vertices([this, &fill](int v) {
+			for (size_t i = graph.begin(v); i < graph.end(v); ++i)
+				fill[bucket(v, graph.neighbor(i))].fetch_add(1, memory_order_relaxed);
+		});
+		vector<size_t> row_begin, next(n + 1);
+		graph.release(edges, row_begin);
+		begin[0] = 0;
+		for (int v = 0; v < n; ++v)
+			begin[v + 1] = begin[v] + fill[v].load(memory_order_relaxed);
+		std::copy(begin.begin(), begin.end(), next.begin());
+
+		const auto row = [&row_begin](size_t i) { return int(upper_bound(row_begin.begin(), row_begin.end(), i) - row_begin.begin()) - 1; };
+		for (int b = 0; b <= n; ++b) {
+			const size_t end = b < n ? begin[b + 1] : edges.size();
+			while (next[b] < end) {
+				const size_t p = next[b];
+				LosingEdge e = edges[p];
+				int v = row(p);
+				for (;;) {
+					const int t = bucket(v, e.neighbor);
+					const LosingEdge placed{ t == v ? e.neighbor : v, e.weight };
+					if (t == b) {
+						edges[p] = placed;
+						++next[b];
+						break;
+					}
+					const size_t q = next[t]++;
+					e = edges[q];
+					edges[q] = placed;
+					v = row(q);
+				}
+			}
+		}
+		edges.resize(begin[n]);
+
+		parallel_vertices([this](int v) {
+			sort(edges.begin() + begin[v], edges.begin() + begin[v + 1], [v](const LosingEdge &a, const LosingEdge &b) { return before(v, a, v, b); });
+			state[v].store(begin[v], memory_order_relaxed);
+		});
+	}
+
+	// Bucket of the edge from v to u: its losing vertex, or n for a self loop.
+	int bucket(int v, int u) const {
+		return u == v ? n : loser(v, u);
+	}
+
+	// Decides the edges of v in order until v is merged, runs out of edges or depends on an undecided edge of another vertex.
+	// Returns true if v is finished.
+	bool advance(int v) {
+		size_t p = state[v].load(memory_order_relaxed) & ~DEAD;
+		const size_t end = begin[v + 1];
+		while (p < end) {
+			const LosingEdge &e = edges[p];
+			const uint64_t s = state[e.neighbor].load(memory_order_acquire);
+			const size_t q = s & ~DEAD;
+			if (q < begin[e.neighbor + 1] && before(e.neighbor, edges[q], v, e)) {
+				if (s & DEAD) {
+					++p;
+					continue;
+				}
+				state[v].store(p, memory_order_release);
+				return false;
+			}
+			state[v].store(p | DEAD, memory_order_release);
+			return true;
+		}
+		state[v].store(p, memory_order_release);
+		return true;
+	}
+
+	// Rounds of parallel decisions that reproduce the sequential greedy order: an edge is accepted iff its winner has
+	// not been merged by an earlier edge, so each vertex only waits on earlier edges of its winners.
+	void run_rounds() {
+		vector<int> active(n);
+		iota(active.begin(), active.end(), 0);
+		vector<char> finished;
+		size_t rounds = 0;
+		while (!active.empty()) {
+			finished.assign(active.size(), 0);
+			const size_t active_partitions = (active.size() + vertex_partition_size - 1) / vertex_partition_size;
+			Util::Parallel::scheduled_thread_pool_auto(threads, active_partitions, [this, &active, &finished](size_t p, size_t thread_id) {
+				const size_t end = min((p + 1) * vertex_partition_size, active.size());
+				for (size_t i = p * vertex_partition_size; i < end; ++i)
+					finished[i] = advance(active[i]);
+			});
+			size_t j = 0;
+			for (size_t i = 0; i < active.size(); ++i)
+				if (!finished[i])
+					active[j++] = active[i];
+			active.resize(j);
+			++rounds;
+		}
+		log_stream << "Greedy vertex cover: edges=" << edges.size() << " rounds=" << rounds << endl;
+	}
+
+	vector<int> centroids() {
+		vector<int> parent(n), centroid(n);
+		parallel_vertices([this, &parent](int v) {
+			const uint64_t s = state[v].load(memory_order_relaxed);
+			parent[v] = (s & DEAD) ? edges[s & ~DEAD].neighbor : v;
+		});
+		parallel_vertices([&parent, &centroid](int v) {
+			int c = v;
+			while (parent[c] != c)
+				c = parent[c];
+			centroid[v] = c;
+		});
+		return centroid;
+	}
+
+	WeightedGraph &graph;
+	const int n;
+	const size_t threads, partitions;
+	vector<atomic<int>> degree;
+	vector<size_t> begin;
+	vector<LosingEdge> edges;
+	vector<atomic<uint64_t>> state;
+
+};
+
+}
+
+vector<int> greedy_vortex_cover_weighted(WeightedGraph &graph, size_t thread_count) {
+	return Cover(graph, thread_count).centroids();
 }
 
 }}
\ No newline at end of file
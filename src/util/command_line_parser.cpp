@@ -69,6 +69,7 @@ void Command_line_parser::store_option(const vector<string> &v)
 	else {
 		v2.insert(v2.end(), v.begin() + 1, v.end());
 		o->read(v2);
+		given_[o->id] = v2;
 	}
 }
 
@@ -85,6 +86,7 @@ void Command_line_parser::store(int count, const char ** str, unsigned &command)
 
 	for (map<string, Option_base*>::const_iterator i = map_.begin(); i != map_.end(); ++i)
 		i->second->set_default();
+	given_.clear();
 
 	vector<string> v;
 	for (int i = 2; i < count; ++i) {
@@ -97,6 +99,19 @@ void Command_line_parser::store(int count, const char ** str, unsigned &command)
 	store_option(v);
 }
 
+string Command_line_parser::given_options(const set<string> &ignore) const
+{
+	string s;
+	for (map<string, vector<string> >::const_iterator i = given_.begin(); i != given_.end(); ++i) {
+		if (ignore.find(i->first) != ignore.end())
+			continue;
+		s += " --" + i->first;
+		for (vector<string>::const_iterator j = i->second.begin(); j != i->second.end(); ++j)
+			s += ' ' + *j;
+	}
+	return s;
+}
+
 void Command_line_parser::print_help()
 {
 	static const size_t col1_width = 25;
@@ -21,6 +21,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <vector>
 #include <map>
+#include <set>
 #include <string>
 #include <assert.h>
 #include <stdlib.h>
@@ -157,11 +158,14 @@ struct Command_line_parser
 	Command_line_parser& add_command(const char *s, const char *desc);
 	void store(int count, const char **str, unsigned &command);
 	void print_help();
+	// Options given on the command line as "--id values...", ordered by id, leaving out the ones in ignore.
+	std::string given_options(const std::set<std::string> &ignore) const;
 private:
 	void store_option(const std::vector<std::string> &v);
 
 	std::map<std::string, Option_base*> map_;
 	std::map<char, Option_base*> map_short_;
+	std::map<std::string, std::vector<std::string> > given_;
 	std::vector<const Options_group*> groups_;
 	std::vector<std::pair<std::string,std::string> > commands_;
 };
@@ -0,0 +1,106 @@
+/****
+DIAMOND protein aligner
+Copyright (C) 2013-2019 Benjamin Buchfink <buchfink@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+****/
+
+#ifndef BLOOM_FILTER_H_
+#define BLOOM_FILTER_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#include "../simd.h"
+
+// Split block Bloom filter: a key sets one bit in each of the 8 words of a 256 bit block, so that a lookup
+// touches a single cache line. Two multiplicative hashes of the key select the block and the bits.
+struct Blocked_bloom_filter
+{
+
+	enum { WORDS = 8, BLOCK_SIZE = WORDS * sizeof(uint32_t) };
+
+	Blocked_bloom_filter(size_t keys, size_t bits_per_key) :
+		blocks_(std::max(keys * bits_per_key / (BLOCK_SIZE * 8), (size_t)1)),
+		buf_(blocks_ * WORDS + WORDS, 0)
+	{
+		data_ = buf_.data();
+		while ((size_t)data_ % BLOCK_SIZE != 0)
+			++data_;
+	}
+
+	void insert(uint64_t key)
+	{
+		uint32_t *b = block(key);
+		const uint32_t h = bit_hash(key);
+		for (unsigned i = 0; i < WORDS; ++i)
+			b[i] |= mask(h, i);
+	}
+
+	bool contains(uint64_t key) const
+	{
+		const uint32_t *b = block(key);
+		const uint32_t h = bit_hash(key);
+		for (unsigned i = 0; i < WORDS; ++i)
+			if ((b[i] & mask(h, i)) == 0)
+				return false;
+		return true;
+	}
+
+	void prefetch(uint64_t key) const
+	{
+#ifdef __SSE2__
+		_mm_prefetch((const char*)block(key), _MM_HINT_T0);
+#endif
+	}
+
+	size_t size() const
+	{
+		return blocks_ * BLOCK_SIZE;
+	}
+
+	double load() const
+	{
+		size_t n = 0;
+		for (size_t i = 0; i < blocks_ * WORDS; ++i)
+			for (uint32_t x = data_[i]; x; x &= x - 1)
+				++n;
+		return (double)n / (blocks_ * BLOCK_SIZE * 8);
+	}
+
+private:
+
+	uint32_t* block(uint64_t key) const
+	{
+		return data_ + (((key * 0x9e3779b97f4a7c15llu) >> 32) * blocks_ >> 32) * WORDS;
+	}
+
+	static uint32_t bit_hash(uint64_t key)
+	{
+		return (uint32_t)((key * 0xc4ceb9fe1a85ec53llu) >> 32);
+	}
+
+	static uint32_t mask(uint32_t hash, unsigned i)
+	{
+		static const uint32_t salt[WORDS] = { 0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU, 0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U };
+		return 1u << ((hash * salt[i]) >> 27);
+	}
+
+	size_t blocks_;
+	std::vector<uint32_t> buf_;
+	uint32_t *data_;
+
+};
+
+#endif
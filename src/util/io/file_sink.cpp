@@ -42,7 +42,9 @@ FileSink::FileSink(const string &file_name, const char *mode):
 #ifdef _MSC_VER
 	f_ = file_name.length() == 0 ? stdout : fopen(file_name.c_str(), mode);
 #else
-	int fd_ = file_name.length() == 0 ? 1 : POSIX_OPEN(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+	// Mode "r+b" opens an existing file for update, all other modes create or truncate the file.
+	const int flags = mode[0] == 'r' ? O_RDWR : (O_WRONLY | O_CREAT | O_TRUNC);
+	int fd_ = file_name.length() == 0 ? 1 : POSIX_OPEN(file_name.c_str(), flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
 	if (fd_ < 0) {
 		perror(0);
 		throw File_open_exception(file_name_);
@@ -1,6 +1,8 @@
 #include <algorithm>
 #include <string>
-#include <map>
+#include <functional>
+#include <limits>
+#include <cmath>
 #include <assert.h>
 #include <utility>
 #include "../parallel/thread_pool.h"
@@ -12,48 +14,79 @@
 using std::get;
 using std::vector;
 using std::string;
-using std::map;
 using std::cerr;
 using std::endl;
 using std::pair;
 
 SparseMatrix::SparseMatrix(unsigned rows):
+	nonzero(0),
 	idx_(rows),
 	value_(rows)
 {
 }
 
-SparseMatrix::SparseMatrix(std::vector<Triplet> &&v)
+SparseMatrix::SparseMatrix(std::vector<Triplet> &&v, unsigned rows):
+	SparseMatrix(rows)
 {
-	std::sort(v.begin(), v.end());
-	const unsigned n = get<0>(v.back()) + 1;
-	idx_.resize(n);
-	value_.resize(n);
-	for (const Triplet &t : v) {
-		idx_[get<0>(t)].push_back(get<1>(t));
-		value_[get<0>(t)].push_back(get<2>(t));
-		++nonzero;
-	}
+	vector<vector<Triplet>> blocks;
+	blocks.push_back(std::move(v));
+	build(blocks, false);
 }
 
-std::vector<SparseMatrix::Triplet> SparseMatrix::read_triplets(std::istream &is) {
-	map<string, unsigned> label2id;
-	vector<Triplet> r;
-	string n1, n2;
-	float w;
-	while (is >> n1 >> n2 >> w) {
-		if (label2id.find(n1) == label2id.end())
-			label2id[n1] = label2id.size();
-		if (label2id.find(n2) == label2id.end())
-			label2id[n2] = label2id.size();
-		r.emplace_back(label2id[n1], label2id[n2], w);
-	}
-	return r;
+SparseMatrix::SparseMatrix(EdgeList &&edges, unsigned rows):
+	SparseMatrix(rows)
+{
+	build(edges.blocks, true);
+	edges.size = 0;
 }
 
-SparseMatrix::SparseMatrix(std::istream &is):
-	SparseMatrix(read_triplets(is))
+void SparseMatrix::build(vector<vector<Triplet>> &blocks, bool symmetric)
 {
+	vector<size_t> degree(rows(), 0);
+	for (const vector<Triplet> &b : blocks)
+		for (const Triplet &t : b) {
+			++degree[get<0>(t)];
+			if (symmetric)
+				++degree[get<1>(t)];
+		}
+	for (unsigned i = 0; i < rows(); ++i) {
+		idx_[i].reserve(degree[i]);
+		value_[i].reserve(degree[i]);
+	}
+	while (!blocks.empty()) {
+		for (const Triplet &t : blocks.back()) {
+			idx_[get<0>(t)].push_back(get<1>(t));
+			value_[get<0>(t)].push_back(get<2>(t));
+			if (symmetric) {
+				idx_[get<1>(t)].push_back(get<0>(t));
+				value_[get<1>(t)].push_back(get<2>(t));
+			}
+		}
+		blocks.pop_back();
+	}
+	Util::Parallel::scheduled_thread_pool_auto(config.threads_, rows(), SparseMatrix::sort_row_worker, this);
+	nonzero = 0;
+	for (const vector<unsigned> &v : idx_)
+		nonzero += v.size();
+}
+
+void SparseMatrix::sort_row_worker(size_t i, size_t thread_id, SparseMatrix *m) {
+	static thread_local vector<pair<unsigned, float>> row;
+	vector<unsigned> &idx = m->idx_[i];
+	vector<float> &value = m->value_[i];
+	row.clear();
+	for (size_t j = 0; j < idx.size(); ++j)
+		row.emplace_back(idx[j], value[j]);
+	std::sort(row.begin(), row.end());
+	idx.clear();
+	value.clear();
+	for (const pair<unsigned, float> &x : row)
+		if (!idx.empty() && idx.back() == x.first)
+			value.back() = std::max(value.back(), x.second);
+		else {
+			idx.push_back(x.first);
+			value.push_back(x.second);
+		}
 }
 
 void SparseMatrix::print_stats() {
@@ -69,6 +102,7 @@ SparseMatrix SparseMatrix::transpose() const {
 			T.idx_[j].push_back(i);
 			T.value_[j].push_back(value_[i][a]);
 		}
+	T.nonzero = nonzero;
 
 	typedef DoubleIterator<vector<unsigned>::iterator, vector<float>::iterator, unsigned, float> It;
 	for (unsigned i = 0; i < T.rows(); ++i) {
@@ -78,15 +112,130 @@ SparseMatrix SparseMatrix::transpose() const {
 	return T;
 }
 
-void SparseMatrix::multiply_worker(size_t i, size_t thread_id, const SparseMatrix *A, const SparseMatrix *B, SparseMatrix *C) {
-	for (unsigned j : A->idx_[i]) {
+void SparseMatrix::add_loops() {
+	for (unsigned i = 0; i < rows(); ++i) {
+		vector<unsigned>::iterator it = std::lower_bound(idx_[i].begin(), idx_[i].end(), i);
+		if (it != idx_[i].end() && *it == i)
+			continue;
+		const float w = value_[i].empty() ? 1.0f : *std::max_element(value_[i].begin(), value_[i].end());
+		value_[i].insert(value_[i].begin() + (it - idx_[i].begin()), w);
+		idx_[i].insert(it, i);
+		++nonzero;
+	}
+}
 
+void SparseMatrix::inflate_worker(size_t i, size_t thread_id, SparseMatrix *m, double r, vector<double> *chaos) {
+	vector<float> &v = m->value_[i];
+	if (v.empty())
+		return;
+	double sum = 0.0;
+	for (float &x : v) {
+		x = (float)std::pow((double)x, r);
+		sum += x;
 	}
+	double max = 0.0, sq = 0.0;
+	for (float &x : v) {
+		x = float(x / sum);
+		max = std::max(max, (double)x);
+		sq += (double)x * x;
+	}
+	(*chaos)[thread_id] = std::max((*chaos)[thread_id], (max - sq) * v.size());
 }
 
-SparseMatrix operator*(const SparseMatrix &A, const SparseMatrix &B) {
+double SparseMatrix::inflate(double r) {
+	vector<double> chaos(config.threads_, 0.0);
+	Util::Parallel::scheduled_thread_pool_auto(config.threads_, rows(), SparseMatrix::inflate_worker, this, r, &chaos);
+	return *std::max_element(chaos.begin(), chaos.end());
+}
+
+vector<vector<unsigned>> SparseMatrix::components() const {
+	vector<unsigned> parent(rows());
+	for (unsigned i = 0; i < rows(); ++i)
+		parent[i] = i;
+	const auto find = [&parent](unsigned i) {
+		while (parent[i] != i)
+			i = parent[i] = parent[parent[i]];
+		return i;
+	};
+	for (unsigned i = 0; i < rows(); ++i)
+		for (unsigned j : idx_[i]) {
+			const unsigned a = find(i), b = find(j);
+			if (a != b)
+				parent[std::max(a, b)] = std::min(a, b);
+		}
+	vector<vector<unsigned>> r;
+	vector<unsigned> component(rows());
+	for (unsigned i = 0; i < rows(); ++i) {
+		const unsigned root = find(i);
+		if (root == i) {
+			component[i] = (unsigned)r.size();
+			r.emplace_back();
+		}
+		r[component[root]].push_back(i);
+	}
+	return r;
+}
+
+void SparseMatrix::multiply_worker(size_t i, size_t thread_id, const SparseMatrix *A, const SparseMatrix *B, SparseMatrix *C, float threshold, unsigned select) {
+	static thread_local vector<float> acc;
+	static thread_local vector<unsigned> touched;
+	static thread_local vector<pair<float, unsigned>> row;
+	touched.clear();
+	for (size_t a = 0; a < A->idx_[i].size(); ++a) {
+		const unsigned k = A->idx_[i][a];
+		const float x = A->value_[i][a];
+		const vector<unsigned> &idx = B->idx_[k];
+		const vector<float> &value = B->value_[k];
+		for (size_t b = 0; b < idx.size(); ++b) {
+			const unsigned j = idx[b];
+			if (j >= acc.size())
+				acc.resize(j + 1, 0.0f);
+			if (acc[j] == 0.0f)
+				touched.push_back(j);
+			acc[j] += x * value[b];
+		}
+	}
+	row.clear();
+	float max = 0.0f;
+	unsigned max_j = 0;
+	for (unsigned j : touched) {
+		const float x = acc[j];
+		if (x == 0.0f)
+			continue;
+		acc[j] = 0.0f;
+		if (x > max) {
+			max = x;
+			max_j = j;
+		}
+		if (x >= threshold)
+			row.emplace_back(x, j);
+	}
+	if (row.empty() && max > 0.0f)
+		row.emplace_back(max, max_j);
+	if (row.size() > select) {
+		std::nth_element(row.begin(), row.begin() + select, row.end(), std::greater<pair<float, unsigned>>());
+		row.resize(select);
+	}
+	std::sort(row.begin(), row.end(), [](const pair<float, unsigned> &x, const pair<float, unsigned> &y) { return x.second < y.second; });
+	vector<unsigned> &idx = C->idx_[i];
+	vector<float> &value = C->value_[i];
+	idx.reserve(row.size());
+	value.reserve(row.size());
+	for (const pair<float, unsigned> &x : row) {
+		idx.push_back(x.second);
+		value.push_back(x.first);
+	}
+}
+
+SparseMatrix SparseMatrix::multiply(const SparseMatrix &A, const SparseMatrix &B, float threshold, unsigned select) {
 	assert(A.rows() == B.rows());
 	SparseMatrix C(A.rows());
-	Util::Parallel::scheduled_thread_pool_auto(config.threads_, A.rows(), SparseMatrix::multiply_worker, &A, &B, &C);
+	Util::Parallel::scheduled_thread_pool_auto(config.threads_, A.rows(), SparseMatrix::multiply_worker, &A, &B, &C, threshold, select);
+	for (const vector<unsigned> &v : C.idx_)
+		C.nonzero += v.size();
 	return C;
-}
\ No newline at end of file
+}
+
+SparseMatrix operator*(const SparseMatrix &A, const SparseMatrix &B) {
+	return SparseMatrix::multiply(A, B, 0.0f, std::numeric_limits<unsigned>::max());
+}
@@ -30,27 +30,62 @@ SOFTWARE.
 #include <iostream>
 #include <vector>
 #include <tuple>
+#include <string>
 
 struct SparseMatrix {
 
 	typedef std::tuple<unsigned, unsigned, float> Triplet;
 
-	SparseMatrix(std::vector<Triplet> &&v);
-	SparseMatrix(std::istream &is);
+	// Undirected edges, collected in blocks that are released while the rows of the matrix are filled.
+	struct EdgeList {
+		enum { BLOCK_SIZE = 1 << 20 };
+		EdgeList():
+			size(0)
+		{}
+		void add(unsigned a, unsigned b, float weight)
+		{
+			if (blocks.empty() || blocks.back().size() == BLOCK_SIZE) {
+				blocks.emplace_back();
+				blocks.back().reserve(BLOCK_SIZE);
+			}
+			blocks.back().emplace_back(a, b, weight);
+			++size;
+		}
+		std::vector<std::vector<Triplet>> blocks;
+		size_t size;
+	};
+
+	SparseMatrix(std::vector<Triplet> &&v, unsigned rows);
+	// Builds the symmetric matrix of the edges, duplicates keep the maximum weight. The edges are consumed.
+	SparseMatrix(EdgeList &&edges, unsigned rows);
 	SparseMatrix(unsigned rows);
 	void print_stats();
 	SparseMatrix transpose() const;
+	// Adds a self loop weighted by the row maximum to every row that does not have one.
+	void add_loops();
+	// Raises all entries to the power r and rescales the rows to sum to 1. Returns the maximum chaos of a row,
+	// (max - sum of squares) * entries, which is 0 for rows of equal entries.
+	double inflate(double r);
+	// Returns the connected components of the nonzero pattern, each sorted by node.
+	std::vector<std::vector<unsigned>> components() const;
+	// Computes A*B row by row in parallel. Entries of a result row below threshold are dropped and at most select of the
+	// largest ones kept, the largest entry is always kept.
+	static SparseMatrix multiply(const SparseMatrix &A, const SparseMatrix &B, float threshold, unsigned select);
 	friend SparseMatrix operator*(const SparseMatrix &A, const SparseMatrix &B);
 	unsigned rows() const {
 		return (unsigned)idx_.size();
 	}
 
-	unsigned nonzero;
+	size_t nonzero;
 
 private:
 
-	static std::vector<Triplet> read_triplets(std::istream &is);
-	static void multiply_worker(size_t i, size_t thread_id, const SparseMatrix *A, const SparseMatrix *B, SparseMatrix *C);
+	// Counts the entries of each row, fills the rows to their exact size while releasing the blocks, then sorts
+	// the rows and merges duplicates.
+	void build(std::vector<std::vector<Triplet>> &blocks, bool symmetric);
+	static void sort_row_worker(size_t i, size_t thread_id, SparseMatrix *m);
+	static void multiply_worker(size_t i, size_t thread_id, const SparseMatrix *A, const SparseMatrix *B, SparseMatrix *C, float threshold, unsigned select);
+	static void inflate_worker(size_t i, size_t thread_id, SparseMatrix *m, double r, std::vector<double> *chaos);
 
 	std::vector<std::vector<unsigned>> idx_;
 	std::vector<std::vector<float>> value_;
@@ -0,0 +1,132 @@
+/****
+DIAMOND protein aligner
+Copyright (C) 2013-2019 Benjamin Buchfink <buchfink@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+****/
+
+#include <stdexcept>
+#include "buffer_pool.h"
+#include "../../basic/config.h"
+#include "../log_stream.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+// Mapped buffers are rounded up to the size of a huge page.
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+BufferPool& BufferPool::get()
+{
+	static BufferPool pool;
+	return pool;
+}
+
+BufferPool::Buffer BufferPool::allocate(size_t size)
+{
+#ifdef __linux__
+	if (config.huge_pages != NO_HUGE_PAGES) {
+		size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+		void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+		if (config.huge_pages == EXPLICIT_HUGE_PAGES) {
+			p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (p == MAP_FAILED)
+				log_stream << "Explicit huge pages unavailable, falling back to transparent huge pages." << endl;
+		}
+#endif
+		if (p == MAP_FAILED) {
+			p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (p == MAP_FAILED)
+				throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+			madvise(p, size, MADV_HUGEPAGE);
+#endif
+		}
+		Buffer b = { (char*)p, size, true };
+		return b;
+	}
+#endif
+	Buffer b = { new char[size], size, false };
+	return b;
+}
+
+void BufferPool::release(const Buffer &b)
+{
+#ifdef __linux__
+	if (b.mapped) {
+		munmap(b.ptr, b.size);
+		return;
+	}
+#endif
+	delete[] b.ptr;
+}
+
+char* BufferPool::alloc(size_t size)
+{
+	lock_guard<mutex> lock(mtx_);
+	vector<Buffer>::iterator best = free_.end(), largest = free_.end();
+	for (vector<Buffer>::iterator i = free_.begin(); i != free_.end(); ++i) {
+		if (i->size >= size && (best == free_.end() || i->size < best->size))
+			best = i;
+		if (largest == free_.end() || i->size > largest->size)
+			largest = i;
+	}
+	Buffer b;
+	if (best != free_.end()) {
+		b = *best;
+		free_.erase(best);
+	}
+	else {
+		if (largest != free_.end()) {
+			release(*largest);
+			free_.erase(largest);
+		}
+		b = allocate(size);
+	}
+	used_.push_back(b);
+	return b.ptr;
+}
+
+void BufferPool::free(char *ptr)
+{
+	if (ptr == 0)
+		return;
+	lock_guard<mutex> lock(mtx_);
+	for (vector<Buffer>::iterator i = used_.begin(); i != used_.end(); ++i)
+		if (i->ptr == ptr) {
+			free_.push_back(*i);
+			used_.erase(i);
+			return;
+		}
+	throw std::runtime_error("Buffer not allocated from pool.");
+}
+
+void BufferPool::clear()
+{
+	lock_guard<mutex> lock(mtx_);
+	for (vector<Buffer>::const_iterator i = free_.begin(); i != free_.end(); ++i)
+		release(*i);
+	free_.clear();
+}
+
+BufferPool::~BufferPool()
+{
+	clear();
+	for (vector<Buffer>::const_iterator i = used_.begin(); i != used_.end(); ++i)
+		release(*i);
+}
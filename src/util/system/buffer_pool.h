@@ -0,0 +1,61 @@
+/****
+DIAMOND protein aligner
+Copyright (C) 2013-2019 Benjamin Buchfink <buchfink@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+****/
+
+#ifndef UTIL_SYSTEM_BUFFER_POOL_H_
+#define UTIL_SYSTEM_BUFFER_POOL_H_
+
+#include <stddef.h>
+#include <vector>
+#include <mutex>
+
+// Large buffers for the seed arrays, kept across reference blocks and query chunks. A released buffer is handed out
+// again for any request that fits (best fit), so that its pages do not have to be faulted in anew. When no free buffer
+// fits, the largest one is returned to the system and a buffer of the requested size is allocated, so the pool holds
+// at most as many buffers as were in use at the same time, each no larger than the largest request. The memory kept
+// between blocks is therefore bounded by the seed buffers of the largest block searched so far. It adds to the peak of
+// the alignment phase unless --release-buffers is set. clear() returns the free buffers to the system; it is called
+// before joining the output blocks and at the end of the search.
+struct BufferPool
+{
+
+	enum { NO_HUGE_PAGES = 0, TRANSPARENT_HUGE_PAGES = 1, EXPLICIT_HUGE_PAGES = 2 };
+
+	static BufferPool& get();
+	char* alloc(size_t size);
+	void free(char *ptr);
+	void clear();
+	~BufferPool();
+
+private:
+
+	struct Buffer
+	{
+		char *ptr;
+		size_t size;
+		bool mapped;
+	};
+
+	static Buffer allocate(size_t size);
+	static void release(const Buffer &b);
+
+	std::vector<Buffer> free_, used_;
+	std::mutex mtx_;
+
+};
+
+#endif
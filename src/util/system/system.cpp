@@ -1,5 +1,8 @@
 #include <stdexcept>
 #include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <errno.h>
 #include "system.h"
 #include "../string/string.h"
 
@@ -7,10 +10,17 @@ using namespace std;
 
 #ifdef _MSC_VER
 #include <windows.h>
+#include <process.h>
+#include <sys/utime.h>
+#include <io.h>
+#include <fcntl.h>
 #else
 #include <unistd.h>
-#include <sys/stat.h>
+#include <signal.h>
+#include <utime.h>
 #endif
+#include <sys/types.h>
+#include <sys/stat.h>
 
 string executable_path() {
 	char buf[4096];
@@ -44,4 +54,95 @@ void auto_append_extension_if_exists(string &str, const char *ext) {
 	if (!ends_with(str, ext))
 		if (exists(str + ext))
 			str += ext;
-}
\ No newline at end of file
+}
+
+double file_age(const std::string &file_name) {
+	struct stat buf;
+	if (stat(file_name.c_str(), &buf) != 0)
+		return -1.0;
+	return difftime(time(0), buf.st_mtime);
+}
+
+void touch(const std::string &file_name) {
+#ifdef _MSC_VER
+	_utime(file_name.c_str(), NULL);
+#else
+	utime(file_name.c_str(), NULL);
+#endif
+}
+
+uint64_t file_size(const std::string &file_name) {
+#ifdef _MSC_VER
+	struct _stat64 buf;
+	if (_stat64(file_name.c_str(), &buf) != 0)
+#else
+	struct stat buf;
+	if (stat(file_name.c_str(), &buf) != 0)
+#endif
+		throw runtime_error("Error calling stat on file " + file_name);
+	return (uint64_t)buf.st_size;
+}
+
+void truncate_file(const std::string &file_name, uint64_t size) {
+#ifdef _MSC_VER
+	int fd;
+	if (_sopen_s(&fd, file_name.c_str(), _O_RDWR | _O_BINARY, _SH_DENYNO, _S_IREAD | _S_IWRITE) != 0)
+		throw runtime_error("Error opening file " + file_name);
+	const bool ok = _chsize_s(fd, (int64_t)size) == 0;
+	_close(fd);
+	if (!ok)
+#else
+	if (truncate(file_name.c_str(), (off_t)size) != 0)
+#endif
+		throw runtime_error("Error truncating file " + file_name);
+}
+
+string host_name() {
+	char buf[256];
+#ifdef _MSC_VER
+	DWORD n = sizeof(buf);
+	if (!GetComputerNameA(buf, &n))
+		return string();
+	return string(buf, n);
+#else
+	if (gethostname(buf, sizeof(buf)) != 0)
+		return string();
+	buf[sizeof(buf) - 1] = '\0';
+	return string(buf);
+#endif
+}
+
+int process_id() {
+#ifdef _MSC_VER
+	return _getpid();
+#else
+	return (int)getpid();
+#endif
+}
+
+bool process_alive(int pid) {
+#ifdef _MSC_VER
+	HANDLE h = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, (DWORD)pid);
+	if (h == NULL)
+		return false;
+	DWORD code;
+	const bool r = GetExitCodeProcess(h, &code) && code == STILL_ACTIVE;
+	CloseHandle(h);
+	return r;
+#else
+	if (kill((pid_t)pid, 0) != 0 && errno != EPERM)
+		return false;
+#ifdef __linux__
+	// A killed process that has not been reaped yet still answers kill().
+	FILE *f = fopen(("/proc/" + std::to_string(pid) + "/stat").c_str(), "r");
+	if (f == NULL)
+		return true;
+	char state = 0;
+	const int n = fscanf(f, "%*d (%*[^)]) %c", &state);
+	fclose(f);
+	return n != 1 || state != 'Z';
+#else
+	return true;
+#endif
+#endif
+}
@@ -3,11 +3,20 @@
 
 #include <stdio.h>
 #include <string>
+#include <stdint.h>
 
 std::string executable_path();
 bool exists(const std::string &file_name);
 void auto_append_extension(std::string &str, const char *ext);
 void auto_append_extension_if_exists(std::string &str, const char *ext);
+// Seconds since the last modification of the file, negative if it does not exist.
+double file_age(const std::string &file_name);
+void touch(const std::string &file_name);
+uint64_t file_size(const std::string &file_name);
+void truncate_file(const std::string &file_name, uint64_t size);
+std::string host_name();
+int process_id();
+bool process_alive(int pid);
 size_t getCurrentRSS();
 size_t getPeakRSS();
 
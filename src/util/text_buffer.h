@@ -23,6 +23,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdio.h>
 #include <stdexcept>
 #include <stdint.h>
+#include <string.h>
+#include <cmath>
 #include <limits>
 #include <vector>
 #include "util.h"
@@ -157,37 +159,52 @@ struct TextBuffer
 	
 	TextBuffer& operator<<(unsigned int x)
 	{
-		//write(x);
 		reserve(16);
-		ptr_ += sprintf(ptr_, "%u", x);
+		ptr_ += print_decimal(ptr_, x);
 		return *this;
 	}
 
 	TextBuffer& operator<<(int x)
 	{
-		//write(x);
 		reserve(16);
-		ptr_ += sprintf(ptr_, "%i", x);
+		if (x < 0) {
+			*(ptr_++) = '-';
+			ptr_ += print_decimal(ptr_, uint64_t(0) - (uint64_t)(int64_t)x);
+		}
+		else
+			ptr_ += print_decimal(ptr_, (uint64_t)x);
 		return *this;
 	}
 
 	TextBuffer& operator<<(unsigned long x)
 	{
 		reserve(32);
-		ptr_ += sprintf(ptr_, "%lu", x);
+		ptr_ += print_decimal(ptr_, x);
 		return *this;
 	}
 	
 	TextBuffer& operator<<(unsigned long long x)
 	{
 		reserve(32);
-		ptr_ += sprintf(ptr_, "%llu", x);
+		ptr_ += print_decimal(ptr_, x);
 		return *this;
 	}
 
+	// Same as printf("%.1lf"). Values close to a rounding tie are left to sprintf.
 	TextBuffer& operator<<(double x)
 	{
 		reserve(32);
+		const double y = x * 10.0;
+		if (x >= 0.0 && !std::signbit(x) && y < 1e9) {
+			const double f = std::floor(y), d = y - f;
+			if (std::fabs(d - 0.5) > 1e-6) {
+				const uint64_t n = (uint64_t)f + (d > 0.5 ? 1 : 0);
+				ptr_ += print_decimal(ptr_, n / 10);
+				*(ptr_++) = '.';
+				*(ptr_++) = char('0' + n % 10);
+				return *this;
+			}
+		}
 		ptr_ += sprintf(ptr_, "%.1lf", x);
 		return *this;
 	}
@@ -199,9 +216,45 @@ struct TextBuffer
 		return *this;
 	}
 
+	// Same as printf("%.1le"), with the same fallback as operator<<(double).
 	TextBuffer& print_e(double x)
 	{
 		reserve(32);
+		if (x == 0.0 && !std::signbit(x)) {
+			memcpy(ptr_, "0.0e+00", 7);
+			ptr_ += 7;
+			return *this;
+		}
+		if (x >= std::numeric_limits<double>::min() && x <= std::numeric_limits<double>::max()) {
+			int e = (int)std::floor(std::log10(x));
+			double y = x * std::pow(10.0, 1 - e);
+			if (y < 10.0) {
+				y *= 10.0;
+				--e;
+			}
+			else if (y >= 100.0) {
+				y /= 10.0;
+				++e;
+			}
+			const double f = std::floor(y), d = y - f;
+			if (std::fabs(d - 0.5) > 1e-6 && y > 9.0 && y < 101.0) {
+				unsigned n = (unsigned)f + (d > 0.5 ? 1 : 0);
+				if (n == 100) {
+					n = 10;
+					++e;
+				}
+				*(ptr_++) = char('0' + n / 10);
+				*(ptr_++) = '.';
+				*(ptr_++) = char('0' + n % 10);
+				*(ptr_++) = 'e';
+				*(ptr_++) = e < 0 ? '-' : '+';
+				const unsigned a = e < 0 ? -e : e;
+				if (a < 10)
+					*(ptr_++) = '0';
+				ptr_ += print_decimal(ptr_, a);
+				return *this;
+			}
+		}
 		ptr_ += sprintf(ptr_, "%.1le", x);
 		return *this;
 	}
@@ -239,6 +292,28 @@ struct TextBuffer
 		return data_[pos];
 	}
 
+	// Writes the decimal digits of x to ptr and returns their number.
+	static size_t print_decimal(char *ptr, uint64_t x)
+	{
+		static const char digits[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+		char buf[20], *p = buf + sizeof(buf);
+		while (x >= 100) {
+			const size_t i = size_t(x % 100) * 2;
+			x /= 100;
+			*(--p) = digits[i + 1];
+			*(--p) = digits[i];
+		}
+		if (x >= 10) {
+			*(--p) = digits[x * 2 + 1];
+			*(--p) = digits[x * 2];
+		}
+		else
+			*(--p) = char('0' + x);
+		const size_t n = buf + sizeof(buf) - p;
+		memcpy(ptr, p, n);
+		return n;
+	}
+
 protected:
 	enum { block_size = 4096 };
 	char *data_, *ptr_;
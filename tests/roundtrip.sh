@@ -0,0 +1,103 @@
+#!/bin/sh
+# Round-trip and equivalence checks of the output formats and database tools, run by ctest on generated sequences.
+# Usage: roundtrip.sh <diamond binary> <daa|column|append|shards|mcl>
+set -e
+diamond=$1
+check=$2
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+run()
+{
+	"$diamond" "$@" --quiet
+}
+
+same()
+{
+	if ! cmp -s "$1" "$2"; then
+		echo "$1 and $2 differ."
+		exit 1
+	fi
+}
+
+# 100 families of 4 sequences with 20% substitutions between the members. Three members of each family go into the
+# database, the fourth is the query.
+awk 'BEGIN {
+	srand(1)
+	a = "ACDEFGHIKLMNPQRSTVWY"
+	for (f = 0; f < 100; ++f) {
+		len = 100 + int(rand() * 300)
+		s = ""
+		for (i = 0; i < len; ++i)
+			s = s substr(a, 1 + int(rand() * 20), 1)
+		for (m = 0; m < 4; ++m) {
+			t = ""
+			for (i = 1; i <= len; ++i)
+				t = t (rand() < 0.2 ? substr(a, 1 + int(rand() * 20), 1) : substr(s, i, 1))
+			out = m < 3 ? "db.fa" : "q.fa"
+			print ">f" f "_" m " family " f > out
+			print t > out
+		}
+	}
+}'
+run makedb --in db.fa -d db
+
+case $check in
+daa)
+	run blastp -q q.fa -d db -o direct.tsv
+	run blastp -q q.fa -d db -f 100 -o plain.daa
+	run blastp -q q.fa -d db -f 100 --daa-block-compression -o blocks.daa
+	run view -a plain.daa -o plain.tsv
+	run view -a blocks.daa -o blocks.tsv
+	run view -a blocks.daa -o blocks_parallel.tsv -p 4
+	same direct.tsv plain.tsv
+	same direct.tsv blocks.tsv
+	same direct.tsv blocks_parallel.tsv
+	;;
+column)
+	fields="qseqid sseqid pident length mismatch gapopen qstart qend sstart send evalue bitscore score qlen slen"
+	run blastp -q q.fa -d db -f 6 $fields -o direct.tsv
+	run blastp -q q.fa -d db -f 104 $fields -o columns.bin
+	run view -a columns.bin -o columns.tsv
+	same direct.tsv columns.tsv
+	;;
+append)
+	head -n 300 db.fa > a.fa
+	tail -n +301 db.fa > b.fa
+	run makedb --in a.fa -d appended
+	run makedb --in b.fa -d appended --append
+	"$diamond" dbinfo -d db.dmnd | grep -v "^Database format version" > db.info
+	"$diamond" dbinfo -d appended.dmnd | grep -v "^Database format version" > appended.info
+	same db.info appended.info
+	run blastp -q q.fa -d db -o direct.tsv
+	run blastp -q q.fa -d appended -o appended.tsv
+	same direct.tsv appended.tsv
+	;;
+shards)
+	run dbsplit -d db --shards 3 -o shard
+	for f in "qseqid sseqid pident length evalue bitscore score" "qseqid sseqid pident length evalue bitscore"; do
+		run blastp -q q.fa -d db -f 6 $f -k 2 -o direct.tsv
+		for i in 0 1 2; do
+			run blastp -q q.fa -d shard.$i -f 6 $f -k 2 -o shard.$i.tsv
+		done
+		run merge-shards -q q.fa --shard-out shard.0.tsv shard.1.tsv shard.2.tsv -f 6 $f -k 2 -o merged.tsv
+		same direct.tsv merged.tsv
+	done
+	;;
+mcl)
+	run blastp -q db.fa -d db -f 6 qseqid sseqid bitscore -o all.tsv
+	run blastp -q db.fa -d db -f 100 -o all.daa
+	run mcl -q all.tsv -o tsv.mcl -p 1
+	run mcl -q all.tsv -o parallel.mcl -p 4
+	run mcl -q all.daa -o daa.mcl
+	same tsv.mcl parallel.mcl
+	same tsv.mcl daa.mcl
+	# No cluster mixes families.
+	awk '{ split($1, x, "_"); for (i = 2; i <= NF; ++i) if (index($i, x[1] "_") != 1) exit 1 }' tsv.mcl || { echo "A cluster mixes families."; exit 1; }
+	;;
+*)
+	echo "Unknown check: $check"
+	exit 1
+	;;
+esac